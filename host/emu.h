@@ -0,0 +1,64 @@
+// Internals shared by the emulator's stand-ins for the RTOS, clock, network
+// and HTTP server.
+//
+// Tasks run on threads, but only one at a time, like on the single core
+// ESP8266: a task holds the emulated CPU while it runs firmware code, and
+// releases it while blocked in the RTOS, or on a socket. Task priorities are
+// ignored, and there's no preemption. Time is the host's monotonic clock,
+// sped up by a constant factor.
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "int_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+  const char *name;
+  // Host CPU time used, and time spent ready but waiting for the emulated
+  // CPU.
+  u64 cpuNs;
+  u64 cpuWaitNs;
+  bool deleted;
+} EmuTaskStats;
+
+typedef struct {
+  u32 requests;
+  // Requests with no handler for the URI and method.
+  u32 notFound;
+  u32 connections;
+  u64 bytesSent;
+  // Host CPU time in handlers.
+  u64 handlerNs;
+  u64 maxHandlerNs;
+} EmuHttpStats;
+
+// Clock.
+void emuClockInit(double speed, s64 startEpoch, s32 syncAfterS);
+u64 emuNowUs();
+// Sleep until the given emulated time, with the CPU released.
+void emuSleepUntilUs(u64 us);
+// Convert an emulated time to a CLOCK_MONOTONIC deadline.
+struct timespec emuDeadline(u64 us);
+
+// Emulated CPU. The calling thread must be a task, see emuTaskAdopt().
+void emuCpuAcquire();
+void emuCpuRelease();
+// Make the calling thread a task, e.g. the main thread for app_main().
+void emuTaskAdopt(const char *name);
+// Stats for each task created so far. Call with the CPU held.
+int emuTaskCount();
+void emuTaskGetStats(int idx, EmuTaskStats *stats);
+
+// Network.
+void emuNetInit(double connectAfterS, u16 httpPort);
+u16 emuHttpPort();
+const EmuHttpStats *emuHttpGetStats();
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
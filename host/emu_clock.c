@@ -0,0 +1,92 @@
+// Clock, esp_timer and SNTP stand-ins for the emulator.
+//
+// The emulated time is the host's monotonic clock since startup, multiplied
+// by the speed. Until SNTP "syncs", time() counts from 1970 like the
+// device's clock does after a reset. After that, it counts from the start
+// epoch given on the command line.
+
+#include <stdbool.h>
+#include <time.h>
+
+#include "esp_sntp.h"
+#include "esp_timer.h"
+
+#include "emu.h"
+
+static double speed = 1;
+static u64 startNs = 0;
+static s64 startEpoch = 0;
+// Seconds from sntp_init() to the sync. Negative to never sync.
+static s32 syncAfterS = 0;
+
+static bool sntpStarted = false;
+static u64 syncAtUs = 0;
+static bool synced = false;
+static bool syncReported = false;
+static sntp_sync_time_cb_t syncCallback = NULL;
+
+static u64 monotonicNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (u64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void emuClockInit(double clockSpeed, s64 epoch, s32 syncAfter) {
+  speed = clockSpeed;
+  startNs = monotonicNs();
+  startEpoch = epoch;
+  syncAfterS = syncAfter;
+}
+
+u64 emuNowUs() { return (u64)((monotonicNs() - startNs) * speed / 1000); }
+
+struct timespec emuDeadline(u64 us) {
+  u64 ns = startNs + (u64)(us * 1000 / speed);
+  struct timespec ts = {(time_t)(ns / 1000000000), (long)(ns % 1000000000)};
+  return ts;
+}
+
+int64_t esp_timer_get_time() { return (int64_t)emuNowUs(); }
+
+static void updateSync() {
+  if (sntpStarted && !synced && syncAfterS >= 0 && emuNowUs() >= syncAtUs) {
+    synced = true;
+  }
+}
+
+// Replaces the C library's time(), which the firmware reads the system
+// clock with.
+time_t time(time_t *t) {
+  updateSync();
+  time_t now = (time_t)(emuNowUs() / 1000000) + (synced ? startEpoch : 0);
+  if (t) {
+    *t = now;
+  }
+  return now;
+}
+
+void sntp_setoperatingmode(int mode) {}
+void sntp_setservername(int idx, const char *server) {}
+
+void sntp_set_time_sync_notification_cb(sntp_sync_time_cb_t callback) {
+  syncCallback = callback;
+}
+
+void sntp_init() {
+  sntpStarted = true;
+  syncAtUs = emuNowUs() + (u64)(syncAfterS > 0 ? syncAfterS : 0) * 1000000;
+}
+
+// Like the SDK, reports the sync once, then goes back to reset.
+sntp_sync_status_t sntp_get_sync_status() {
+  updateSync();
+  if (!synced || syncReported) {
+    return SNTP_SYNC_STATUS_RESET;
+  }
+  syncReported = true;
+  if (syncCallback) {
+    struct timeval tv = {time(NULL), 0};
+    syncCallback(&tv);
+  }
+  return SNTP_SYNC_STATUS_COMPLETED;
+}
@@ -0,0 +1,515 @@
+// esp_http_server stand-in for the emulator. Serves the registered handlers
+// on 127.0.0.1, from a single task that polls all connections and handles
+// one request at a time, like the SDK's server. Supports keep-alive,
+// chunked responses and request bodies with a Content-Length.
+
+#include <arpa/inet.h>
+#include <ctype.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_http_server.h"
+
+#include "emu.h"
+
+#define MAX_REQUEST_BYTES 8192
+#define MAX_SERVERS 2
+
+typedef struct {
+  int fd;
+  size_t len;
+  char buf[MAX_REQUEST_BYTES];
+} Conn;
+
+typedef struct {
+  httpd_config_t config;
+  int listenFd;
+  bool stopping;
+  int handlerCount;
+  httpd_uri_t *handlers;
+  Conn *conns;
+} Server;
+
+// The parts of the request and response that aren't in httpd_req_t.
+typedef struct {
+  Conn *conn;
+  // Header lines of the request, NUL terminated.
+  const char *headers;
+  const char *query;
+  const char *body;
+  // Bytes of the body that came with the headers. Requests that don't fit
+  // the buffer get the rest from the socket, as it arrives.
+  size_t bodyBuffered;
+  size_t bodyRead;
+  const char *status;
+  const char *type;
+  const char *hdrFields[8];
+  const char *hdrValues[8];
+  int hdrCount;
+  bool headersSent;
+  bool failed;
+  bool close;
+} ReqAux;
+
+static EmuHttpStats stats;
+
+const EmuHttpStats *emuHttpGetStats() { return &stats; }
+
+static u64 threadCpuNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return (u64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Send with the CPU released, like lwIP blocking the httpd task.
+static bool sendAll(ReqAux *aux, const char *buf, size_t len) {
+  if (aux->failed) {
+    return false;
+  }
+  emuCpuRelease();
+  while (len) {
+    ssize_t n = send(aux->conn->fd, buf, len, MSG_NOSIGNAL);
+    if (n <= 0) {
+      aux->failed = true;
+      break;
+    }
+    stats.bytesSent += n;
+    buf += n;
+    len -= n;
+  }
+  emuCpuAcquire();
+  return !aux->failed;
+}
+
+static bool sendHeaders(ReqAux *aux, ssize_t contentLength) {
+  char head[1024];
+  int n = snprintf(head, sizeof(head), "HTTP/1.1 %s\r\nContent-Type: %s\r\n",
+                   aux->status, aux->type);
+  for (int i = 0; i < aux->hdrCount; ++i) {
+    n += snprintf(head + n, sizeof(head) - n, "%s: %s\r\n", aux->hdrFields[i],
+                  aux->hdrValues[i]);
+  }
+  if (contentLength >= 0) {
+    n += snprintf(head + n, sizeof(head) - n, "Content-Length: %zd\r\n\r\n",
+                  contentLength);
+  } else {
+    n += snprintf(head + n, sizeof(head) - n,
+                  "Transfer-Encoding: chunked\r\n\r\n");
+  }
+  aux->headersSent = true;
+  return sendAll(aux, head, n);
+}
+
+esp_err_t httpd_resp_set_status(httpd_req_t *r, const char *status) {
+  ((ReqAux *)r->aux)->status = status;
+  return ESP_OK;
+}
+
+esp_err_t httpd_resp_set_type(httpd_req_t *r, const char *type) {
+  ((ReqAux *)r->aux)->type = type;
+  return ESP_OK;
+}
+
+esp_err_t httpd_resp_set_hdr(httpd_req_t *r, const char *field,
+                             const char *value) {
+  ReqAux *aux = r->aux;
+  if (aux->hdrCount == sizeof(aux->hdrFields) / sizeof(aux->hdrFields[0])) {
+    return ESP_ERR_HTTPD_RESP_HDR;
+  }
+  aux->hdrFields[aux->hdrCount] = field;
+  aux->hdrValues[aux->hdrCount++] = value;
+  return ESP_OK;
+}
+
+esp_err_t httpd_resp_send(httpd_req_t *r, const char *buf, ssize_t buf_len) {
+  ReqAux *aux = r->aux;
+  if (buf_len == HTTPD_RESP_USE_STRLEN) {
+    buf_len = buf ? strlen(buf) : 0;
+  }
+  if (!sendHeaders(aux, buf_len) || (buf_len && !sendAll(aux, buf, buf_len))) {
+    return ESP_ERR_HTTPD_RESP_SEND;
+  }
+  return ESP_OK;
+}
+
+esp_err_t httpd_resp_send_chunk(httpd_req_t *r, const char *buf,
+                                ssize_t buf_len) {
+  ReqAux *aux = r->aux;
+  if (buf_len == HTTPD_RESP_USE_STRLEN) {
+    buf_len = buf ? strlen(buf) : 0;
+  }
+  if (!aux->headersSent && !sendHeaders(aux, -1)) {
+    return ESP_ERR_HTTPD_RESP_SEND;
+  }
+  char size[16];
+  int n = snprintf(size, sizeof(size), "%zx\r\n", buf_len);
+  if (!sendAll(aux, size, n) || (buf_len && !sendAll(aux, buf, buf_len)) ||
+      !sendAll(aux, "\r\n", 2)) {
+    return ESP_ERR_HTTPD_RESP_SEND;
+  }
+  return ESP_OK;
+}
+
+esp_err_t httpd_resp_send_err(httpd_req_t *req, httpd_err_code_t error,
+                              const char *msg) {
+  static const char *statuses[] = {
+      "400 Bad Request", "404 Not Found", "405 Method Not Allowed",
+      "408 Request Timeout", "500 Internal Server Error"};
+  httpd_resp_set_status(req, statuses[error]);
+  httpd_resp_set_type(req, "text/html");
+  return httpd_resp_send(req, msg, HTTPD_RESP_USE_STRLEN);
+}
+
+esp_err_t httpd_resp_send_404(httpd_req_t *r) {
+  return httpd_resp_send_err(r, HTTPD_404_NOT_FOUND,
+                             "This URI does not exist");
+}
+
+// Find a request header. Returns the value and its length, or NULL.
+static const char *findHeader(httpd_req_t *r, const char *field, size_t *len) {
+  size_t fieldLen = strlen(field);
+  for (const char *line = ((ReqAux *)r->aux)->headers; *line;) {
+    const char *end = strstr(line, "\r\n");
+    if (!end) {
+      break;
+    }
+    if (!strncasecmp(line, field, fieldLen) && line[fieldLen] == ':') {
+      const char *v = line + fieldLen + 1;
+      while (v < end && *v == ' ') {
+        ++v;
+      }
+      *len = end - v;
+      return v;
+    }
+    line = end + 2;
+  }
+  return NULL;
+}
+
+size_t httpd_req_get_hdr_value_len(httpd_req_t *r, const char *field) {
+  size_t len;
+  return findHeader(r, field, &len) ? len : 0;
+}
+
+esp_err_t httpd_req_get_hdr_value_str(httpd_req_t *r, const char *field,
+                                      char *val, size_t val_size) {
+  size_t len;
+  const char *v = findHeader(r, field, &len);
+  if (!v) {
+    return ESP_ERR_NOT_FOUND;
+  }
+  snprintf(val, val_size, "%.*s", (int)len, v);
+  return len < val_size ? ESP_OK : ESP_ERR_HTTPD_RESULT_TRUNC;
+}
+
+size_t httpd_req_get_url_query_len(httpd_req_t *r) {
+  const char *q = ((ReqAux *)r->aux)->query;
+  return q ? strlen(q) : 0;
+}
+
+esp_err_t httpd_req_get_url_query_str(httpd_req_t *r, char *buf,
+                                      size_t buf_len) {
+  const char *q = ((ReqAux *)r->aux)->query;
+  if (!q) {
+    return ESP_ERR_NOT_FOUND;
+  }
+  snprintf(buf, buf_len, "%s", q);
+  return strlen(q) < buf_len ? ESP_OK : ESP_ERR_HTTPD_RESULT_TRUNC;
+}
+
+esp_err_t httpd_query_key_value(const char *qry, const char *key, char *val,
+                                size_t val_size) {
+  size_t keyLen = strlen(key);
+  for (const char *p = qry; p && *p;) {
+    const char *end = strchr(p, '&');
+    size_t len = end ? (size_t)(end - p) : strlen(p);
+    if (len > keyLen && !strncmp(p, key, keyLen) && p[keyLen] == '=') {
+      size_t valueLen = len - keyLen - 1;
+      snprintf(val, val_size, "%.*s", (int)valueLen, p + keyLen + 1);
+      return valueLen < val_size ? ESP_OK : ESP_ERR_HTTPD_RESULT_TRUNC;
+    }
+    p = end ? end + 1 : NULL;
+  }
+  return ESP_ERR_NOT_FOUND;
+}
+
+int httpd_req_recv(httpd_req_t *r, char *buf, size_t buf_len) {
+  ReqAux *aux = r->aux;
+  size_t left = r->content_len - aux->bodyRead;
+  size_t n = buf_len < left ? buf_len : left;
+  if (aux->bodyRead < aux->bodyBuffered) {
+    size_t buffered = aux->bodyBuffered - aux->bodyRead;
+    n = n < buffered ? n : buffered;
+    memcpy(buf, aux->body + aux->bodyRead, n);
+  } else if (n) {
+    Server *s = r->handle;
+    struct pollfd p = {aux->conn->fd, POLLIN, 0};
+    emuCpuRelease();
+    int ready = poll(&p, 1, s->config.recv_wait_timeout * 1000);
+    ssize_t got = ready > 0 ? recv(aux->conn->fd, buf, n, 0) : -1;
+    emuCpuAcquire();
+    if (got <= 0) {
+      aux->failed = true;
+      return ready == 0 ? HTTPD_SOCK_ERR_TIMEOUT : HTTPD_SOCK_ERR_FAIL;
+    }
+    n = (size_t)got;
+  }
+  aux->bodyRead += n;
+  return (int)n;
+}
+
+static int parseMethod(const char *m, size_t len) {
+  static const char *names[] = {"DELETE", "GET", "HEAD", "POST", "PUT"};
+  for (int i = 0; i < (int)(sizeof(names) / sizeof(names[0])); ++i) {
+    if (strlen(names[i]) == len && !strncmp(m, names[i], len)) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// Handle the request at the start of the connection's buffer, if it's all
+// there. Returns the bytes it took, 0 if it's incomplete, or -1 to close the
+// connection.
+static ssize_t handleRequest(Server *s, Conn *c) {
+  c->buf[c->len] = 0;
+  char *headerEnd = strstr(c->buf, "\r\n\r\n");
+  if (!headerEnd) {
+    return c->len == MAX_REQUEST_BYTES ? -1 : 0;
+  }
+  char *lineEnd = strstr(c->buf, "\r\n");
+  char *sp1 = memchr(c->buf, ' ', lineEnd - c->buf);
+  char *sp2 = sp1 ? memchr(sp1 + 1, ' ', lineEnd - sp1 - 1) : NULL;
+  if (!sp2 || sp2 - sp1 - 1 > HTTPD_MAX_URI_LEN) {
+    return -1;
+  }
+
+  httpd_req_t req = {0};
+  ReqAux aux = {0};
+  req.handle = s;
+  req.aux = &aux;
+  req.method = parseMethod(c->buf, sp1 - c->buf);
+  memcpy((char *)req.uri, sp1 + 1, sp2 - sp1 - 1);
+  aux.conn = c;
+  aux.status = HTTPD_200;
+  aux.type = "text/html";
+  aux.close = !strncmp(sp2 + 1, "HTTP/1.0", 8);
+
+  // Terminate the header lines after the last CRLF.
+  headerEnd[2] = 0;
+  aux.headers = lineEnd + 2;
+  size_t len;
+  const char *v = findHeader(&req, "Content-Length", &len);
+  req.content_len = v ? strtoul(v, NULL, 10) : 0;
+  size_t total = headerEnd + 4 - c->buf + req.content_len;
+  bool streamed = total > MAX_REQUEST_BYTES;
+  if (!streamed && total > c->len) {
+    headerEnd[2] = '\r';
+    return 0;
+  }
+  aux.body = headerEnd + 4;
+  // All that's buffered is this request's, when it's streamed.
+  aux.bodyBuffered = (streamed ? c->len : total) - (headerEnd + 4 - c->buf);
+  v = findHeader(&req, "Connection", &len);
+  if (v && len == 5 && !strncasecmp(v, "close", 5)) {
+    aux.close = true;
+  }
+
+  char *query = strchr(req.uri, '?');
+  if (query) {
+    *query = 0;
+    aux.query = query + 1;
+  }
+
+  ++stats.requests;
+  const httpd_uri_t *h = NULL;
+  bool uriMatched = false;
+  for (int i = 0; i < s->handlerCount; ++i) {
+    if (!strcmp(s->handlers[i].uri, req.uri)) {
+      uriMatched = true;
+      if ((int)s->handlers[i].method == req.method) {
+        h = &s->handlers[i];
+      }
+    }
+  }
+  if (!h) {
+    ++stats.notFound;
+    if (uriMatched) {
+      httpd_resp_send_err(&req, HTTPD_405_METHOD_NOT_ALLOWED,
+                          "Request method for this URI is not handled by "
+                          "server");
+    } else {
+      httpd_resp_send_404(&req);
+    }
+  } else {
+    req.user_ctx = h->user_ctx;
+    u64 start = threadCpuNs();
+    esp_err_t err = h->handler(&req);
+    u64 ns = threadCpuNs() - start;
+    stats.handlerNs += ns;
+    if (ns > stats.maxHandlerNs) {
+      stats.maxHandlerNs = ns;
+    }
+    if (err != ESP_OK) {
+      aux.close = true;
+    }
+  }
+  if (streamed) {
+    // What the handler didn't read is still on the socket.
+    bool unread = aux.bodyRead < req.content_len;
+    return aux.failed || aux.close || unread ? -1 : (ssize_t)c->len;
+  }
+  return aux.failed || aux.close ? -1 : (ssize_t)total;
+}
+
+static void closeConn(Conn *c) {
+  close(c->fd);
+  c->fd = -1;
+  c->len = 0;
+}
+
+static void serverTask(void *param) {
+  Server *s = param;
+  int maxConns = s->config.max_open_sockets;
+  struct pollfd *fds = calloc(maxConns + 1, sizeof(struct pollfd));
+  while (!s->stopping) {
+    fds[0].fd = s->listenFd;
+    fds[0].events = POLLIN;
+    for (int i = 0; i < maxConns; ++i) {
+      fds[i + 1].fd = s->conns[i].fd;
+      fds[i + 1].events = POLLIN;
+    }
+    emuCpuRelease();
+    int ready = poll(fds, maxConns + 1, 100);
+    emuCpuAcquire();
+    if (ready <= 0) {
+      continue;
+    }
+
+    if (fds[0].revents & POLLIN) {
+      int fd = accept(s->listenFd, NULL, NULL);
+      int slot = -1;
+      for (int i = 0; i < maxConns && slot < 0; ++i) {
+        if (s->conns[i].fd < 0) {
+          slot = i;
+        }
+      }
+      if (fd >= 0 && slot < 0) {
+        // Out of sockets, and LRU purging is off.
+        close(fd);
+      } else if (fd >= 0) {
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        s->conns[slot].fd = fd;
+        s->conns[slot].len = 0;
+        ++stats.connections;
+      }
+    }
+
+    for (int i = 0; i < maxConns; ++i) {
+      Conn *c = &s->conns[i];
+      if (c->fd < 0 || !(fds[i + 1].revents & (POLLIN | POLLHUP | POLLERR))) {
+        continue;
+      }
+      ssize_t n = recv(c->fd, c->buf + c->len, MAX_REQUEST_BYTES - c->len, 0);
+      if (n <= 0) {
+        closeConn(c);
+        continue;
+      }
+      c->len += n;
+      // Handle every complete request, for pipelining clients.
+      while (c->fd >= 0) {
+        ssize_t used = handleRequest(s, c);
+        if (used < 0) {
+          closeConn(c);
+        } else if (used == 0) {
+          break;
+        } else {
+          memmove(c->buf, c->buf + used, c->len - used);
+          c->len -= used;
+        }
+      }
+    }
+  }
+  for (int i = 0; i < maxConns; ++i) {
+    if (s->conns[i].fd >= 0) {
+      closeConn(&s->conns[i]);
+    }
+  }
+  close(s->listenFd);
+  free(fds);
+  free(s->conns);
+  free(s->handlers);
+  free(s);
+}
+
+esp_err_t httpd_start(httpd_handle_t *handle, const httpd_config_t *config) {
+  Server *s = calloc(1, sizeof(Server));
+  s->config = *config;
+  // The device listens on port 80. Use the emulator's port instead.
+  s->config.server_port = emuHttpPort();
+  s->handlers = calloc(config->max_uri_handlers, sizeof(httpd_uri_t));
+  s->conns = calloc(config->max_open_sockets, sizeof(Conn));
+  for (int i = 0; i < config->max_open_sockets; ++i) {
+    s->conns[i].fd = -1;
+  }
+
+  s->listenFd = socket(AF_INET, SOCK_STREAM, 0);
+  int one = 1;
+  setsockopt(s->listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  struct sockaddr_in addr = {0};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(s->config.server_port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (s->listenFd < 0 ||
+      bind(s->listenFd, (struct sockaddr *)&addr, sizeof(addr)) ||
+      listen(s->listenFd, config->backlog_conn)) {
+    perror("httpd_start");
+    if (s->listenFd >= 0) {
+      close(s->listenFd);
+    }
+    free(s->conns);
+    free(s->handlers);
+    free(s);
+    return ESP_FAIL;
+  }
+
+  if (xTaskCreate(serverTask, "httpd", config->stack_size, s,
+                  config->task_priority, NULL) != pdPASS) {
+    return ESP_ERR_HTTPD_TASK;
+  }
+  *handle = s;
+  return ESP_OK;
+}
+
+esp_err_t httpd_stop(httpd_handle_t handle) {
+  // The server task frees everything when it sees this.
+  ((Server *)handle)->stopping = true;
+  return ESP_OK;
+}
+
+esp_err_t httpd_register_uri_handler(httpd_handle_t handle,
+                                     const httpd_uri_t *uri_handler) {
+  Server *s = handle;
+  for (int i = 0; i < s->handlerCount; ++i) {
+    if (!strcmp(s->handlers[i].uri, uri_handler->uri) &&
+        s->handlers[i].method == uri_handler->method) {
+      return ESP_ERR_HTTPD_HANDLER_EXISTS;
+    }
+  }
+  if (s->handlerCount == s->config.max_uri_handlers) {
+    return ESP_ERR_HTTPD_HANDLERS_FULL;
+  }
+  s->handlers[s->handlerCount++] = *uri_handler;
+  return ESP_OK;
+}
@@ -0,0 +1,322 @@
+// Run the whole firmware on Linux, serving its HTTP handlers on localhost.
+//
+// app_main() and every task run unmodified on the stand-ins in emu_*.c: the
+// RTOS on threads, the clock sped up by --speed, SNTP syncing after
+// --sync-after seconds, and the network coming up after --connect-after
+// seconds. The DS18B20s are simulated on the 1-Wire bus, following a
+// scripted temperature: a trace, or a synthetic daily cycle.
+//
+//   emulator --speed 60 --duration 3600 &
+//   curl localhost:8080/
+//
+// The publisher sends to --publish, e.g. a host/udp_collector.
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "alerts.h"
+#include "emu.h"
+#include "host_shims.h"
+#include "int_types.h"
+#include "log_ring.h"
+#include "onewire_sim.h"
+#include "power.h"
+#include "publisher.h"
+#include "sampler.h"
+#include "sdkconfig.h"
+#include "temperature_tracker.h"
+
+extern "C" void app_main();
+
+namespace {
+
+const u32 MAX_LINE_LENGTH = 256;
+const u32 SCRIPT_PERIOD_MS = 1000;
+
+struct Options {
+  u16 port = 8080;
+  double speed = 1;
+  s64 start = 0;
+  s32 syncAfter = 5;
+  double connectAfter = 2;
+  u32 sensors = 1;
+  const char *tracePath = nullptr;
+  // Emulated seconds to run for. 0 to run until interrupted.
+  double duration = 0;
+  // Days of history to fill the tracker with before startup.
+  u32 historyDays = 0;
+  // Collector for the publisher, instead of the configured one.
+  std::string publishHost;
+  u16 publishPort = 0;
+};
+
+struct Sample {
+  s64 epoch;
+  float celsius;
+};
+
+Options options;
+std::vector<Sample> trace;
+std::atomic<bool> interrupted(false);
+
+void usage(const char *argv0) {
+  fprintf(stderr,
+          "Usage: %s [options]\n"
+          "  --port N           HTTP port on 127.0.0.1 (default 8080)\n"
+          "  --speed X          Emulated seconds per second (default 1)\n"
+          "  --start EPOCH      Time NTP syncs to, at startup (default now)\n"
+          "  --sync-after S     Seconds until NTP syncs, -1 for never "
+          "(default 5)\n"
+          "  --connect-after S  Seconds until WiFi connects (default 2)\n"
+          "  --sensors N        Number of DS18B20s on the bus (default 1)\n"
+          "  --trace FILE       CSV of epoch,celsius for the sensors to "
+          "follow\n"
+          "  --duration S       Emulated seconds to run, 0 until SIGINT "
+          "(default 0)\n"
+          "  --history-days N   Days of history to start with, ending "
+          "yesterday\n"
+          "  --publish HOST:PORT  UDP collector to publish to (default "
+          "%s:%u)\n"
+          "  --verbose          Print the firmware's log\n",
+          argv0, CONFIG_PUBLISH_HOST, CONFIG_PUBLISH_PORT);
+  exit(2);
+}
+
+bool parseOptions(int argc, char **argv) {
+  // time() is the emulated clock, see emu_clock.c.
+  struct timespec realtime;
+  clock_gettime(CLOCK_REALTIME, &realtime);
+  options.start = (s64)realtime.tv_sec;
+  for (int i = 1; i < argc; ++i) {
+    const char *arg = argv[i];
+    const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+    if (!strcmp(arg, "--verbose")) {
+      hostVerbose = true;
+      continue;
+    }
+    if (!value) {
+      return false;
+    }
+    ++i;
+    if (!strcmp(arg, "--port")) {
+      options.port = (u16)atoi(value);
+    } else if (!strcmp(arg, "--speed")) {
+      options.speed = atof(value);
+    } else if (!strcmp(arg, "--start")) {
+      options.start = atoll(value);
+    } else if (!strcmp(arg, "--sync-after")) {
+      options.syncAfter = atoi(value);
+    } else if (!strcmp(arg, "--connect-after")) {
+      options.connectAfter = atof(value);
+    } else if (!strcmp(arg, "--sensors")) {
+      options.sensors = (u32)atoi(value);
+    } else if (!strcmp(arg, "--trace")) {
+      options.tracePath = value;
+    } else if (!strcmp(arg, "--duration")) {
+      options.duration = atof(value);
+    } else if (!strcmp(arg, "--history-days")) {
+      options.historyDays = (u32)atoi(value);
+    } else if (!strcmp(arg, "--publish")) {
+      const char *colon = strrchr(value, ':');
+      if (!colon) {
+        return false;
+      }
+      options.publishHost.assign(value, colon - value);
+      options.publishPort = (u16)atoi(colon + 1);
+    } else {
+      return false;
+    }
+  }
+  return options.speed > 0 && options.sensors > 0;
+}
+
+bool loadTrace(const char *path) {
+  FILE *f = fopen(path, "r");
+  if (!f) {
+    perror(path);
+    return false;
+  }
+  char line[MAX_LINE_LENGTH];
+  while (fgets(line, sizeof(line), f)) {
+    Sample s;
+    if (sscanf(line, "%lld,%f", (long long *)&s.epoch, &s.celsius) == 2) {
+      trace.push_back(s);
+    }
+  }
+  fclose(f);
+  if (trace.empty()) {
+    fprintf(stderr, "%s: no samples\n", path);
+    return false;
+  }
+  return true;
+}
+
+// The temperature at an epoch: the last trace sample at or before it, or a
+// daily cycle between 15 and 25 C, coldest at 4:00 UTC.
+float scriptedCelsius(s64 epoch) {
+  if (trace.empty()) {
+    double day = (epoch % 86400) / 86400.0;
+    return (float)(20 - 5 * std::cos(2 * M_PI * (day - 4 / 24.0)));
+  }
+  // The trace starts at boot, wherever its first epoch is.
+  s64 t = trace.front().epoch + (epoch - options.start);
+  size_t lo = 0;
+  size_t hi = trace.size();
+  while (hi - lo > 1) {
+    size_t mid = (lo + hi) / 2;
+    (trace[mid].epoch <= t ? lo : hi) = mid;
+  }
+  return trace[lo].celsius;
+}
+
+// Fill the tracker with the days before the start, from hourly readings of
+// the script, as if the device had been running all along.
+void preloadHistory() {
+  for (u32 d = options.historyDays; d > 0; --d) {
+    s64 dayStart = options.start - (s64)d * 86400;
+    for (u32 h = 0; h < 24; ++h) {
+      s64 t = dayStart + h * 3600;
+      registerTempAt((Temp16)std::lround(scriptedCelsius(t) * 16), (time_t)t);
+    }
+  }
+}
+
+// Moves the simulated sensors' temperatures along with the emulated clock.
+// Each sensor reads a little warmer than the one before it.
+void scriptTask(void *param) {
+  TickType_t lastWake = xTaskGetTickCount();
+  while (true) {
+    s64 epoch = options.start + (s64)(emuNowUs() / 1000000);
+    float celsius = scriptedCelsius(epoch);
+    for (u32 i = 0; i < options.sensors; ++i) {
+      owSimSetTemperature((int)i, celsius + 0.5f * i);
+    }
+    vTaskDelayUntil(&lastWake, pdMS_TO_TICKS(SCRIPT_PERIOD_MS));
+  }
+}
+
+void onSignal(int) { interrupted = true; }
+
+void printReport(double wallS) {
+  printf("{\n");
+  printf("  \"emulatedS\": %.1f,\n", emuNowUs() / 1e6);
+  printf("  \"wallS\": %.1f,\n", wallS);
+
+  printf("  \"tasks\": [\n");
+  int taskCount = emuTaskCount();
+  for (int i = 0; i < taskCount; ++i) {
+    EmuTaskStats t;
+    emuTaskGetStats(i, &t);
+    printf("    {\"name\": \"%s\", \"cpuMs\": %.3f, \"cpuWaitMs\": %.3f, "
+           "\"deleted\": %s}%s\n",
+           t.name, t.cpuNs / 1e6, t.cpuWaitNs / 1e6,
+           t.deleted ? "true" : "false", i + 1 < taskCount ? "," : "");
+  }
+  printf("  ],\n");
+
+  const EmuHttpStats *http = emuHttpGetStats();
+  printf("  \"http\": {\"requests\": %u, \"notFound\": %u, \"connections\": "
+         "%u, \"bytesSent\": %llu, \"handlerMs\": %.3f, "
+         "\"maxHandlerUs\": %.1f},\n",
+         http->requests, http->notFound, http->connections,
+         (unsigned long long)http->bytesSent, http->handlerNs / 1e6,
+         http->maxHandlerNs / 1e3);
+
+  const SamplerStats *sampler = samplerGetStats();
+  printf("  \"sampler\": {\"cycles\": %u, \"missedDeadlines\": %u, "
+         "\"maxLatenessUs\": %u, \"maxProcessUs\": %u},\n",
+         sampler->cycles, sampler->missedDeadlines, sampler->maxLatenessUs,
+         sampler->maxProcessUs);
+
+  const PublisherStats *pub = publisherGetStats();
+  printf("  \"publisher\": {\"queued\": %u, \"acked\": %u, \"dropped\": %u, "
+         "\"packets\": %u, \"ackTimeouts\": %u, \"outboxMessages\": %u},\n",
+         pub->queued, pub->acked, pub->dropped, pub->packets,
+         pub->ackTimeouts, pub->outboxMessages);
+
+  const AlertStats *alerts = alertsGetStats();
+  printf("  \"alerts\": {\"raised\": %u, \"cleared\": %u, \"active\": %u, "
+         "\"maxWaitUs\": %u},\n",
+         alerts->raised, alerts->cleared, alerts->active,
+         pub->maxAlertWaitUs);
+
+  const PowerStats *power = powerGetStats();
+  printf("  \"power\": {\"cycles\": %u, \"maxAwakeUs\": %u, "
+         "\"meanAwakeUs\": %u, \"meanCurrentUa\": %u},\n",
+         power->cycles, power->maxAwakeUs,
+         power->cycles ? (u32)(power->totalAwakeUs / power->cycles) : 0,
+         power->meanCurrentUa);
+
+  printf("  \"records\": %zu,\n", getMinMaxCount());
+  const LogStats *log = logGetStats();
+  printf("  \"log\": {\"records\": %u, \"dropped\": %u}\n", log->records,
+         log->dropped);
+  printf("}\n");
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  if (!parseOptions(argc, argv)) {
+    usage(argv[0]);
+  }
+  if (options.tracePath && !loadTrace(options.tracePath)) {
+    return 1;
+  }
+  // The firmware applies its own offset to UTC, see ntp.c.
+  setenv("TZ", "UTC", 1);
+  tzset();
+  signal(SIGINT, onSignal);
+  signal(SIGTERM, onSignal);
+
+  owSimReset();
+  owSimAttach(CONFIG_ONEWIRE_PIN);
+  float celsius = scriptedCelsius(options.start);
+  for (u32 i = 0; i < options.sensors; ++i) {
+    u8 rom[8];
+    owSimMakeRom(rom, 0x1000 + i);
+    owSimAddDevice(rom, celsius + 0.5f * i);
+  }
+
+  emuClockInit(options.speed, options.start, options.syncAfter);
+  emuNetInit(options.connectAfter, options.port);
+  if (options.publishPort) {
+    publisherSetCollector(options.publishHost.c_str(), options.publishPort);
+  }
+  auto wallStart = std::chrono::steady_clock::now();
+
+  emuTaskAdopt("main");
+  emuCpuAcquire();
+  preloadHistory();
+  xTaskCreate(scriptTask, "script", 2048, nullptr, tskIDLE_PRIORITY + 1,
+              nullptr);
+  app_main();
+  emuCpuRelease();
+  fprintf(stderr, "Serving on http://127.0.0.1:%u/\n", options.port);
+
+  u64 endUs = (u64)(options.duration * 1e6);
+  while (!interrupted && (!endUs || emuNowUs() < endUs)) {
+    struct timespec ts = {0, 50 * 1000 * 1000};
+    nanosleep(&ts, nullptr);
+  }
+
+  // Stop the other tasks where they are, and report.
+  emuCpuAcquire();
+  double wallS = std::chrono::duration<double>(
+                     std::chrono::steady_clock::now() - wallStart)
+                     .count();
+  printReport(wallS);
+  fflush(stdout);
+  _exit(0);
+}
@@ -0,0 +1,80 @@
+// Network and system stand-ins for the emulator. The host's network is
+// always up, so connecting only takes the configured time, and no events are
+// ever posted.
+
+#include <malloc.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_event.h"
+#include "esp_heap_caps.h"
+#include "esp_netif.h"
+#include "esp_system.h"
+#include "esp_wifi.h"
+#include "protocol_examples_common.h"
+
+#include "emu.h"
+
+esp_event_base_t IP_EVENT = "IP_EVENT";
+esp_event_base_t WIFI_EVENT = "WIFI_EVENT";
+
+static double connectAfterS = 0;
+static u16 httpPort = 8080;
+static u32 minFreeBytes = UINT32_MAX;
+
+void emuNetInit(double connectAfter, u16 port) {
+  connectAfterS = connectAfter;
+  httpPort = port;
+}
+
+u16 emuHttpPort() { return httpPort; }
+
+esp_err_t esp_netif_init() { return ESP_OK; }
+esp_err_t esp_event_loop_create_default() { return ESP_OK; }
+
+esp_err_t esp_event_handler_register(esp_event_base_t event_base,
+                                     int32_t event_id,
+                                     esp_event_handler_t event_handler,
+                                     void *event_handler_arg) {
+  return ESP_OK;
+}
+
+esp_err_t example_connect() {
+  emuSleepUntilUs(emuNowUs() + (u64)(connectAfterS * 1000000));
+  return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_ps(wifi_ps_type_t type) { return ESP_OK; }
+
+// Free space in the host's heap arenas, which only tracks how the firmware's
+// own allocations come and go.
+size_t heap_caps_get_free_size(unsigned int caps) {
+  struct mallinfo2 info = mallinfo2();
+  if (info.fordblks < minFreeBytes) {
+    minFreeBytes = (u32)info.fordblks;
+  }
+  return info.fordblks;
+}
+
+uint32_t esp_get_minimum_free_heap_size() {
+  heap_caps_get_free_size(MALLOC_CAP_8BIT);
+  return minFreeBytes;
+}
+
+// Locally administered, and different for each HTTP port, so that several
+// emulators can publish to one collector.
+esp_err_t esp_read_mac(uint8_t *mac, esp_mac_type_t type) {
+  const uint8_t base[6] = {0x02, 0, 0, type, httpPort >> 8, httpPort & 0xff};
+  memcpy(mac, base, sizeof(base));
+  return ESP_OK;
+}
+
+uint32_t esp_random() {
+  u32 r = 0;
+  FILE *f = fopen("/dev/urandom", "rb");
+  if (f) {
+    fread(&r, sizeof(r), 1, f);
+    fclose(f);
+  }
+  return r;
+}
@@ -0,0 +1,320 @@
+// FreeRTOS stand-ins for the emulator. See emu.h for the scheduling model.
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "freertos/timers.h"
+
+#include "emu.h"
+
+#define TICK_US (1000000 / configTICK_RATE_HZ)
+#define MAX_TASKS 32
+
+typedef struct {
+  char name[16];
+  TaskFunction_t fn;
+  void *param;
+  clockid_t cpuClock;
+  u32 notifyCount;
+  pthread_cond_t notifyCond;
+  EmuTaskStats stats;
+} EmuTask;
+
+typedef struct {
+  EventBits_t bits;
+  pthread_cond_t changed;
+} EmuEventGroup;
+
+typedef struct {
+  EmuTask *holder;
+  pthread_cond_t released;
+} EmuMutex;
+
+typedef struct {
+  const char *name;
+  TickType_t period;
+  bool autoReload;
+  void *id;
+  TimerCallbackFunction_t callback;
+  bool started;
+  // Counts starts, so that the task of a stopped run can tell it's stale.
+  u32 generation;
+} EmuTimer;
+
+// Held by the task that is running. Also protects all of the state here.
+static pthread_mutex_t cpu = PTHREAD_MUTEX_INITIALIZER;
+static EmuTask *tasks[MAX_TASKS];
+static int taskCount = 0;
+static __thread EmuTask *self = NULL;
+
+static u64 hostNs(clockid_t clock) {
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return (u64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void initCond(pthread_cond_t *cond) {
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(cond, &attr);
+  pthread_condattr_destroy(&attr);
+}
+
+// Wait on a condition with the CPU released. Returns false on timeout.
+static bool waitCond(pthread_cond_t *cond, TickType_t ticks, u64 startUs) {
+  if (ticks == portMAX_DELAY) {
+    pthread_cond_wait(cond, &cpu);
+    return true;
+  }
+  struct timespec deadline = emuDeadline(startUs + (u64)ticks * TICK_US);
+  return pthread_cond_timedwait(cond, &cpu, &deadline) != ETIMEDOUT;
+}
+
+static EmuTask *newTask(const char *name) {
+  EmuTask *t = calloc(1, sizeof(EmuTask));
+  configASSERT(t && taskCount < MAX_TASKS);
+  strncpy(t->name, name, sizeof(t->name) - 1);
+  t->stats.name = t->name;
+  initCond(&t->notifyCond);
+  tasks[taskCount++] = t;
+  return t;
+}
+
+static void startTask(EmuTask *t) {
+  self = t;
+  pthread_getcpuclockid(pthread_self(), &t->cpuClock);
+}
+
+void emuCpuAcquire() {
+  u64 start = hostNs(CLOCK_MONOTONIC);
+  pthread_mutex_lock(&cpu);
+  self->stats.cpuWaitNs += hostNs(CLOCK_MONOTONIC) - start;
+}
+
+void emuCpuRelease() { pthread_mutex_unlock(&cpu); }
+
+void emuTaskAdopt(const char *name) {
+  pthread_mutex_lock(&cpu);
+  EmuTask *t = newTask(name);
+  pthread_mutex_unlock(&cpu);
+  startTask(t);
+}
+
+int emuTaskCount() { return taskCount; }
+
+void emuTaskGetStats(int idx, EmuTaskStats *stats) {
+  EmuTask *t = tasks[idx];
+  *stats = t->stats;
+  if (!t->stats.deleted) {
+    stats->cpuNs = hostNs(t->cpuClock);
+  }
+}
+
+void emuSleepUntilUs(u64 us) {
+  struct timespec deadline = emuDeadline(us);
+  emuCpuRelease();
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) ==
+         EINTR) {
+  }
+  emuCpuAcquire();
+}
+
+static void *taskMain(void *arg) {
+  EmuTask *t = arg;
+  startTask(t);
+  emuCpuAcquire();
+  t->fn(t->param);
+  // FreeRTOS tasks must not return, but treat it as deleting itself.
+  vTaskDelete(NULL);
+  return NULL;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t pvTaskCode, const char *pcName,
+                       uint32_t usStackDepth, void *pvParameters,
+                       UBaseType_t uxPriority, TaskHandle_t *pxCreatedTask) {
+  EmuTask *t = newTask(pcName);
+  t->fn = pvTaskCode;
+  t->param = pvParameters;
+  pthread_t thread;
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  int rc = pthread_create(&thread, &attr, taskMain, t);
+  pthread_attr_destroy(&attr);
+  if (rc) {
+    return pdFALSE;
+  }
+  if (pxCreatedTask) {
+    *pxCreatedTask = t;
+  }
+  return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t xTaskToDelete) {
+  // Only deleting the calling task is supported.
+  configASSERT(!xTaskToDelete || xTaskToDelete == self);
+  self->stats.cpuNs = hostNs(self->cpuClock);
+  self->stats.deleted = true;
+  emuCpuRelease();
+  pthread_exit(NULL);
+}
+
+TickType_t xTaskGetTickCount() { return (TickType_t)(emuNowUs() / TICK_US); }
+
+void vTaskDelay(TickType_t xTicksToDelay) {
+  emuSleepUntilUs(emuNowUs() + (u64)xTicksToDelay * TICK_US);
+}
+
+void vTaskDelayUntil(TickType_t *pxPreviousWakeTime,
+                     TickType_t xTimeIncrement) {
+  *pxPreviousWakeTime += xTimeIncrement;
+  TickType_t now = xTaskGetTickCount();
+  // Don't wait if the wake time has passed, like FreeRTOS.
+  if ((TickType_t)(*pxPreviousWakeTime - now) <= xTimeIncrement) {
+    emuSleepUntilUs((u64)*pxPreviousWakeTime * TICK_US);
+  }
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t xTaskToNotify) {
+  EmuTask *t = xTaskToNotify;
+  ++t->notifyCount;
+  pthread_cond_signal(&t->notifyCond);
+  return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t xClearCountOnExit,
+                          TickType_t xTicksToWait) {
+  u64 startUs = emuNowUs();
+  while (!self->notifyCount) {
+    if (!waitCond(&self->notifyCond, xTicksToWait, startUs)) {
+      return 0;
+    }
+  }
+  uint32_t count = self->notifyCount;
+  self->notifyCount = xClearCountOnExit ? 0 : count - 1;
+  return count;
+}
+
+// Only one task runs at a time, so there's nothing to exclude.
+void taskENTER_CRITICAL() {}
+void taskEXIT_CRITICAL() {}
+
+EventGroupHandle_t xEventGroupCreate() {
+  EmuEventGroup *g = calloc(1, sizeof(EmuEventGroup));
+  initCond(&g->changed);
+  return g;
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits) {
+  EmuEventGroup *g = group;
+  g->bits |= bits;
+  pthread_cond_broadcast(&g->changed);
+  return g->bits;
+}
+
+EventBits_t xEventGroupGetBits(EventGroupHandle_t group) {
+  return ((EmuEventGroup *)group)->bits;
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits,
+                                BaseType_t clearOnExit, BaseType_t waitForAll,
+                                TickType_t ticks) {
+  EmuEventGroup *g = group;
+  u64 startUs = emuNowUs();
+  while (waitForAll ? (g->bits & bits) != bits : !(g->bits & bits)) {
+    if (!waitCond(&g->changed, ticks, startUs)) {
+      return g->bits;
+    }
+  }
+  EventBits_t result = g->bits;
+  if (clearOnExit) {
+    g->bits &= ~bits;
+  }
+  return result;
+}
+
+// Tasks aren't preempted, so a task only finds a mutex held if the holder
+// blocked while holding it.
+SemaphoreHandle_t xSemaphoreCreateMutex() {
+  EmuMutex *m = calloc(1, sizeof(EmuMutex));
+  initCond(&m->released);
+  return m;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t xSemaphore, TickType_t ticks) {
+  EmuMutex *m = xSemaphore;
+  u64 startUs = emuNowUs();
+  while (m->holder) {
+    if (!waitCond(&m->released, ticks, startUs)) {
+      return pdFALSE;
+    }
+  }
+  m->holder = self;
+  return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t xSemaphore) {
+  EmuMutex *m = xSemaphore;
+  if (m->holder != self) {
+    return pdFALSE;
+  }
+  m->holder = NULL;
+  pthread_cond_signal(&m->released);
+  return pdTRUE;
+}
+
+// Each timer gets its own task, instead of sharing a timer service task.
+static void timerTask(void *param) {
+  EmuTimer *timer = param;
+  u32 generation = timer->generation;
+  u64 nextUs = emuNowUs();
+  do {
+    nextUs += (u64)timer->period * TICK_US;
+    emuSleepUntilUs(nextUs);
+    if (!timer->started || timer->generation != generation) {
+      return;
+    }
+    timer->callback(timer);
+  } while (timer->autoReload);
+  timer->started = false;
+}
+
+TimerHandle_t xTimerCreate(const char *pcTimerName, TickType_t xTimerPeriod,
+                           UBaseType_t uxAutoReload, void *pvTimerID,
+                           TimerCallbackFunction_t pxCallbackFunction) {
+  EmuTimer *timer = calloc(1, sizeof(EmuTimer));
+  timer->name = pcTimerName;
+  timer->period = xTimerPeriod;
+  timer->autoReload = uxAutoReload;
+  timer->id = pvTimerID;
+  timer->callback = pxCallbackFunction;
+  return timer;
+}
+
+BaseType_t xTimerStart(TimerHandle_t xTimer, TickType_t xTicksToWait) {
+  EmuTimer *timer = xTimer;
+  // Restarting a running timer isn't supported.
+  if (timer->started) {
+    return pdPASS;
+  }
+  timer->started = true;
+  ++timer->generation;
+  return xTaskCreate(timerTask, timer->name, 0, timer, 0, NULL);
+}
+
+BaseType_t xTimerStop(TimerHandle_t xTimer, TickType_t xTicksToWait) {
+  ((EmuTimer *)xTimer)->started = false;
+  return pdPASS;
+}
+
+void *pvTimerGetTimerID(TimerHandle_t xTimer) {
+  return ((EmuTimer *)xTimer)->id;
+}
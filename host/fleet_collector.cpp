@@ -0,0 +1,776 @@
+// Collect the histories of a fleet of thermometers into one local store.
+//
+// All devices are polled concurrently from a single thread, with
+// non-blocking sockets and poll(), so a slow or unreachable device doesn't
+// hold up the others, and a round takes as long as the slowest device
+// rather than the sum of them. Each device keeps its own sync state: the
+// ETag of the last history merged, sent as If-None-Match, so that polls of
+// an unchanged history cost a 304. The ETags are saved next to the store,
+// so that a restarted collector carries on where it left off.
+//
+// The store is a TSV file of day records, ordered by day and then device.
+// Records are only ever added or updated, so days that a device has lost,
+// e.g. to a reboot, are kept. Reports scrape latency per device, as JSON.
+//
+//   for p in 8081 8082 8083; do emulator --port $p --history-days 30 & done
+//   fleet_collector --store fleet.tsv --interval 10 127.0.0.1:808{1,2,3}
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "int_types.h"
+
+namespace {
+
+const size_t READ_BUFFER_BYTES = 16384;
+// Poll timeout cap, so that SIGINT is noticed promptly.
+const double MAX_POLL_S = 0.5;
+// How often a changed store is written out, at most.
+const double SAVE_PERIOD_S = 5;
+
+struct Options {
+  std::vector<std::string> devices;
+  const char *storePath = nullptr;
+  const char *jsonPath = nullptr;
+  double intervalS = 60;
+  double timeoutS = 10;
+  // Scrapes per device, 0 until SIGINT.
+  u32 count = 0;
+  bool gzip = false;
+};
+
+// A day's record, as in the history's JSON.
+struct Record {
+  std::string minTime;
+  std::string minTemp;
+  std::string maxTime;
+  std::string maxTemp;
+
+  bool operator==(const Record &o) const {
+    return minTime == o.minTime && minTemp == o.minTemp &&
+           maxTime == o.maxTime && maxTemp == o.maxTemp;
+  }
+};
+
+// By day, then device.
+typedef std::map<std::string, std::map<std::string, Record>> Store;
+
+struct Response {
+  bool headersDone = false;
+  int status = 0;
+  std::string etag;
+  bool gzip = false;
+  bool chunked = false;
+  ssize_t contentLength = -1;
+  // Where parsing resumes in the received bytes.
+  size_t pos = 0;
+  std::string body;
+};
+
+enum State { IDLE, CONNECTING, SENDING, READING };
+
+struct DeviceStats {
+  u64 scrapes = 0;
+  u64 status200 = 0;
+  u64 status304 = 0;
+  u64 errors = 0;
+  u64 timeouts = 0;
+  u64 wireBytes = 0;
+  u64 bodyBytes = 0;
+  // Records in the last history received.
+  u64 records = 0;
+  u64 added = 0;
+  u64 updated = 0;
+  std::vector<double> latenciesMs;
+  std::string lastError;
+};
+
+struct Device {
+  std::string name;
+  sockaddr_in addr;
+  // Sync state: the ETag of the last history merged.
+  std::string etag;
+
+  State state = IDLE;
+  int fd = -1;
+  std::string request;
+  size_t sent = 0;
+  std::string received;
+  Response response;
+  double startS = 0;
+  double deadlineS = 0;
+  double nextPollS = 0;
+
+  DeviceStats stats;
+};
+
+Options options;
+Store store;
+// Set when the store or the sync state has changed since it was saved.
+bool storeDirty = false;
+volatile sig_atomic_t interrupted = 0;
+
+void onSignal(int) { interrupted = 1; }
+
+double nowS() {
+  return std::chrono::duration<double>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+void usage(const char *argv0) {
+  fprintf(stderr,
+          "Usage: %s [options] [NAME=]HOST:PORT...\n"
+          "  --devices FILE   Read more devices from FILE, one per line\n"
+          "  --store FILE     Merge the histories into FILE, and keep the\n"
+          "                   sync state in FILE.sync\n"
+          "  --interval S     Seconds between polls of a device (default "
+          "60)\n"
+          "  --timeout S      Seconds before a scrape is abandoned (default "
+          "10)\n"
+          "  --count N        Scrapes per device, 0 until SIGINT (default "
+          "0)\n"
+          "  --gzip           Ask for the history gzip'd\n"
+          "  --json FILE      Write the report here instead of stdout\n",
+          argv0);
+  exit(2);
+}
+
+bool readDeviceList(const char *path) {
+  FILE *f = fopen(path, "r");
+  if (!f) {
+    perror(path);
+    return false;
+  }
+  char line[256];
+  while (fgets(line, sizeof(line), f)) {
+    std::string s(line);
+    s.erase(s.find_last_not_of(" \t\r\n") + 1);
+    s.erase(0, s.find_first_not_of(" \t"));
+    if (!s.empty() && s[0] != '#') {
+      options.devices.push_back(s);
+    }
+  }
+  fclose(f);
+  return true;
+}
+
+bool parseOptions(int argc, char **argv) {
+  for (int i = 1; i < argc; ++i) {
+    const char *arg = argv[i];
+    if (strncmp(arg, "--", 2)) {
+      options.devices.push_back(arg);
+      continue;
+    }
+    if (!strcmp(arg, "--gzip")) {
+      options.gzip = true;
+      continue;
+    }
+    const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+    if (!value) {
+      return false;
+    }
+    ++i;
+    if (!strcmp(arg, "--devices")) {
+      if (!readDeviceList(value)) {
+        exit(1);
+      }
+    } else if (!strcmp(arg, "--store")) {
+      options.storePath = value;
+    } else if (!strcmp(arg, "--interval")) {
+      options.intervalS = atof(value);
+    } else if (!strcmp(arg, "--timeout")) {
+      options.timeoutS = atof(value);
+    } else if (!strcmp(arg, "--count")) {
+      options.count = (u32)atoi(value);
+    } else if (!strcmp(arg, "--json")) {
+      options.jsonPath = value;
+    } else {
+      return false;
+    }
+  }
+  return !options.devices.empty() && options.intervalS > 0 &&
+         options.timeoutS > 0;
+}
+
+// "[NAME=]HOST:PORT". The name defaults to HOST:PORT.
+bool resolve(const std::string &spec, Device *d) {
+  size_t eq = spec.find('=');
+  std::string target = eq == std::string::npos ? spec : spec.substr(eq + 1);
+  d->name = eq == std::string::npos ? spec : spec.substr(0, eq);
+  size_t colon = target.rfind(':');
+  if (colon == std::string::npos || d->name.empty()) {
+    return false;
+  }
+  std::string host = target.substr(0, colon);
+  addrinfo hints = {};
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo *info = nullptr;
+  if (getaddrinfo(host.c_str(), nullptr, &hints, &info) || !info) {
+    return false;
+  }
+  d->addr = *(const sockaddr_in *)info->ai_addr;
+  d->addr.sin_port = htons((u16)atoi(target.c_str() + colon + 1));
+  freeaddrinfo(info);
+  return true;
+}
+
+std::vector<std::string> splitTabs(const std::string &line) {
+  std::vector<std::string> fields;
+  size_t start = 0;
+  while (true) {
+    size_t tab = line.find('\t', start);
+    fields.push_back(line.substr(start, tab - start));
+    if (tab == std::string::npos) {
+      return fields;
+    }
+    start = tab + 1;
+  }
+}
+
+// Read a TSV file, skipping comments. Returns false if it exists but can't
+// be read.
+bool readTsv(const std::string &path, size_t fields,
+             std::vector<std::vector<std::string>> *rows) {
+  FILE *f = fopen(path.c_str(), "r");
+  if (!f) {
+    return errno == ENOENT;
+  }
+  char line[512];
+  while (fgets(line, sizeof(line), f)) {
+    std::string s(line);
+    s.erase(s.find_last_not_of("\r\n") + 1);
+    if (s.empty() || s[0] == '#') {
+      continue;
+    }
+    auto row = splitTabs(s);
+    if (row.size() == fields) {
+      rows->push_back(row);
+    }
+  }
+  fclose(f);
+  return true;
+}
+
+// Write a file in full, then rename it over the old one, so that an
+// interrupted write doesn't leave half a store.
+bool writeAtomically(const std::string &path, const std::string &contents) {
+  std::string tmp = path + ".tmp";
+  FILE *f = fopen(tmp.c_str(), "w");
+  if (!f) {
+    perror(tmp.c_str());
+    return false;
+  }
+  bool ok = fwrite(contents.data(), 1, contents.size(), f) == contents.size();
+  ok = fclose(f) == 0 && ok;
+  if (!ok || rename(tmp.c_str(), path.c_str())) {
+    perror(path.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool loadStore(std::vector<Device> *devices) {
+  std::vector<std::vector<std::string>> rows;
+  if (!readTsv(options.storePath, 6, &rows)) {
+    perror(options.storePath);
+    return false;
+  }
+  for (const auto &r : rows) {
+    store[r[0]][r[1]] = Record{r[2], r[3], r[4], r[5]};
+  }
+  rows.clear();
+  std::string syncPath = std::string(options.storePath) + ".sync";
+  if (!readTsv(syncPath, 2, &rows)) {
+    perror(syncPath.c_str());
+    return false;
+  }
+  for (const auto &r : rows) {
+    for (auto &d : *devices) {
+      if (d.name == r[0]) {
+        d.etag = r[1];
+      }
+    }
+  }
+  return true;
+}
+
+void saveStore(const std::vector<Device> &devices) {
+  std::string s = "# day\tdevice\tminTime\tminTemp\tmaxTime\tmaxTemp\n";
+  for (const auto &day : store) {
+    for (const auto &device : day.second) {
+      const Record &r = device.second;
+      s += day.first + '\t' + device.first + '\t' + r.minTime + '\t' +
+           r.minTemp + '\t' + r.maxTime + '\t' + r.maxTemp + '\n';
+    }
+  }
+  std::string sync = "# device\tetag\n";
+  for (const auto &d : devices) {
+    if (!d.etag.empty()) {
+      sync += d.name + '\t' + d.etag + '\n';
+    }
+  }
+  // The store first, so that a crash in between re-fetches rather than
+  // skips a history.
+  if (writeAtomically(options.storePath, s)) {
+    writeAtomically(std::string(options.storePath) + ".sync", sync);
+  }
+  storeDirty = false;
+}
+
+bool gunzip(const std::string &in, std::string *out) {
+  z_stream z = {};
+  if (inflateInit2(&z, 16 + MAX_WBITS) != Z_OK) {
+    return false;
+  }
+  z.next_in = (Bytef *)in.data();
+  z.avail_in = (uInt)in.size();
+  char buf[READ_BUFFER_BYTES];
+  int ret;
+  do {
+    z.next_out = (Bytef *)buf;
+    z.avail_out = sizeof(buf);
+    ret = inflate(&z, Z_NO_FLUSH);
+    out->append(buf, sizeof(buf) - z.avail_out);
+  } while (ret == Z_OK);
+  inflateEnd(&z);
+  return ret == Z_STREAM_END;
+}
+
+// The value of a string field in a record's line.
+bool stringField(const std::string &line, const char *key, std::string *value) {
+  std::string quoted = std::string("\"") + key + "\":";
+  size_t pos = line.find(quoted);
+  if (pos == std::string::npos) {
+    return false;
+  }
+  size_t start = line.find('"', pos + quoted.size());
+  size_t end = start == std::string::npos ? start : line.find('"', start + 1);
+  if (end == std::string::npos) {
+    return false;
+  }
+  *value = line.substr(start + 1, end - start - 1);
+  return true;
+}
+
+// Merge a history, one record per line, into the store. Returns false if
+// it doesn't parse, in which case nothing is merged.
+bool merge(Device *d, const std::string &json) {
+  std::vector<std::pair<std::string, Record>> records;
+  size_t pos = 0;
+  while (pos < json.size()) {
+    size_t end = json.find('\n', pos);
+    if (end == std::string::npos) {
+      end = json.size();
+    }
+    std::string line = json.substr(pos, end - pos);
+    pos = end + 1;
+    if (line.find('{') == std::string::npos) {
+      continue;
+    }
+    std::string day;
+    Record r;
+    if (!stringField(line, "period", &day) ||
+        !stringField(line, "minTime", &r.minTime) ||
+        !stringField(line, "minTemp", &r.minTemp) ||
+        !stringField(line, "maxTime", &r.maxTime) ||
+        !stringField(line, "maxTemp", &r.maxTemp)) {
+      return false;
+    }
+    records.emplace_back(day, r);
+  }
+  if (json.find('[') == std::string::npos ||
+      json.find(']') == std::string::npos) {
+    return false;
+  }
+
+  d->stats.records = records.size();
+  for (const auto &dr : records) {
+    auto &devices = store[dr.first];
+    auto it = devices.find(d->name);
+    if (it == devices.end()) {
+      devices.emplace(d->name, dr.second);
+      ++d->stats.added;
+      storeDirty = true;
+    } else if (!(it->second == dr.second)) {
+      it->second = dr.second;
+      ++d->stats.updated;
+      storeDirty = true;
+    }
+  }
+  return true;
+}
+
+// Parse what's been received so far. Returns 1 when the response is
+// complete, 0 if more is needed, -1 if it's malformed. At end of input,
+// a response without a length is complete.
+int parseResponse(const std::string &in, bool eof, Response *r) {
+  if (!r->headersDone) {
+    size_t end = in.find("\r\n\r\n");
+    if (end == std::string::npos) {
+      return eof ? -1 : 0;
+    }
+    size_t pos = in.find("\r\n");
+    if (sscanf(in.c_str(), "HTTP/1.%*d %d", &r->status) != 1) {
+      return -1;
+    }
+    while (pos < end) {
+      size_t lineStart = pos + 2;
+      pos = in.find("\r\n", lineStart);
+      std::string line = in.substr(lineStart, pos - lineStart);
+      size_t colon = line.find(':');
+      if (colon == std::string::npos) {
+        continue;
+      }
+      std::string field = line.substr(0, colon);
+      std::string value = line.substr(colon + 1);
+      value.erase(0, value.find_first_not_of(' '));
+      if (!strcasecmp(field.c_str(), "Content-Length")) {
+        r->contentLength = atol(value.c_str());
+      } else if (!strcasecmp(field.c_str(), "Transfer-Encoding")) {
+        r->chunked = !strcasecmp(value.c_str(), "chunked");
+      } else if (!strcasecmp(field.c_str(), "ETag")) {
+        r->etag = value;
+      } else if (!strcasecmp(field.c_str(), "Content-Encoding")) {
+        r->gzip = !strcasecmp(value.c_str(), "gzip");
+      }
+    }
+    r->headersDone = true;
+    r->pos = end + 4;
+    if (r->status == 304 || r->status == 204) {
+      return 1;
+    }
+  }
+
+  if (!r->chunked) {
+    size_t have = in.size() - r->pos;
+    if (r->contentLength >= 0 && have >= (size_t)r->contentLength) {
+      r->body = in.substr(r->pos, r->contentLength);
+      return 1;
+    }
+    if (eof && r->contentLength < 0) {
+      r->body = in.substr(r->pos);
+      return 1;
+    }
+    return eof ? -1 : 0;
+  }
+  // Take whole chunks as they arrive.
+  while (true) {
+    size_t lineEnd = in.find("\r\n", r->pos);
+    if (lineEnd == std::string::npos) {
+      return eof ? -1 : 0;
+    }
+    size_t size = strtoul(in.c_str() + r->pos, nullptr, 16);
+    size_t dataStart = lineEnd + 2;
+    if (in.size() < dataStart + size + 2) {
+      return eof ? -1 : 0;
+    }
+    r->body.append(in, dataStart, size);
+    r->pos = dataStart + size + 2;
+    if (size == 0) {
+      return 1;
+    }
+  }
+}
+
+void closeConnection(Device *d) {
+  if (d->fd >= 0) {
+    close(d->fd);
+  }
+  d->fd = -1;
+  d->state = IDLE;
+}
+
+// Schedule the next poll from the start of this one, so that the interval
+// doesn't drift with the scrape time, unless the scrape overran it.
+void scheduleNext(Device *d, double now) {
+  d->nextPollS = std::max(d->startS + options.intervalS, now);
+}
+
+void fail(Device *d, const char *what, double now) {
+  ++d->stats.errors;
+  d->stats.lastError = what;
+  if (errno && strcmp(what, "timeout")) {
+    d->stats.lastError += std::string(": ") + strerror(errno);
+  }
+  closeConnection(d);
+  scheduleNext(d, now);
+}
+
+void finish(Device *d, double now) {
+  Response &r = d->response;
+  d->stats.latenciesMs.push_back((now - d->startS) * 1000);
+  d->stats.wireBytes += d->received.size();
+  d->stats.bodyBytes += r.body.size();
+  closeConnection(d);
+  scheduleNext(d, now);
+  errno = 0;
+  if (r.status == 304) {
+    ++d->stats.status304;
+    return;
+  }
+  if (r.status != 200) {
+    ++d->stats.errors;
+    d->stats.lastError = "status " + std::to_string(r.status);
+    return;
+  }
+  ++d->stats.status200;
+  std::string plain;
+  if (r.gzip && !gunzip(r.body, &plain)) {
+    fail(d, "bad gzip data", now);
+    return;
+  }
+  if (!merge(d, r.gzip ? plain : r.body)) {
+    fail(d, "bad history", now);
+    return;
+  }
+  if (d->etag != r.etag) {
+    d->etag = r.etag;
+    storeDirty = true;
+  }
+}
+
+// A fresh connection per scrape: polls are minutes apart, and a device
+// only has a few sockets to serve everyone with.
+void startScrape(Device *d, double now) {
+  ++d->stats.scrapes;
+  d->startS = now;
+  d->deadlineS = now + options.timeoutS;
+  d->received.clear();
+  d->response = Response();
+  d->sent = 0;
+  d->request = "GET / HTTP/1.1\r\nHost: " + d->name + "\r\n";
+  if (!d->etag.empty()) {
+    d->request += "If-None-Match: " + d->etag + "\r\n";
+  }
+  if (options.gzip) {
+    d->request += "Accept-Encoding: gzip\r\n";
+  }
+  d->request += "\r\n";
+
+  errno = 0;
+  d->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  if (d->fd < 0) {
+    fail(d, "socket", now);
+    return;
+  }
+  int one = 1;
+  setsockopt(d->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  if (connect(d->fd, (const sockaddr *)&d->addr, sizeof(d->addr)) == 0) {
+    d->state = SENDING;
+  } else if (errno == EINPROGRESS) {
+    d->state = CONNECTING;
+  } else {
+    fail(d, "connect", now);
+  }
+}
+
+// Move the scrape along after poll() says the socket is ready.
+void advance(Device *d, double now) {
+  errno = 0;
+  if (d->state == CONNECTING) {
+    int err = 0;
+    socklen_t len = sizeof(err);
+    getsockopt(d->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+    if (err) {
+      errno = err;
+      fail(d, "connect", now);
+      return;
+    }
+    d->state = SENDING;
+  }
+  if (d->state == SENDING) {
+    ssize_t n = send(d->fd, d->request.data() + d->sent,
+                     d->request.size() - d->sent, MSG_NOSIGNAL);
+    if (n < 0 && errno != EAGAIN) {
+      fail(d, "send", now);
+      return;
+    }
+    d->sent += n > 0 ? n : 0;
+    if (d->sent == d->request.size()) {
+      d->state = READING;
+    }
+    return;
+  }
+  if (d->state == READING) {
+    char buf[READ_BUFFER_BYTES];
+    ssize_t n;
+    while ((n = recv(d->fd, buf, sizeof(buf), 0)) > 0) {
+      d->received.append(buf, n);
+    }
+    if (n < 0 && errno != EAGAIN) {
+      fail(d, "recv", now);
+      return;
+    }
+    int done = parseResponse(d->received, n == 0, &d->response);
+    if (done > 0) {
+      finish(d, now);
+    } else if (done < 0) {
+      errno = 0;
+      fail(d, "bad response", now);
+    }
+  }
+}
+
+bool finished(const Device &d) {
+  return d.state == IDLE && options.count &&
+         d.stats.scrapes >= options.count;
+}
+
+double percentile(const std::vector<double> &sorted, double p) {
+  if (sorted.empty()) {
+    return 0;
+  }
+  size_t idx = (size_t)(p / 100 * (sorted.size() - 1) + 0.5);
+  return sorted[idx];
+}
+
+void printReport(FILE *f, std::vector<Device> &devices, double wallS) {
+  size_t records = 0;
+  for (const auto &day : store) {
+    records += day.second.size();
+  }
+  fprintf(f, "{\n");
+  fprintf(f, "  \"wallS\": %.1f,\n  \"intervalS\": %.1f,\n", wallS,
+          options.intervalS);
+  fprintf(f, "  \"storeDays\": %zu,\n  \"storeRecords\": %zu,\n",
+          store.size(), records);
+  if (!store.empty()) {
+    fprintf(f, "  \"firstDay\": \"%s\",\n  \"lastDay\": \"%s\",\n",
+            store.begin()->first.c_str(), store.rbegin()->first.c_str());
+  }
+  fprintf(f, "  \"devices\": [\n");
+  for (size_t i = 0; i < devices.size(); ++i) {
+    DeviceStats &s = devices[i].stats;
+    std::sort(s.latenciesMs.begin(), s.latenciesMs.end());
+    u64 responses = s.latenciesMs.empty() ? 1 : s.latenciesMs.size();
+    fprintf(f,
+            "    { \"name\": \"%s\", \"scrapes\": %llu, \"status200\": %llu, "
+            "\"status304\": %llu, \"errors\": %llu, \"timeouts\": %llu, "
+            "\"p50Ms\": %.3f, \"p95Ms\": %.3f, \"maxMs\": %.3f, "
+            "\"bytesPerResponse\": %.0f, \"bodyBytes\": %llu, "
+            "\"records\": %llu, \"added\": %llu, \"updated\": %llu, "
+            "\"lastError\": ",
+            devices[i].name.c_str(), (unsigned long long)s.scrapes,
+            (unsigned long long)s.status200, (unsigned long long)s.status304,
+            (unsigned long long)s.errors, (unsigned long long)s.timeouts,
+            percentile(s.latenciesMs, 50), percentile(s.latenciesMs, 95),
+            s.latenciesMs.empty() ? 0 : s.latenciesMs.back(),
+            (double)s.wireBytes / responses, (unsigned long long)s.bodyBytes,
+            (unsigned long long)s.records, (unsigned long long)s.added,
+            (unsigned long long)s.updated);
+    if (s.lastError.empty()) {
+      fprintf(f, "null");
+    } else {
+      fprintf(f, "\"%s\"", s.lastError.c_str());
+    }
+    fprintf(f, " }%s\n", i + 1 < devices.size() ? "," : "");
+  }
+  fprintf(f, "  ]\n}\n");
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  if (!parseOptions(argc, argv)) {
+    usage(argv[0]);
+  }
+  std::vector<Device> devices(options.devices.size());
+  for (size_t i = 0; i < devices.size(); ++i) {
+    if (!resolve(options.devices[i], &devices[i])) {
+      fprintf(stderr, "Can't resolve %s\n", options.devices[i].c_str());
+      return 1;
+    }
+  }
+  if (options.storePath && !loadStore(&devices)) {
+    return 1;
+  }
+  signal(SIGINT, onSignal);
+  signal(SIGTERM, onSignal);
+
+  double start = nowS();
+  double lastSave = start;
+  std::vector<pollfd> fds;
+  std::vector<Device *> polled;
+  while (!interrupted) {
+    double now = nowS();
+    bool done = true;
+    double wakeS = now + MAX_POLL_S;
+    fds.clear();
+    polled.clear();
+    for (auto &d : devices) {
+      if (d.state == IDLE && !finished(d) && now >= d.nextPollS) {
+        startScrape(&d, now);
+      }
+      if (d.state != IDLE && now >= d.deadlineS) {
+        ++d.stats.timeouts;
+        errno = 0;
+        fail(&d, "timeout", now);
+      }
+      done = done && finished(d);
+      if (d.state == IDLE) {
+        if (!finished(d)) {
+          wakeS = std::min(wakeS, d.nextPollS);
+        }
+        continue;
+      }
+      wakeS = std::min(wakeS, d.deadlineS);
+      fds.push_back(
+          {d.fd, (short)(d.state == READING ? POLLIN : POLLOUT), 0});
+      polled.push_back(&d);
+    }
+    if (done) {
+      break;
+    }
+    if (options.storePath && storeDirty && now - lastSave >= SAVE_PERIOD_S) {
+      saveStore(devices);
+      lastSave = now;
+    }
+
+    int timeoutMs = (int)std::max(0.0, (wakeS - now) * 1000) + 1;
+    if (poll(fds.data(), fds.size(), timeoutMs) <= 0) {
+      continue;
+    }
+    for (size_t i = 0; i < fds.size(); ++i) {
+      if (fds[i].revents) {
+        advance(polled[i], nowS());
+      }
+    }
+  }
+
+  for (auto &d : devices) {
+    closeConnection(&d);
+  }
+  if (options.storePath) {
+    saveStore(devices);
+  }
+  FILE *f = options.jsonPath ? fopen(options.jsonPath, "w") : stdout;
+  if (!f) {
+    perror(options.jsonPath);
+    return 1;
+  }
+  printReport(f, devices, nowS() - start);
+  if (f != stdout) {
+    fclose(f);
+  }
+  return 0;
+}
@@ -0,0 +1,20 @@
+// Control over the host stand-ins for the ESP8266 RTOS SDK.
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Show firmware log output (os_printf) on stderr.
+extern int hostVerbose;
+
+// Fix esp_timer_get_time() to the given value, instead of following the host
+// clock.
+void hostSetTimerUs(int64_t us);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
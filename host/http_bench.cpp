@@ -0,0 +1,594 @@
+// Load test the firmware's HTTP server, on a device or the emulator.
+//
+// For each path, with and without conditional GETs, with and without gzip if
+// asked, and for each number of concurrent clients, keep-alive clients request the path back to back for
+// a fixed time. Reports requests/s, latency percentiles, bytes per response
+// and how the sampling task's deadlines fared meanwhile, from /diag before
+// and after, as JSON.
+//
+//   emulator --history-days 365 &
+//   http_bench --clients 1,4 --json bench.json
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "int_types.h"
+
+namespace {
+
+const size_t READ_BUFFER_BYTES = 4096;
+const int SOCKET_TIMEOUT_S = 10;
+
+struct Options {
+  const char *host = "127.0.0.1";
+  u16 port = 8080;
+  std::vector<std::string> paths = {"/"};
+  std::vector<u32> clients = {1, 4};
+  double durationS = 5;
+  // Which of plain and conditional GETs to run.
+  bool plain = true;
+  bool conditional = true;
+  // Which of identity and gzip encodings to ask for.
+  bool identity = true;
+  bool gzip = false;
+  const char *jsonPath = nullptr;
+};
+
+struct Response {
+  int status = 0;
+  size_t headerBytes = 0;
+  size_t bodyBytes = 0;
+  std::string etag;
+  bool gzip = false;
+  bool close = false;
+  std::string body;
+};
+
+// One keep-alive connection, reconnecting when the server closes it.
+class Connection {
+public:
+  Connection(const sockaddr_in &addr) : addr(addr) {}
+  ~Connection() { disconnect(); }
+
+  // Returns false on a network or protocol error.
+  bool get(const std::string &path, const std::string &ifNoneMatch,
+           bool gzip, bool keepBody, Response *r) {
+    std::string request = "GET " + path + " HTTP/1.1\r\nHost: bench\r\n";
+    if (!ifNoneMatch.empty()) {
+      request += "If-None-Match: " + ifNoneMatch + "\r\n";
+    }
+    if (gzip) {
+      request += "Accept-Encoding: gzip\r\n";
+    }
+    request += "\r\n";
+    if (fd < 0 && !connectNow()) {
+      return false;
+    }
+    if (!sendAll(request)) {
+      // The server may have closed an idle connection. Retry once.
+      disconnect();
+      if (!connectNow() || !sendAll(request)) {
+        return false;
+      }
+    }
+    *r = Response();
+    bool ok = readResponse(keepBody, r);
+    if (!ok || r->close) {
+      disconnect();
+    }
+    return ok;
+  }
+
+  u32 connects = 0;
+
+private:
+  sockaddr_in addr;
+  int fd = -1;
+  char buf[READ_BUFFER_BYTES];
+  size_t start = 0;
+  size_t end = 0;
+
+  bool connectNow() {
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+      return false;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    timeval tv = {SOCKET_TIMEOUT_S, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    if (connect(fd, (const sockaddr *)&addr, sizeof(addr))) {
+      disconnect();
+      return false;
+    }
+    ++connects;
+    return true;
+  }
+
+  void disconnect() {
+    if (fd >= 0) {
+      close(fd);
+    }
+    fd = -1;
+    start = end = 0;
+  }
+
+  bool sendAll(const std::string &s) {
+    size_t sent = 0;
+    while (sent < s.size()) {
+      ssize_t n = send(fd, s.data() + sent, s.size() - sent, MSG_NOSIGNAL);
+      if (n <= 0) {
+        return false;
+      }
+      sent += n;
+    }
+    return true;
+  }
+
+  bool fill() {
+    if (start == end) {
+      start = end = 0;
+    }
+    if (end == sizeof(buf)) {
+      memmove(buf, buf + start, end - start);
+      end -= start;
+      start = 0;
+    }
+    ssize_t n = recv(fd, buf + end, sizeof(buf) - end, 0);
+    if (n <= 0) {
+      return false;
+    }
+    end += n;
+    return true;
+  }
+
+  // Read a CRLF terminated line, without the CRLF.
+  bool readLine(std::string *line, size_t *wireBytes) {
+    line->clear();
+    while (true) {
+      for (size_t i = start; i < end; ++i) {
+        if (buf[i] == '\n') {
+          line->append(buf + start, i - start);
+          *wireBytes += i + 1 - start;
+          start = i + 1;
+          if (!line->empty() && line->back() == '\r') {
+            line->pop_back();
+          }
+          return true;
+        }
+      }
+      line->append(buf + start, end - start);
+      *wireBytes += end - start;
+      start = end;
+      if (!fill()) {
+        return false;
+      }
+    }
+  }
+
+  bool readBytes(size_t n, bool keep, Response *r) {
+    while (n) {
+      if (start == end && !fill()) {
+        return false;
+      }
+      size_t take = std::min(n, end - start);
+      if (keep) {
+        r->body.append(buf + start, take);
+      }
+      start += take;
+      n -= take;
+      r->bodyBytes += take;
+    }
+    return true;
+  }
+
+  bool readResponse(bool keepBody, Response *r) {
+    std::string line;
+    if (!readLine(&line, &r->headerBytes) ||
+        sscanf(line.c_str(), "HTTP/1.%*d %d", &r->status) != 1) {
+      return false;
+    }
+    ssize_t contentLength = -1;
+    bool chunked = false;
+    while (readLine(&line, &r->headerBytes)) {
+      if (line.empty()) {
+        break;
+      }
+      size_t colon = line.find(':');
+      if (colon == std::string::npos) {
+        return false;
+      }
+      std::string field = line.substr(0, colon);
+      std::string value = line.substr(colon + 1);
+      value.erase(0, value.find_first_not_of(' '));
+      if (!strcasecmp(field.c_str(), "Content-Length")) {
+        contentLength = atol(value.c_str());
+      } else if (!strcasecmp(field.c_str(), "Transfer-Encoding")) {
+        chunked = !strcasecmp(value.c_str(), "chunked");
+      } else if (!strcasecmp(field.c_str(), "ETag")) {
+        r->etag = value;
+      } else if (!strcasecmp(field.c_str(), "Content-Encoding")) {
+        r->gzip = !strcasecmp(value.c_str(), "gzip");
+      } else if (!strcasecmp(field.c_str(), "Connection")) {
+        r->close = !strcasecmp(value.c_str(), "close");
+      }
+    }
+    if (!chunked) {
+      return readBytes(contentLength > 0 ? contentLength : 0, keepBody, r);
+    }
+    while (true) {
+      size_t chunkBytes = 0;
+      if (!readLine(&line, &r->headerBytes)) {
+        return false;
+      }
+      size_t size = strtoul(line.c_str(), nullptr, 16);
+      if (!readBytes(size, keepBody, r) ||
+          !readLine(&line, &chunkBytes)) {
+        return false;
+      }
+      r->headerBytes += chunkBytes;
+      if (size == 0) {
+        return true;
+      }
+    }
+  }
+};
+
+// Counters from /diag, and the tracker's size from /heap.
+struct DeviceStats {
+  bool valid = false;
+  u64 cycles = 0;
+  u64 missedDeadlines = 0;
+  u64 totalLatenessUs = 0;
+  // The max since the previous read.
+  u64 windowMaxLatenessUs = 0;
+  u64 records = 0;
+};
+
+bool jsonNumber(const std::string &json, const char *key, u64 *value) {
+  std::string quoted = std::string("\"") + key + "\":";
+  size_t pos = json.find(quoted);
+  if (pos == std::string::npos) {
+    return false;
+  }
+  *value = strtoull(json.c_str() + pos + quoted.size(), nullptr, 10);
+  return true;
+}
+
+DeviceStats readDeviceStats(const sockaddr_in &addr) {
+  DeviceStats s;
+  Connection c(addr);
+  Response r;
+  if (!c.get("/diag?resetWindow=1", "", false, true, &r) || r.status != 200) {
+    return s;
+  }
+  s.valid = jsonNumber(r.body, "cycles", &s.cycles) &&
+            jsonNumber(r.body, "missedDeadlines", &s.missedDeadlines) &&
+            jsonNumber(r.body, "totalLatenessUs", &s.totalLatenessUs) &&
+            jsonNumber(r.body, "windowMaxLatenessUs",
+                       &s.windowMaxLatenessUs);
+  if (c.get("/heap", "", false, true, &r) && r.status == 200) {
+    jsonNumber(r.body, "records", &s.records);
+  }
+  return s;
+}
+
+struct Result {
+  std::string path;
+  bool conditional;
+  bool gzip;
+  u32 clients;
+  double seconds = 0;
+  u64 requests = 0;
+  u64 errors = 0;
+  u64 connects = 0;
+  u64 status200 = 0;
+  u64 status304 = 0;
+  u64 statusOther = 0;
+  // 200 responses that came gzip'd.
+  u64 gzipped = 0;
+  u64 headerBytes = 0;
+  u64 bodyBytes = 0;
+  std::vector<double> latenciesUs;
+  DeviceStats before;
+  DeviceStats after;
+};
+
+void runClient(const sockaddr_in &addr, const Options &o, Result *result,
+               std::chrono::steady_clock::time_point endAt,
+               std::atomic<bool> *failed, Result *mine) {
+  using clock = std::chrono::steady_clock;
+  Connection c(addr);
+  std::string etag;
+  while (clock::now() < endAt && !*failed) {
+    Response r;
+    auto start = clock::now();
+    bool ok = c.get(result->path, result->conditional ? etag : "",
+                    result->gzip, false, &r);
+    auto us =
+        std::chrono::duration<double, std::micro>(clock::now() - start).count();
+    if (!ok) {
+      ++mine->errors;
+      // Don't spin on a server that's gone.
+      if (mine->errors > 100 && mine->requests == 0) {
+        *failed = true;
+      }
+      continue;
+    }
+    ++mine->requests;
+    mine->latenciesUs.push_back(us);
+    mine->headerBytes += r.headerBytes;
+    mine->bodyBytes += r.bodyBytes;
+    if (r.status == 200) {
+      ++mine->status200;
+      mine->gzipped += r.gzip;
+      etag = r.etag;
+    } else if (r.status == 304) {
+      ++mine->status304;
+    } else {
+      ++mine->statusOther;
+    }
+  }
+  mine->connects = c.connects;
+}
+
+bool runScenario(const sockaddr_in &addr, const Options &o, Result *result) {
+  using clock = std::chrono::steady_clock;
+  result->before = readDeviceStats(addr);
+  std::vector<Result> perClient(result->clients);
+  std::vector<std::thread> threads;
+  std::atomic<bool> failed(false);
+  auto start = clock::now();
+  auto endAt = start + std::chrono::microseconds((u64)(o.durationS * 1e6));
+  for (u32 i = 0; i < result->clients; ++i) {
+    threads.emplace_back(runClient, std::cref(addr), std::cref(o), result,
+                         endAt, &failed, &perClient[i]);
+  }
+  for (auto &t : threads) {
+    t.join();
+  }
+  result->seconds =
+      std::chrono::duration<double>(clock::now() - start).count();
+  result->after = readDeviceStats(addr);
+
+  for (auto &r : perClient) {
+    result->requests += r.requests;
+    result->errors += r.errors;
+    result->connects += r.connects;
+    result->status200 += r.status200;
+    result->status304 += r.status304;
+    result->statusOther += r.statusOther;
+    result->gzipped += r.gzipped;
+    result->headerBytes += r.headerBytes;
+    result->bodyBytes += r.bodyBytes;
+    result->latenciesUs.insert(result->latenciesUs.end(),
+                               r.latenciesUs.begin(), r.latenciesUs.end());
+  }
+  std::sort(result->latenciesUs.begin(), result->latenciesUs.end());
+  return !failed;
+}
+
+double percentile(const std::vector<double> &sorted, double p) {
+  if (sorted.empty()) {
+    return 0;
+  }
+  size_t idx = (size_t)(p / 100 * (sorted.size() - 1) + 0.5);
+  return sorted[idx];
+}
+
+// The sampler's lateness over the run, from the counters before and after.
+// Reading them before restarted the window for the max.
+void printSampler(FILE *f, const Result &r) {
+  const DeviceStats &b = r.before;
+  const DeviceStats &a = r.after;
+  if (!b.valid || !a.valid || a.cycles <= b.cycles) {
+    fprintf(f, "null");
+    return;
+  }
+  u64 cycles = a.cycles - b.cycles;
+  fprintf(f,
+          "{ \"cycles\": %llu, \"missedDeadlines\": %llu, "
+          "\"meanLatenessUs\": %.0f, \"maxLatenessUs\": %llu }",
+          (unsigned long long)cycles,
+          (unsigned long long)(a.missedDeadlines - b.missedDeadlines),
+          (double)(a.totalLatenessUs - b.totalLatenessUs) / cycles,
+          (unsigned long long)a.windowMaxLatenessUs);
+}
+
+void printResults(FILE *f, const Options &o, const std::vector<Result> &results) {
+  fprintf(f, "{\n");
+  fprintf(f, "  \"target\": \"%s:%u\",\n", o.host, o.port);
+  fprintf(f, "  \"durationS\": %.1f,\n", o.durationS);
+  if (!results.empty() && results[0].before.valid) {
+    fprintf(f, "  \"records\": %llu,\n",
+            (unsigned long long)results[0].before.records);
+  } else {
+    fprintf(f, "  \"records\": null,\n");
+  }
+  fprintf(f, "  \"scenarios\": [\n");
+  for (size_t i = 0; i < results.size(); ++i) {
+    const Result &r = results[i];
+    u64 n = r.requests ? r.requests : 1;
+    fprintf(f,
+            "    { \"path\": \"%s\", \"conditional\": %s, \"gzip\": %s, "
+            "\"clients\": %u, "
+            "\"requests\": %llu, \"errors\": %llu, \"connects\": %llu, "
+            "\"status200\": %llu, \"status304\": %llu, \"statusOther\": %llu, "
+            "\"gzipped\": %llu, "
+            "\"requestsPerS\": %.1f, \"p50Ms\": %.3f, \"p99Ms\": %.3f, "
+            "\"maxMs\": %.3f, \"bytesPerResponse\": %.0f, "
+            "\"bodyBytesPerResponse\": %.0f, \"sampler\": ",
+            r.path.c_str(), r.conditional ? "true" : "false",
+            r.gzip ? "true" : "false", r.clients,
+            (unsigned long long)r.requests, (unsigned long long)r.errors,
+            (unsigned long long)r.connects, (unsigned long long)r.status200,
+            (unsigned long long)r.status304,
+            (unsigned long long)r.statusOther, (unsigned long long)r.gzipped,
+            r.requests / r.seconds,
+            percentile(r.latenciesUs, 50) / 1000,
+            percentile(r.latenciesUs, 99) / 1000,
+            r.latenciesUs.empty() ? 0 : r.latenciesUs.back() / 1000,
+            (double)(r.headerBytes + r.bodyBytes) / n,
+            (double)r.bodyBytes / n);
+    printSampler(f, r);
+    fprintf(f, " }%s\n", i + 1 < results.size() ? "," : "");
+  }
+  fprintf(f, "  ]\n}\n");
+}
+
+template <class T>
+std::vector<T> splitList(const char *s, T (*parse)(const std::string &)) {
+  std::vector<T> out;
+  std::string item;
+  for (const char *p = s;; ++p) {
+    if (*p == ',' || !*p) {
+      if (!item.empty()) {
+        out.push_back(parse(item));
+      }
+      item.clear();
+      if (!*p) {
+        break;
+      }
+    } else {
+      item += *p;
+    }
+  }
+  return out;
+}
+
+void usage(const char *argv0) {
+  fprintf(stderr,
+          "Usage: %s [options]\n"
+          "  --host HOST          Device or emulator address (default "
+          "127.0.0.1)\n"
+          "  --port N             HTTP port (default 8080)\n"
+          "  --paths P,...        Paths to request (default /)\n"
+          "  --clients N,...      Concurrent clients to run with (default "
+          "1,4)\n"
+          "  --duration S         Seconds per scenario (default 5)\n"
+          "  --conditional MODE   off, on or both (default both)\n"
+          "  --gzip MODE          Accept gzip: off, on or both (default off)\n"
+          "  --json FILE          Write the results here instead of stdout\n",
+          argv0);
+  exit(2);
+}
+
+bool parseOptions(int argc, char **argv, Options *o) {
+  for (int i = 1; i < argc; ++i) {
+    const char *arg = argv[i];
+    const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+    if (!value) {
+      return false;
+    }
+    ++i;
+    if (!strcmp(arg, "--host")) {
+      o->host = value;
+    } else if (!strcmp(arg, "--port")) {
+      o->port = (u16)atoi(value);
+    } else if (!strcmp(arg, "--paths")) {
+      o->paths = splitList<std::string>(
+          value, [](const std::string &s) { return s; });
+    } else if (!strcmp(arg, "--clients")) {
+      o->clients = splitList<u32>(
+          value, [](const std::string &s) { return (u32)atoi(s.c_str()); });
+    } else if (!strcmp(arg, "--duration")) {
+      o->durationS = atof(value);
+    } else if (!strcmp(arg, "--conditional")) {
+      o->plain = strcmp(value, "on") != 0;
+      o->conditional = strcmp(value, "off") != 0;
+    } else if (!strcmp(arg, "--gzip")) {
+      o->identity = strcmp(value, "on") != 0;
+      o->gzip = strcmp(value, "off") != 0;
+    } else if (!strcmp(arg, "--json")) {
+      o->jsonPath = value;
+    } else {
+      return false;
+    }
+  }
+  return !o->paths.empty() && !o->clients.empty() && o->durationS > 0 &&
+         std::find(o->clients.begin(), o->clients.end(), 0u) ==
+             o->clients.end();
+}
+
+bool resolve(const Options &o, sockaddr_in *addr) {
+  addrinfo hints = {};
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo *info = nullptr;
+  if (getaddrinfo(o.host, nullptr, &hints, &info) || !info) {
+    return false;
+  }
+  *addr = *(const sockaddr_in *)info->ai_addr;
+  addr->sin_port = htons(o.port);
+  freeaddrinfo(info);
+  return true;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  Options o;
+  if (!parseOptions(argc, argv, &o)) {
+    usage(argv[0]);
+  }
+  sockaddr_in addr;
+  if (!resolve(o, &addr)) {
+    fprintf(stderr, "Can't resolve %s\n", o.host);
+    return 1;
+  }
+
+  std::vector<Result> results;
+  for (const auto &path : o.paths) {
+    for (int conditional = 0; conditional < 2; ++conditional) {
+      if (!(conditional ? o.conditional : o.plain)) {
+        continue;
+      }
+      for (int gzip = 0; gzip < 2; ++gzip) {
+        if (!(gzip ? o.gzip : o.identity)) {
+          continue;
+        }
+        for (u32 clients : o.clients) {
+          Result r;
+          r.path = path;
+          r.conditional = conditional;
+          r.gzip = gzip;
+          r.clients = clients;
+          fprintf(stderr, "%s%s%s, %u clients...\n", path.c_str(),
+                  conditional ? " (conditional)" : "", gzip ? " (gzip)" : "",
+                  clients);
+          if (!runScenario(addr, o, &r)) {
+            fprintf(stderr, "Can't reach %s:%u\n", o.host, o.port);
+            return 1;
+          }
+          results.push_back(std::move(r));
+        }
+      }
+    }
+  }
+
+  FILE *f = o.jsonPath ? fopen(o.jsonPath, "w") : stdout;
+  if (!f) {
+    perror(o.jsonPath);
+    return 1;
+  }
+  printResults(f, o, results);
+  if (f != stdout) {
+    fclose(f);
+  }
+  return 0;
+}
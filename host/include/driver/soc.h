@@ -0,0 +1,15 @@
+// Host stand-in for driver/soc.h. The cycle counter follows the simulated
+// bus clock.
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+uint32_t soc_get_ccount(void);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,25 @@
+// Host stand-in for esp8266/eagle_soc.h. GPIO register accesses go to the
+// simulated bus in onewire_sim.cpp.
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define GPIO_OUT_W1TS_ADDRESS 0x04
+#define GPIO_OUT_W1TC_ADDRESS 0x08
+#define GPIO_ENABLE_W1TS_ADDRESS 0x10
+#define GPIO_ENABLE_W1TC_ADDRESS 0x14
+#define GPIO_IN_ADDRESS 0x18
+
+void hostGpioRegWrite(uint32_t reg, uint32_t val);
+uint32_t hostGpioRegRead(uint32_t reg);
+
+#define GPIO_REG_WRITE(reg, val) hostGpioRegWrite(reg, val)
+#define GPIO_REG_READ(reg) hostGpioRegRead(reg)
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,2 @@
+// Host stand-in for esp8266/rom_functions.h.
+#pragma once
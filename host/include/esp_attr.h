@@ -0,0 +1,5 @@
+// Host stand-in for esp_attr.h. There's no RTC memory, so nothing survives
+// a restart of the emulator.
+#pragma once
+
+#define RTC_DATA_ATTR
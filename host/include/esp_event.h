@@ -0,0 +1,32 @@
+// Host stand-in for esp_event.h. The emulator never posts events, as its
+// network never goes down.
+#pragma once
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef const char *esp_event_base_t;
+typedef void (*esp_event_handler_t)(void *event_handler_arg,
+                                    esp_event_base_t event_base,
+                                    int32_t event_id, void *event_data);
+
+extern esp_event_base_t IP_EVENT;
+extern esp_event_base_t WIFI_EVENT;
+
+#define IP_EVENT_STA_GOT_IP 0
+#define WIFI_EVENT_STA_DISCONNECTED 5
+
+esp_err_t esp_event_loop_create_default();
+esp_err_t esp_event_handler_register(esp_event_base_t event_base,
+                                     int32_t event_id,
+                                     esp_event_handler_t event_handler,
+                                     void *event_handler_arg);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
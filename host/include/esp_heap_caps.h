@@ -0,0 +1,17 @@
+// Host stand-in for esp_heap_caps.h. The emulator reports the host's heap,
+// which says little about the device's. See /heap for the tracker's budget.
+#pragma once
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MALLOC_CAP_8BIT (1 << 2)
+
+size_t heap_caps_get_free_size(unsigned int caps);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,2 @@
+// Host stand-in for esp_log.h.
+#pragma once
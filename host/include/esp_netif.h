@@ -0,0 +1,14 @@
+// Host stand-in for esp_netif.h. The emulator uses the host's network.
+#pragma once
+
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+esp_err_t esp_netif_init();
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,31 @@
+// Host stand-in for esp_sntp.h. Time comes from the virtual clock instead.
+#pragma once
+
+#include <stdbool.h>
+#include <sys/time.h>
+
+#include "os.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SNTP_OPMODE_POLL 0
+
+typedef enum {
+  SNTP_SYNC_STATUS_RESET,
+  SNTP_SYNC_STATUS_COMPLETED,
+  SNTP_SYNC_STATUS_IN_PROGRESS,
+} sntp_sync_status_t;
+
+typedef void (*sntp_sync_time_cb_t)(struct timeval *tv);
+
+void sntp_setoperatingmode(int mode);
+void sntp_setservername(int idx, const char *server);
+void sntp_set_time_sync_notification_cb(sntp_sync_time_cb_t callback);
+void sntp_init();
+sntp_sync_status_t sntp_get_sync_status();
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,15 @@
+// Host stand-in for esp_timer.h.
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Monotonic time in microseconds.
+int64_t esp_timer_get_time();
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,21 @@
+// Host stand-in for esp_wifi.h. The emulator uses the host's network, which
+// doesn't sleep.
+#pragma once
+
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+  WIFI_PS_NONE,
+  WIFI_PS_MIN_MODEM,
+  WIFI_PS_MAX_MODEM,
+} wifi_ps_type_t;
+
+esp_err_t esp_wifi_set_ps(wifi_ps_type_t type);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,36 @@
+// Host stand-in for FreeRTOS.h. Only what the firmware modules built on the
+// host use.
+#pragma once
+
+#include <stdint.h>
+
+#include "os.h"
+#include "sdkconfig.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef uint32_t TickType_t;
+typedef long BaseType_t;
+typedef unsigned long UBaseType_t;
+
+#define configTICK_RATE_HZ CONFIG_FREERTOS_HZ
+#define portTICK_PERIOD_MS (1000 / configTICK_RATE_HZ)
+#define portMAX_DELAY ((TickType_t)0xffffffffUL)
+#define pdMS_TO_TICKS(ms) ((TickType_t)((ms) * configTICK_RATE_HZ / 1000))
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+
+#define configASSERT(x)                                                        \
+  do {                                                                         \
+    if (!(x)) {                                                                \
+      fprintf(stderr, "%s:%d: assert failed: %s\n", __FILE__, __LINE__, #x);  \
+      abort();                                                                 \
+    }                                                                          \
+  } while (0)
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
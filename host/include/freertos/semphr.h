@@ -0,0 +1,19 @@
+// Host stand-in for FreeRTOS semphr.h. Mutexes only. In the host tools, there
+// are no other tasks to exclude. The emulator implements waiting.
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef void *SemaphoreHandle_t;
+
+SemaphoreHandle_t xSemaphoreCreateMutex();
+BaseType_t xSemaphoreTake(SemaphoreHandle_t xSemaphore, TickType_t ticks);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t xSemaphore);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,33 @@
+// Host stand-in for FreeRTOS task.h. Inert in the host tools, see
+// rtos_stubs.c. The emulator runs tasks on threads, see emu_rtos.c.
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef void *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+#define tskIDLE_PRIORITY 0
+
+BaseType_t xTaskCreate(TaskFunction_t pvTaskCode, const char *pcName,
+                       uint32_t usStackDepth, void *pvParameters,
+                       UBaseType_t uxPriority, TaskHandle_t *pxCreatedTask);
+void vTaskDelay(TickType_t xTicksToDelay);
+void vTaskDelayUntil(TickType_t *pxPreviousWakeTime,
+                     TickType_t xTimeIncrement);
+TickType_t xTaskGetTickCount();
+void vTaskDelete(TaskHandle_t xTaskToDelete);
+BaseType_t xTaskNotifyGive(TaskHandle_t xTaskToNotify);
+uint32_t ulTaskNotifyTake(BaseType_t xClearCountOnExit,
+                          TickType_t xTicksToWait);
+
+void taskENTER_CRITICAL();
+void taskEXIT_CRITICAL();
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,4 @@
+// Host stand-in for lwip/netdb.h.
+#pragma once
+
+#include <netdb.h>
@@ -0,0 +1,8 @@
+// Host stand-in for lwip/sockets.h. lwIP has the BSD socket API under the
+// same names.
+#pragma once
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
@@ -0,0 +1,16 @@
+// Host stand-in for nvs_flash.h.
+#pragma once
+
+#include "nvs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+esp_err_t nvs_flash_init();
+// Host only. Erase everything, as if the flash was wiped.
+void hostNvsErase();
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
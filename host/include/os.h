@@ -0,0 +1,25 @@
+// Host stand-in for the ESP8266 RTOS SDK os.h.
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "host_shims.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int os_printf(const char *format, ...);
+
+#define os_malloc malloc
+#define os_zalloc(size) calloc(1, size)
+#define os_realloc realloc
+#define os_free free
+#define os_memcpy memcpy
+#define os_memset memset
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
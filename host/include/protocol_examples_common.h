@@ -0,0 +1,15 @@
+// Host stand-in for the IDF examples' connection helper. In the emulator,
+// connecting takes a configurable time, see emu_net.c.
+#pragma once
+
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+esp_err_t example_connect();
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,15 @@
+// Host stand-in for rom/ets_sys.h. Delays advance the simulated bus clock
+// instead of waiting.
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void os_delay_us(uint16_t us);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
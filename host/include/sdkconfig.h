@@ -0,0 +1,62 @@
+// Host build configuration. Mirrors the project settings in ../../sdkconfig
+// that the firmware modules built on the host depend on, except where noted.
+#pragma once
+
+#define CONFIG_FREERTOS_HZ 100
+#define CONFIG_ESP8266_DEFAULT_CPU_FREQ_MHZ 160
+
+#define CONFIG_ONEWIRE_PIN 2
+#define CONFIG_SAMPLE_PERIOD_MS 1000
+#define CONFIG_TEMP_PLAUSIBLE_MIN -50
+#define CONFIG_TEMP_PLAUSIBLE_MAX 50
+#define CONFIG_TEMP_FILTER_WINDOW 7
+#define CONFIG_TEMP_FILTER_MIN_DEVIATION 20
+// Raised from 8 so onewire_bench can run large buses.
+#define CONFIG_DS18B20_MAX_SENSORS 100
+#define CONFIG_DS18B20_RESCAN_PERIOD_S 300
+#define CONFIG_DS18B20_RECOVER_AFTER_FAILURES 3
+
+#define CONFIG_TM1637_CLK_PIN 1
+#define CONFIG_TM1637_DIO_PIN 3
+#define CONFIG_DISPLAY_FRAME_MS 2000
+#define CONFIG_DISPLAY_SHOW_MIN_MAX 1
+
+#define CONFIG_TRACKER_MAX_DAYS 180
+#define CONFIG_TRACKER_PRESYNC_BUCKETS 48
+#define CONFIG_TRACKER_RENDER_CACHE_BYTES 8192
+
+#define CONFIG_HTTP_GZIP 1
+#define CONFIG_HTTP_GZIP_CACHE_BYTES 4096
+#define CONFIG_HTTP_IMPORT_TOKEN "emulator"
+
+// Enabled so that the emulator can publish to host/udp_collector.
+#define CONFIG_PUBLISH_ENABLED 1
+#define CONFIG_PUBLISH_HOST "127.0.0.1"
+#define CONFIG_PUBLISH_PORT 7070
+#define CONFIG_PUBLISH_SAMPLE_PERIOD_S 60
+#define CONFIG_PUBLISH_BATCH_S 300
+#define CONFIG_PUBLISH_OUTBOX_BYTES 4096
+
+// Enabled so that the emulator's alerts can be tried, with two sensors.
+#define CONFIG_ALERTS_ENABLED 1
+#define CONFIG_ALERT_SENSORS 2
+#define CONFIG_ALERT_HIGH_DECI_C 300
+#define CONFIG_ALERT_LOW_DECI_C 50
+#define CONFIG_ALERT_HYSTERESIS_DECI_C 5
+#define CONFIG_ALERT_MIN_DURATION_S 60
+#define CONFIG_ALERT_LED_PIN -1
+
+// Enabled so that the emulator reports its power estimate. The light sleep
+// itself is up to the SDK's FreeRTOS.
+#define CONFIG_POWER_SAVE_ENABLED 1
+#define CONFIG_ENABLE_FREERTOS_SLEEP 1
+#define CONFIG_POWER_WIFI_MIN_MODEM 1
+#define CONFIG_POWER_ACTIVE_UA 15000
+#define CONFIG_POWER_SLEEP_UA 900
+#define CONFIG_POWER_RADIO_UA 1600
+
+// Enabled so trace_replay can report the tracker's allocations.
+#define CONFIG_ALLOC_TRACING 1
+#define CONFIG_LOG_RING_BYTES 2048
+// Enabled so that --verbose shows log messages as they happen.
+#define CONFIG_LOG_UART 1
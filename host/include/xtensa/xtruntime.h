@@ -0,0 +1,19 @@
+// Host stand-in for xtensa/xtruntime.h. Interrupt masking is only recorded,
+// so the simulator can report how long interrupts would be disabled.
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+uint32_t hostIrqDisable();
+void hostIrqRestore(uint32_t level);
+
+#define XTOS_DISABLE_ALL_INTERRUPTS hostIrqDisable()
+#define XTOS_RESTORE_INTLEVEL(level) hostIrqRestore(level)
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
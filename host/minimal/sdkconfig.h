@@ -0,0 +1,29 @@
+// Host build configuration with every optional feature off, for the
+// firmware_minimal target, which only checks that main/ compiles without
+// them. Otherwise the settings of ../../sdkconfig.
+#pragma once
+
+#define CONFIG_FREERTOS_HZ 100
+#define CONFIG_ESP8266_DEFAULT_CPU_FREQ_MHZ 160
+
+#define CONFIG_ONEWIRE_PIN 2
+#define CONFIG_SAMPLE_PERIOD_MS 1000
+#define CONFIG_TEMP_PLAUSIBLE_MIN -50
+#define CONFIG_TEMP_PLAUSIBLE_MAX 50
+#define CONFIG_TEMP_FILTER_WINDOW 7
+#define CONFIG_TEMP_FILTER_MIN_DEVIATION 20
+#define CONFIG_DS18B20_MAX_SENSORS 8
+#define CONFIG_DS18B20_RESCAN_PERIOD_S 0
+#define CONFIG_DS18B20_RECOVER_AFTER_FAILURES 3
+
+#define CONFIG_TM1637_CLK_PIN 1
+#define CONFIG_TM1637_DIO_PIN 3
+#define CONFIG_DISPLAY_FRAME_MS 2000
+
+#define CONFIG_TRACKER_MAX_DAYS 180
+#define CONFIG_TRACKER_PRESYNC_BUCKETS 48
+#define CONFIG_TRACKER_RENDER_CACHE_BYTES 0
+
+#define CONFIG_HTTP_IMPORT_TOKEN ""
+
+#define CONFIG_LOG_RING_BYTES 2048
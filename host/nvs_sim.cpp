@@ -0,0 +1,67 @@
+// In-memory stand-in for NVS.
+
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "nvs_flash.h"
+
+namespace {
+
+std::map<std::string, std::vector<uint8_t>> store;
+std::vector<std::string> namespaces;
+
+std::string fullKey(nvs_handle handle, const char *key) {
+  return namespaces.at(handle) + "/" + key;
+}
+
+} // namespace
+
+extern "C" {
+
+esp_err_t nvs_flash_init() { return ESP_OK; }
+
+void hostNvsErase() { store.clear(); }
+
+esp_err_t nvs_open(const char *name, nvs_open_mode open_mode,
+                   nvs_handle *out_handle) {
+  namespaces.push_back(name);
+  *out_handle = (nvs_handle)(namespaces.size() - 1);
+  return ESP_OK;
+}
+
+esp_err_t nvs_get_blob(nvs_handle handle, const char *key, void *out_value,
+                       size_t *length) {
+  auto it = store.find(fullKey(handle, key));
+  if (it == store.end()) {
+    return ESP_ERR_NVS_NOT_FOUND;
+  }
+  if (!out_value) {
+    *length = it->second.size();
+    return ESP_OK;
+  }
+  if (*length < it->second.size()) {
+    return ESP_ERR_NVS_INVALID_LENGTH;
+  }
+  *length = it->second.size();
+  memcpy(out_value, it->second.data(), *length);
+  return ESP_OK;
+}
+
+esp_err_t nvs_set_blob(nvs_handle handle, const char *key, const void *value,
+                       size_t length) {
+  auto *p = static_cast<const uint8_t *>(value);
+  store[fullKey(handle, key)] = std::vector<uint8_t>(p, p + length);
+  return ESP_OK;
+}
+
+esp_err_t nvs_erase_key(nvs_handle handle, const char *key) {
+  return store.erase(fullKey(handle, key)) ? ESP_OK : ESP_ERR_NVS_NOT_FOUND;
+}
+
+esp_err_t nvs_commit(nvs_handle handle) { return ESP_OK; }
+
+void nvs_close(nvs_handle handle) {}
+
+} // extern "C"
@@ -0,0 +1,253 @@
+// Run the firmware's 1-Wire search and DS18B20 read paths against the
+// simulated bus, and report bus slots and time per operation for a range of
+// sensor counts.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "int_types.h"
+#include "ds18b20.h"
+#include "host_shims.h"
+#include "nvs_flash.h"
+#include "onewire_sim.h"
+
+extern "C" Temp16 ds18b20_read(DS18B20_Sensors *sensors, u8 target);
+
+namespace {
+
+// ONEWIRE_PIN in onewire.c.
+const int BUS_PIN = CONFIG_ONEWIRE_PIN;
+
+struct Options {
+  std::vector<int> sensorCounts = {1, 2, 5, 10, 20, 50, 100};
+  int alarmCycles = 1000;
+  int alarmSwings = 1;
+  double bitErrorRate = 0;
+  u32 seed = 1;
+};
+
+struct SimDevice {
+  u8 rom[8];
+  float tempCelcius;
+};
+
+void usage() {
+  fprintf(stderr,
+          "Usage: onewire_bench [options]\n"
+          "  --sensors N[,N...]    Sensor counts to run (default "
+          "1,2,5,10,20,50,100)\n"
+          "  --bit-error-rate P    Flip bits sent by the sensors with "
+          "probability P\n"
+          "  --seed S              Seed for ROM codes, temperatures and "
+          "errors\n"
+          "  --alarm-cycles K      Samples per simulated day in alarm mode "
+          "(default 1000)\n"
+          "  --alarm-swings W      Temperature swings per simulated day "
+          "(default 1)\n"
+          "  --verbose             Show firmware log output\n");
+  exit(2);
+}
+
+Options parseArgs(int argc, char **argv) {
+  Options o;
+  for (int i = 1; i < argc; ++i) {
+    std::string a = argv[i];
+    bool hasValue = i + 1 < argc;
+    if (a == "--sensors" && hasValue) {
+      o.sensorCounts.clear();
+      for (char *tok = strtok(argv[++i], ","); tok; tok = strtok(NULL, ",")) {
+        o.sensorCounts.push_back(atoi(tok));
+      }
+    } else if (a == "--bit-error-rate" && hasValue) {
+      o.bitErrorRate = atof(argv[++i]);
+    } else if (a == "--alarm-cycles" && hasValue) {
+      o.alarmCycles = atoi(argv[++i]);
+    } else if (a == "--alarm-swings" && hasValue) {
+      o.alarmSwings = atoi(argv[++i]);
+    } else if (a == "--seed" && hasValue) {
+      o.seed = (u32)atoi(argv[++i]);
+    } else if (a == "--verbose") {
+      hostVerbose = 1;
+    } else {
+      usage();
+    }
+  }
+  return o;
+}
+
+const SimDevice *findDevice(const std::vector<SimDevice> &devs,
+                            const u8 *rom) {
+  for (auto &d : devs) {
+    if (memcmp(d.rom, rom, 8) == 0) {
+      return &d;
+    }
+  }
+  return nullptr;
+}
+
+struct AlarmResult {
+  double slotsPerCycle = 0;
+  double readsPerCycle = 0;
+  u32 exact = 0;
+};
+
+// Run a simulated day of samples, each sensor swinging around its start
+// temperature with its own phase and amplitude, and track the per sensor
+// extremes with alarm scans. Checks the result against the extremes of the
+// simulated values.
+AlarmResult runAlarmMode(const Options &o, std::vector<SimDevice> &devs,
+                         DS18B20_Sensors &sensors, std::mt19937_64 &rng) {
+  std::uniform_real_distribution<double> phase(0, 2 * M_PI);
+  std::uniform_real_distribution<double> amplitude(2, 8);
+  std::vector<double> phases(devs.size());
+  std::vector<double> amplitudes(devs.size());
+  std::vector<float> base(devs.size());
+  for (size_t i = 0; i < devs.size(); ++i) {
+    phases[i] = phase(rng);
+    amplitudes[i] = amplitude(rng);
+    base[i] = devs[i].tempCelcius;
+  }
+  std::vector<Temp16> minRaw(devs.size(), TEMP16_MAX);
+  std::vector<Temp16> maxRaw(devs.size(), TEMP16_MIN);
+  AlarmResult r;
+
+  ds18b20_alarm_new_period(&sensors);
+  owSimResetStats();
+  u32 readsBefore = sensors.alarm_reads;
+  for (int c = 0; c < o.alarmCycles; ++c) {
+    for (size_t i = 0; i < devs.size(); ++i) {
+      double t = base[i] + amplitudes[i] * sin(2 * M_PI * c * o.alarmSwings /
+                                               o.alarmCycles +
+                                           phases[i]);
+      Temp16 raw = (Temp16)lround(t * 16);
+      devs[i].tempCelcius = raw / 16.0f;
+      owSimSetTemperature((int)i, devs[i].tempCelcius);
+      minRaw[i] = std::min(minRaw[i], raw);
+      maxRaw[i] = std::max(maxRaw[i], raw);
+    }
+    ds18b20_start_conversion(&sensors);
+    ds18b20_alarm_scan(&sensors);
+  }
+  r.slotsPerCycle = (double)owSimGetStats()->slots / o.alarmCycles;
+  r.readsPerCycle =
+      (double)(sensors.alarm_reads - readsBefore) / o.alarmCycles;
+
+  for (u8 s = 0; s < sensors.count; ++s) {
+    const SimDevice *d = findDevice(devs, sensors.addresses + s * 8);
+    size_t i = d - devs.data();
+    if (sensors.has_extremes[s] && sensors.min_raw[s] == minRaw[i] &&
+        sensors.max_raw[s] == maxRaw[i]) {
+      ++r.exact;
+    }
+  }
+  return r;
+}
+
+void runBench(const Options &o, int sensorCount, bool last) {
+  std::mt19937_64 rng(o.seed);
+  std::uniform_int_distribution<int> temp16(-20 * 16, 40 * 16);
+
+  owSimReset();
+  owSimAttach(BUS_PIN);
+  hostNvsErase();
+  std::vector<SimDevice> devs(sensorCount);
+  for (auto &d : devs) {
+    owSimMakeRom(d.rom, rng() & 0xffffffffffffULL);
+    d.tempCelcius = temp16(rng) / 16.0f;
+    owSimAddDevice(d.rom, d.tempCelcius);
+  }
+  owSimSetBitErrorRate(o.bitErrorRate, o.seed);
+
+  DS18B20_Sensors sensors;
+  double t0 = owSimNowUs();
+  ds18b20_setup(&sensors);
+  double setupUs = owSimNowUs() - t0;
+  OwSimStats setup = *owSimGetStats();
+
+  owSimResetStats();
+  t0 = owSimNowUs();
+  ds18b20_start_conversion(&sensors);
+  u32 ok = 0;
+  u32 failed = 0;
+  u32 wrong = 0;
+  for (u8 i = 0; i < sensors.count; ++i) {
+    Temp16 v = ds18b20_read(&sensors, i);
+    const SimDevice *d = findDevice(devs, sensors.addresses + i * 8);
+    if (v == TEMP16_INVALID) {
+      ++failed;
+    } else if (!d || v != lroundf(d->tempCelcius * 16)) {
+      ++wrong;
+    } else {
+      ++ok;
+    }
+  }
+  double readUs = owSimNowUs() - t0;
+  OwSimStats read = *owSimGetStats();
+  u32 n = sensors.count ? sensors.count : 1;
+
+  // Boot again, now with the sensors cached in NVS.
+  DS18B20_Sensors cached;
+  owSimResetStats();
+  t0 = owSimNowUs();
+  ds18b20_setup(&cached);
+  double cachedUs = owSimNowUs() - t0;
+  OwSimStats cachedBoot = *owSimGetStats();
+
+  // Plug in another sensor and look for it.
+  u8 rom[8];
+  owSimMakeRom(rom, rng() & 0xffffffffffffULL);
+  owSimAddDevice(rom, 20.0f);
+  owSimResetStats();
+  t0 = owSimNowUs();
+  bool changed = ds18b20_rescan(&cached);
+  double rescanUs = owSimNowUs() - t0;
+  OwSimStats rescan = *owSimGetStats();
+  owSimSetPresent((int)devs.size(), false);
+  ds18b20_rescan(&cached);
+
+  AlarmResult alarm = runAlarmMode(o, devs, cached, rng);
+
+  printf("  { \"sensors\": %d, \"found\": %u, "
+         "\"setup\": { \"resets\": %u, \"slots\": %u, \"busUs\": %.0f, "
+         "\"maxIrqMaskedUs\": %u }, "
+         "\"readAll\": { \"slotsPerSensor\": %u, \"busUsPerSensor\": %.0f, "
+         "\"ok\": %u, \"failed\": %u, \"wrong\": %u, "
+         "\"injectedErrors\": %u, \"lateSamples\": %u, "
+         "\"maxSampleUs\": %.1f, \"irqMaskedUsPerSensor\": %llu, "
+         "\"maxIrqMaskedUs\": %u }, "
+         "\"cachedSetup\": { \"fromCache\": %s, \"resets\": %u, "
+         "\"slots\": %u, \"busUs\": %.0f }, "
+         "\"rescanAfterAdd\": { \"changed\": %s, \"count\": %u, "
+         "\"slots\": %u, \"busUs\": %.0f }, "
+         "\"alarmMode\": { \"cycles\": %d, \"slotsPerCycle\": %.0f, "
+         "\"readsPerCycle\": %.2f, \"fullReadSlots\": %u, "
+         "\"exactExtremes\": %u } }%s\n",
+         sensorCount, sensors.count, setup.resets, setup.slots, setupUs,
+         setup.maxIrqMaskedUs, read.slots / n, readUs / n, ok, failed, wrong,
+         setup.injectedErrors + read.injectedErrors,
+         setup.lateSamples + read.lateSamples, read.maxSampleUs,
+         (unsigned long long)(read.irqMaskedUs / n), read.maxIrqMaskedUs,
+         cached.from_cache ? "true" : "false", cachedBoot.resets,
+         cachedBoot.slots, cachedUs, changed ? "true" : "false",
+         cached.count, rescan.slots, rescanUs, o.alarmCycles,
+         alarm.slotsPerCycle, alarm.readsPerCycle,
+         read.slots, alarm.exact, last ? "" : ",");
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  Options o = parseArgs(argc, argv);
+  printf("[\n");
+  for (size_t i = 0; i < o.sensorCounts.size(); ++i) {
+    runBench(o, o.sensorCounts[i], i + 1 == o.sensorCounts.size());
+  }
+  printf("]\n");
+  return 0;
+}
@@ -0,0 +1,502 @@
+// Simulated 1-Wire bus with emulated DS18B20 sensors. See onewire_sim.h.
+
+#include <cmath>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "driver/gpio.h"
+#include "driver/soc.h"
+#include "esp8266/eagle_soc.h"
+#include "rom/ets_sys.h"
+#include "sdkconfig.h"
+#include "xtensa/xtruntime.h"
+
+#include "onewire_sim.h"
+
+namespace {
+
+// Bus timing, in microseconds.
+const double RESET_MIN_US = 480;
+// A low pulse shorter than this is a 1 bit.
+const double WRITE_ONE_MAX_US = 15;
+const double PRESENCE_DELAY_US = 20;
+const double PRESENCE_LENGTH_US = 120;
+// How long a device holds the bus low to send a 0 bit.
+const double READ_ZERO_US = 30;
+// The master must sample a read slot within this time from the falling edge.
+const double READ_SAMPLE_MAX_US = 15;
+const double SLOT_MIN_US = 60;
+
+// Estimated CPU time of the firmware's GPIO accesses, which moves its bus
+// edges and samples later than the delays alone would. A driver call checks
+// its arguments and does a read-modify-write of the GPIO registers, while a
+// direct register access is a single store or load.
+const double DRIVER_CALL_US = 0.5;
+const double REGISTER_ACCESS_US = 0.025;
+
+const u8 ROM_SEARCH = 0xF0;
+const u8 ROM_READ = 0x33;
+const u8 ROM_MATCH = 0x55;
+const u8 ROM_SKIP = 0xCC;
+const u8 ROM_ALARM_SEARCH = 0xEC;
+
+const u8 CONVERT_T = 0x44;
+const u8 WRITE_SCRATCHPAD = 0x4E;
+const u8 READ_SCRATCHPAD = 0xBE;
+const u8 COPY_SCRATCHPAD = 0x48;
+const u8 RECALL_EEPROM = 0xB8;
+const u8 READ_POWER_SUPPLY = 0xB4;
+
+enum class Mode { Idle, Rx, Tx, Search };
+enum class RxTarget { RomCmd, MatchRom, FuncCmd, WriteScratchpad };
+
+struct Device {
+  u8 rom[8];
+  u8 scratchpad[9];
+  u8 eeprom[3];
+  s16 rawTemp;
+  bool present = true;
+  bool alarm = false;
+
+  Mode mode = Mode::Idle;
+  RxTarget rxTarget = RxTarget::RomCmd;
+  u8 rxBuf[8];
+  u32 rxBits = 0;
+  u32 rxNeeded = 0;
+  u8 txBuf[9];
+  u32 txBits = 0;
+  u32 txPos = 0;
+  u32 searchBit = 0;
+  u8 searchPhase = 0;
+  // Sent a bit in the current slot, so the slot is not also received.
+  bool sentInSlot = false;
+};
+
+std::vector<Device> devices;
+int busPin = -1;
+double nowUs = 0;
+
+bool masterLow = false;
+bool masterOutputEnabled = true;
+u32 masterLevel = 1;
+double lastFallUs = 0;
+double lastLowUs = 0;
+bool sampledSinceFall = false;
+double holdLowUntilUs = 0;
+double presenceFromUs = 0;
+double presenceUntilUs = 0;
+
+u32 irqDepth = 0;
+double irqMaskedSinceUs = 0;
+
+double bitErrorRate = 0;
+std::mt19937 rng;
+OwSimStats stats;
+
+u8 crc8(const u8 *data, size_t len) {
+  u8 crc = 0;
+  for (size_t i = 0; i < len; ++i) {
+    crc ^= data[i];
+    for (int b = 0; b < 8; ++b) {
+      crc = (crc & 1) ? (crc >> 1) ^ 0x8C : crc >> 1;
+    }
+  }
+  return crc;
+}
+
+bool bitOf(const u8 *buf, u32 idx) { return (buf[idx / 8] >> (idx % 8)) & 1; }
+
+void updateScratchpadCrc(Device &d) { d.scratchpad[8] = crc8(d.scratchpad, 8); }
+
+void startRx(Device &d, RxTarget target, u32 bits) {
+  d.mode = Mode::Rx;
+  d.rxTarget = target;
+  d.rxBits = 0;
+  d.rxNeeded = bits;
+  memset(d.rxBuf, 0, sizeof(d.rxBuf));
+}
+
+void startTx(Device &d, const u8 *data, u32 bits) {
+  d.mode = Mode::Tx;
+  memcpy(d.txBuf, data, (bits + 7) / 8);
+  d.txBits = bits;
+  d.txPos = 0;
+}
+
+void startSearch(Device &d) {
+  d.mode = Mode::Search;
+  d.searchBit = 0;
+  d.searchPhase = 0;
+}
+
+void convert(Device &d) {
+  ++stats.conversions;
+  d.scratchpad[0] = (u8)(d.rawTemp & 0xff);
+  d.scratchpad[1] = (u8)((u16)d.rawTemp >> 8);
+  // Alarm compares the integer part of the temperature with TH and TL.
+  s8 whole = (s8)(d.rawTemp >> 4);
+  d.alarm = whole >= (s8)d.scratchpad[2] || whole <= (s8)d.scratchpad[3];
+  updateScratchpadCrc(d);
+}
+
+void onRxDone(Device &d) {
+  switch (d.rxTarget) {
+  case RxTarget::RomCmd:
+    switch (d.rxBuf[0]) {
+    case ROM_SEARCH:
+      startSearch(d);
+      break;
+    case ROM_ALARM_SEARCH:
+      if (d.alarm) {
+        startSearch(d);
+      } else {
+        d.mode = Mode::Idle;
+      }
+      break;
+    case ROM_MATCH:
+      startRx(d, RxTarget::MatchRom, 64);
+      break;
+    case ROM_SKIP:
+      startRx(d, RxTarget::FuncCmd, 8);
+      break;
+    case ROM_READ:
+      startTx(d, d.rom, 64);
+      break;
+    default:
+      d.mode = Mode::Idle;
+    }
+    break;
+  case RxTarget::MatchRom:
+    if (memcmp(d.rxBuf, d.rom, 8) == 0) {
+      startRx(d, RxTarget::FuncCmd, 8);
+    } else {
+      d.mode = Mode::Idle;
+    }
+    break;
+  case RxTarget::FuncCmd:
+    d.mode = Mode::Idle;
+    switch (d.rxBuf[0]) {
+    case CONVERT_T:
+      convert(d);
+      break;
+    case READ_SCRATCHPAD:
+      startTx(d, d.scratchpad, 72);
+      break;
+    case WRITE_SCRATCHPAD:
+      startRx(d, RxTarget::WriteScratchpad, 24);
+      break;
+    case COPY_SCRATCHPAD:
+      memcpy(d.eeprom, d.scratchpad + 2, 3);
+      break;
+    case RECALL_EEPROM:
+      memcpy(d.scratchpad + 2, d.eeprom, 3);
+      updateScratchpadCrc(d);
+      break;
+    case READ_POWER_SUPPLY: {
+      // Externally powered.
+      u8 one = 1;
+      startTx(d, &one, 1);
+      break;
+    }
+    }
+    break;
+  case RxTarget::WriteScratchpad:
+    d.scratchpad[2] = d.rxBuf[0];
+    d.scratchpad[3] = d.rxBuf[1];
+    // Only the resolution bits of the config register are writable.
+    d.scratchpad[4] = (u8)(d.rxBuf[2] & 0x60) | 0x1F;
+    updateScratchpadCrc(d);
+    d.mode = Mode::Idle;
+    break;
+  }
+}
+
+// The master pulled the bus low: start of a slot. Devices that are sending
+// decide here whether to hold the bus low for a 0 bit.
+void onFall() {
+  lastFallUs = nowUs;
+  sampledSinceFall = false;
+  bool anySending = false;
+  bool line = true;
+  for (auto &d : devices) {
+    if (!d.present) {
+      continue;
+    }
+    bool bit;
+    if (d.mode == Mode::Tx) {
+      bit = bitOf(d.txBuf, d.txPos++);
+      if (d.txPos == d.txBits) {
+        d.mode = Mode::Idle;
+      }
+    } else if (d.mode == Mode::Search && d.searchPhase < 2) {
+      bit = bitOf(d.rom, d.searchBit) ^ (d.searchPhase == 1);
+      ++d.searchPhase;
+    } else {
+      continue;
+    }
+    d.sentInSlot = true;
+    anySending = true;
+    line = line && bit;
+  }
+  if (anySending && bitErrorRate > 0 &&
+      std::uniform_real_distribution<double>(0, 1)(rng) < bitErrorRate) {
+    line = !line;
+    ++stats.injectedErrors;
+  }
+  if (!line) {
+    holdLowUntilUs = nowUs + READ_ZERO_US;
+  }
+}
+
+// The master released the bus. The length of the low pulse gives a reset, a
+// 1 bit or a 0 bit. Devices that are receiving take the bit here.
+void onRise() {
+  double lowUs = nowUs - lastFallUs;
+  lastLowUs = lowUs;
+  if (lowUs >= RESET_MIN_US) {
+    ++stats.resets;
+    bool anyPresent = false;
+    for (auto &d : devices) {
+      d.sentInSlot = false;
+      if (d.present) {
+        startRx(d, RxTarget::RomCmd, 8);
+        anyPresent = true;
+      }
+    }
+    if (anyPresent) {
+      presenceFromUs = nowUs + PRESENCE_DELAY_US;
+      presenceUntilUs = presenceFromUs + PRESENCE_LENGTH_US;
+    }
+    return;
+  }
+
+  ++stats.slots;
+  bool bit = lowUs < WRITE_ONE_MAX_US;
+  for (auto &d : devices) {
+    if (!d.present || d.sentInSlot) {
+      d.sentInSlot = false;
+      continue;
+    }
+    if (d.mode == Mode::Rx) {
+      if (bit) {
+        d.rxBuf[d.rxBits / 8] |= 1 << (d.rxBits % 8);
+      }
+      if (++d.rxBits == d.rxNeeded) {
+        onRxDone(d);
+      }
+    } else if (d.mode == Mode::Search && d.searchPhase == 2) {
+      // Devices that don't match the direction chosen by the master drop out.
+      if (bit != bitOf(d.rom, d.searchBit)) {
+        d.mode = Mode::Idle;
+      } else if (++d.searchBit == 64) {
+        d.mode = Mode::Idle;
+      } else {
+        d.searchPhase = 0;
+      }
+    }
+  }
+}
+
+void updateMaster() {
+  bool low = masterOutputEnabled && masterLevel == 0;
+  if (low == masterLow) {
+    return;
+  }
+  masterLow = low;
+  if (low) {
+    onFall();
+  } else {
+    onRise();
+  }
+}
+
+int busLevel();
+
+// The master reads the bus. The first read after a short low pulse, before
+// the slot ends, samples a read slot.
+int sampleBus() {
+  double sampleUs = nowUs - lastFallUs;
+  if (!masterLow && !sampledSinceFall && lastLowUs < WRITE_ONE_MAX_US &&
+      sampleUs < SLOT_MIN_US) {
+    sampledSinceFall = true;
+    ++stats.samples;
+    if (sampleUs > READ_SAMPLE_MAX_US) {
+      ++stats.lateSamples;
+    }
+    if (sampleUs > stats.maxSampleUs) {
+      stats.maxSampleUs = sampleUs;
+    }
+  }
+  return busLevel();
+}
+
+int busLevel() {
+  if (masterLow || nowUs < holdLowUntilUs) {
+    return 0;
+  }
+  if (presenceFromUs <= nowUs && nowUs < presenceUntilUs) {
+    return 0;
+  }
+  return 1;
+}
+
+s16 toRaw(float tempCelcius) { return (s16)lroundf(tempCelcius * 16); }
+
+} // namespace
+
+extern "C" {
+
+void owSimReset() {
+  devices.clear();
+  nowUs = 0;
+  masterLow = false;
+  masterOutputEnabled = true;
+  masterLevel = 1;
+  lastFallUs = lastLowUs = 0;
+  sampledSinceFall = false;
+  holdLowUntilUs = 0;
+  presenceFromUs = presenceUntilUs = 0;
+  irqDepth = 0;
+  bitErrorRate = 0;
+  owSimResetStats();
+}
+
+void owSimAttach(int pin) { busPin = pin; }
+
+void owSimMakeRom(u8 rom[8], u64 serial) {
+  rom[0] = 0x28;
+  for (int i = 1; i < 7; ++i) {
+    rom[i] = (u8)(serial >> (8 * (i - 1)));
+  }
+  rom[7] = crc8(rom, 7);
+}
+
+int owSimAddDevice(const u8 rom[8], float tempCelcius) {
+  Device d;
+  memcpy(d.rom, rom, 8);
+  // Power-on state: 85 C, TH 75, TL 70, 12 bit.
+  const u8 initial[8] = {0x50, 0x05, 0x4B, 0x46, 0x7F, 0xFF, 0x0C, 0x10};
+  memcpy(d.scratchpad, initial, 8);
+  updateScratchpadCrc(d);
+  memcpy(d.eeprom, d.scratchpad + 2, 3);
+  d.rawTemp = toRaw(tempCelcius);
+  devices.push_back(d);
+  return (int)devices.size() - 1;
+}
+
+void owSimSetTemperature(int idx, float tempCelcius) {
+  devices.at(idx).rawTemp = toRaw(tempCelcius);
+}
+
+void owSimSetPresent(int idx, bool present) {
+  devices.at(idx).present = present;
+  devices.at(idx).mode = Mode::Idle;
+}
+
+void owSimGetAlarm(int idx, s8 *th, s8 *tl) {
+  *th = (s8)devices.at(idx).scratchpad[2];
+  *tl = (s8)devices.at(idx).scratchpad[3];
+}
+
+void owSimSetBitErrorRate(double rate, u32 seed) {
+  bitErrorRate = rate;
+  rng.seed(seed);
+}
+
+double owSimNowUs() { return nowUs; }
+const OwSimStats *owSimGetStats() { return &stats; }
+void owSimResetStats() { memset(&stats, 0, sizeof(stats)); }
+
+// SDK stand-ins.
+
+void os_delay_us(uint16_t us) { nowUs += us; }
+
+esp_err_t gpio_config(const gpio_config_t *gpio_cfg) {
+  if (busPin >= 0 && (gpio_cfg->pin_bit_mask >> busPin) & 1) {
+    masterOutputEnabled = gpio_cfg->mode == GPIO_MODE_OUTPUT ||
+                          gpio_cfg->mode == GPIO_MODE_OUTPUT_OD;
+    updateMaster();
+  }
+  return ESP_OK;
+}
+
+esp_err_t gpio_set_level(gpio_num_t gpio_num, uint32_t level) {
+  nowUs += DRIVER_CALL_US;
+  if (gpio_num == busPin) {
+    masterLevel = level ? 1 : 0;
+    updateMaster();
+  }
+  return ESP_OK;
+}
+
+int gpio_get_level(gpio_num_t gpio_num) {
+  nowUs += DRIVER_CALL_US;
+  return gpio_num == busPin ? sampleBus() : 1;
+}
+
+esp_err_t gpio_set_direction(gpio_num_t gpio_num, gpio_mode_t mode) {
+  nowUs += DRIVER_CALL_US;
+  if (gpio_num == busPin) {
+    masterOutputEnabled =
+        mode == GPIO_MODE_OUTPUT || mode == GPIO_MODE_OUTPUT_OD;
+    updateMaster();
+  }
+  return ESP_OK;
+}
+
+void hostGpioRegWrite(uint32_t reg, uint32_t val) {
+  nowUs += REGISTER_ACCESS_US;
+  if (busPin < 0 || !((val >> busPin) & 1)) {
+    return;
+  }
+  switch (reg) {
+  case GPIO_OUT_W1TS_ADDRESS:
+    masterLevel = 1;
+    break;
+  case GPIO_OUT_W1TC_ADDRESS:
+    masterLevel = 0;
+    break;
+  case GPIO_ENABLE_W1TS_ADDRESS:
+    masterOutputEnabled = true;
+    break;
+  case GPIO_ENABLE_W1TC_ADDRESS:
+    masterOutputEnabled = false;
+    break;
+  }
+  updateMaster();
+}
+
+uint32_t hostGpioRegRead(uint32_t reg) {
+  nowUs += REGISTER_ACCESS_US;
+  if (reg != GPIO_IN_ADDRESS || busPin < 0) {
+    return 0;
+  }
+  // Other pins read as high.
+  return sampleBus() ? 0xffff : (0xffff & ~(1u << busPin));
+}
+
+uint32_t soc_get_ccount(void) {
+  nowUs += REGISTER_ACCESS_US;
+  return (uint32_t)(u64)(nowUs * CONFIG_ESP8266_DEFAULT_CPU_FREQ_MHZ);
+}
+
+uint32_t hostIrqDisable() {
+  if (irqDepth++ == 0) {
+    irqMaskedSinceUs = nowUs;
+  }
+  return irqDepth - 1;
+}
+
+void hostIrqRestore(uint32_t level) {
+  irqDepth = level;
+  if (irqDepth == 0) {
+    u32 maskedUs = (u32)(nowUs - irqMaskedSinceUs);
+    stats.irqMaskedUs += maskedUs;
+    if (maskedUs > stats.maxIrqMaskedUs) {
+      stats.maxIrqMaskedUs = maskedUs;
+    }
+  }
+}
+
+} // extern "C"
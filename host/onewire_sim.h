@@ -0,0 +1,59 @@
+// Simulated 1-Wire bus with emulated DS18B20 sensors.
+//
+// The simulator sits behind the GPIO and delay stand-ins, so the firmware's
+// onewire.c and ds18b20.c run unmodified. Time is virtual: it advances
+// through os_delay_us(), and by an estimated cost for each GPIO access and
+// cycle counter read. The bus decodes the master's slots from the length of
+// its low pulses, like a real device would.
+#pragma once
+
+#include <stdbool.h>
+
+#include "int_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+  u32 resets;
+  // Read and write time slots, excluding resets.
+  u32 slots;
+  u32 conversions;
+  // Bits flipped by error injection.
+  u32 injectedErrors;
+  // Read slots sampled by the master, and how many of those were sampled
+  // after the 15 us the devices guarantee their data to be valid for.
+  u32 samples;
+  u32 lateSamples;
+  double maxSampleUs;
+  // Virtual time spent with interrupts disabled.
+  u64 irqMaskedUs;
+  u32 maxIrqMaskedUs;
+} OwSimStats;
+
+// Remove all devices, and reset the clock and stats.
+void owSimReset();
+// Connect the simulated bus to the given GPIO.
+void owSimAttach(int pin);
+
+// Build a DS18B20 ROM code (family 0x28) with a valid CRC.
+void owSimMakeRom(u8 rom[8], u64 serial);
+// Add a DS18B20. Returns its index.
+int owSimAddDevice(const u8 rom[8], float tempCelcius);
+void owSimSetTemperature(int idx, float tempCelcius);
+// Disconnect or reconnect a device, e.g. to simulate hot-plugging.
+void owSimSetPresent(int idx, bool present);
+// Get the TH/TL alarm thresholds in a device's scratchpad.
+void owSimGetAlarm(int idx, s8 *th, s8 *tl);
+
+// Flip each bit transmitted by the devices with the given probability.
+void owSimSetBitErrorRate(double rate, u32 seed);
+
+double owSimNowUs();
+const OwSimStats *owSimGetStats();
+void owSimResetStats();
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
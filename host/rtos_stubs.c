@@ -0,0 +1,76 @@
+// Inert stand-ins for the RTOS, SNTP and timer functions that the firmware
+// modules call. Tasks are never started; callers drive the modules directly.
+// The emulator replaces these with working versions.
+
+#include <time.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "esp_sntp.h"
+#include "esp_timer.h"
+
+void sntp_setoperatingmode(int mode) {}
+void sntp_setservername(int idx, const char *server) {}
+void sntp_set_time_sync_notification_cb(sntp_sync_time_cb_t callback) {}
+void sntp_init() {}
+sntp_sync_status_t sntp_get_sync_status() { return SNTP_SYNC_STATUS_COMPLETED; }
+
+BaseType_t xTaskCreate(TaskFunction_t pvTaskCode, const char *pcName,
+                       uint32_t usStackDepth, void *pvParameters,
+                       UBaseType_t uxPriority, TaskHandle_t *pxCreatedTask) {
+  static int dummyTask;
+  if (pxCreatedTask) {
+    *pxCreatedTask = &dummyTask;
+  }
+  return pdPASS;
+}
+
+void vTaskDelay(TickType_t xTicksToDelay) {}
+void vTaskDelayUntil(TickType_t *pxPreviousWakeTime,
+                     TickType_t xTimeIncrement) {
+  *pxPreviousWakeTime += xTimeIncrement;
+}
+TickType_t xTaskGetTickCount() { return 0; }
+
+void taskENTER_CRITICAL() {}
+void taskEXIT_CRITICAL() {}
+
+static EventBits_t eventBits;
+
+EventGroupHandle_t xEventGroupCreate() { return &eventBits; }
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits) {
+  return eventBits |= bits;
+}
+EventBits_t xEventGroupGetBits(EventGroupHandle_t group) { return eventBits; }
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits,
+                                BaseType_t clearOnExit, BaseType_t waitForAll,
+                                TickType_t ticks) {
+  return eventBits;
+}
+
+static int mutexDummy;
+
+SemaphoreHandle_t xSemaphoreCreateMutex() { return &mutexDummy; }
+BaseType_t xSemaphoreTake(SemaphoreHandle_t xSemaphore, TickType_t ticks) {
+  return pdTRUE;
+}
+BaseType_t xSemaphoreGive(SemaphoreHandle_t xSemaphore) { return pdTRUE; }
+
+static int hostTimerVirtual = 0;
+static int64_t hostTimerUs = 0;
+
+void hostSetTimerUs(int64_t us) {
+  hostTimerVirtual = 1;
+  hostTimerUs = us;
+}
+
+int64_t esp_timer_get_time() {
+  if (hostTimerVirtual) {
+    return hostTimerUs;
+  }
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
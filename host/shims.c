@@ -0,0 +1,19 @@
+// SDK stand-ins shared by all host tools, including the emulator.
+
+#include <stdarg.h>
+#include <stdio.h>
+
+#include "os.h"
+
+int hostVerbose = 0;
+
+int os_printf(const char *format, ...) {
+  if (!hostVerbose) {
+    return 0;
+  }
+  va_list args;
+  va_start(args, format);
+  int n = vfprintf(stderr, format, args);
+  va_end(args);
+  return n;
+}
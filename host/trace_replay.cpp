@@ -0,0 +1,394 @@
+// Replay a temperature trace through the filter and tracker on the host, with
+// a virtual clock in place of NTP, and report memory use and per-sample
+// latency.
+//
+// The trace is CSV with one "epoch,celsius" sample per line. Alternatively,
+// a synthetic trace with daily and yearly cycles can be generated, so that a
+// year of 1 Hz samples can be checked in seconds.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <zlib.h>
+
+#include "alloc_stats.h"
+#include "history_export.h"
+#include "int_types.h"
+#include "log_ring.h"
+#include "host_shims.h"
+#include "temperature.h"
+#include "temperature_filter.h"
+#include "temperature_tracker.h"
+
+extern "C" time_t now;
+
+namespace {
+
+const u32 MAX_LINE_LENGTH = 256;
+
+// Latency histogram with 10 ns buckets up to 1 ms.
+const u64 BUCKET_NS = 10;
+const size_t BUCKET_COUNT = 100000;
+
+struct Options {
+  const char *tracePath = nullptr;
+  double syntheticDays = 0;
+  time_t start = 1577836800; // 2020-01-01 00:00:00 UTC
+  u32 period = 1;
+  const char *jsonPath = nullptr;
+  // Seconds from the first sample until the first NTP sync.
+  u32 syncAfter = 0;
+  bool dumpLog = false;
+  bool checkGzip = false;
+};
+
+struct Stats {
+  u64 samples = 0;
+  u64 totalNs = 0;
+  u64 maxNs = 0;
+  std::vector<u64> buckets = std::vector<u64>(BUCKET_COUNT + 1);
+  size_t peakRecords = 0;
+  // Time spent in the outlier filter, included in the latency above.
+  u64 filterNs = 0;
+  u64 exportNs = 0;
+  u64 gzipNs = 0;
+  size_t jsonBytes = 0;
+  size_t gzipBytes = 0;
+  // Gzip exports inflated with zlib and compared to the JSON export.
+  u32 gzipChecks = 0;
+  u32 gzipFailures = 0;
+
+  void add(u64 ns) {
+    ++samples;
+    totalNs += ns;
+    if (ns > maxNs) {
+      maxNs = ns;
+    }
+    size_t b = ns / BUCKET_NS;
+    ++buckets[b < BUCKET_COUNT ? b : BUCKET_COUNT];
+  }
+
+  // Upper bound of the bucket holding the given percentile.
+  u64 percentile(double p) const {
+    u64 target = (u64)std::ceil(samples * p / 100.0);
+    u64 seen = 0;
+    for (size_t b = 0; b < buckets.size(); ++b) {
+      seen += buckets[b];
+      if (seen >= target && seen) {
+        return b < BUCKET_COUNT ? std::min((b + 1) * BUCKET_NS, maxNs) : maxNs;
+      }
+    }
+    return maxNs;
+  }
+};
+
+void usage() {
+  fprintf(stderr,
+          "Usage: trace_replay [options] [trace.csv]\n"
+          "  --synthetic DAYS  Generate DAYS of samples instead of reading "
+          "a trace\n"
+          "  --start EPOCH     Start of the synthetic trace (default "
+          "2020-01-01)\n"
+          "  --period SECONDS  Sample period of the synthetic trace "
+          "(default 1)\n"
+          "  --sync-after SECONDS  Samples before then have no NTP time "
+          "(default 0)\n"
+          "  --json FILE       Write the exported history to FILE, - for "
+          "stdout\n"
+          "  --log             Print the firmware log ring to stderr at "
+          "the end\n"
+          "  --check-gzip      Check the gzip export against the JSON "
+          "export with zlib every day, instead of only at the end\n"
+          "  --verbose         Show firmware log output\n");
+  exit(2);
+}
+
+Options parseArgs(int argc, char **argv) {
+  Options o;
+  for (int i = 1; i < argc; ++i) {
+    std::string a = argv[i];
+    bool hasValue = i + 1 < argc;
+    if (a == "--synthetic" && hasValue) {
+      o.syntheticDays = atof(argv[++i]);
+    } else if (a == "--start" && hasValue) {
+      o.start = (time_t)atoll(argv[++i]);
+    } else if (a == "--period" && hasValue) {
+      o.period = (u32)atoi(argv[++i]);
+    } else if (a == "--sync-after" && hasValue) {
+      o.syncAfter = (u32)atoi(argv[++i]);
+    } else if (a == "--json" && hasValue) {
+      o.jsonPath = argv[++i];
+    } else if (a == "--log") {
+      o.dumpLog = true;
+    } else if (a == "--check-gzip") {
+      o.checkGzip = true;
+    } else if (a == "--verbose") {
+      hostVerbose = 1;
+    } else if ((a == "-" || a[0] != '-') && !o.tracePath) {
+      o.tracePath = argv[i];
+    } else {
+      usage();
+    }
+  }
+  if (!o.tracePath == !o.syntheticDays || o.period == 0) {
+    usage();
+  }
+  return o;
+}
+
+bool appendExport(void *ctx, const s8 *data, size_t len) {
+  static_cast<std::string *>(ctx)->append(data, len);
+  return true;
+}
+
+// The same exports as the HTTP handler, timed.
+std::string exportJson(u64 *ns) {
+  std::string out;
+  auto t0 = std::chrono::steady_clock::now();
+  exportHistoryJson(appendExport, &out);
+  *ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now() - t0)
+             .count();
+  return out;
+}
+
+std::string exportGzip(u64 *ns) {
+  std::string out;
+  auto t0 = std::chrono::steady_clock::now();
+  exportHistoryGzip(appendExport, &out);
+  *ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now() - t0)
+             .count();
+  return out;
+}
+
+// Inflate with zlib, which also checks the gzip header, CRC and length.
+bool gunzip(const std::string &in, std::string *out) {
+  z_stream z = {};
+  if (inflateInit2(&z, 16 + MAX_WBITS) != Z_OK) {
+    return false;
+  }
+  z.next_in = (Bytef *)in.data();
+  z.avail_in = (uInt)in.size();
+  char buf[4096];
+  int r;
+  do {
+    z.next_out = (Bytef *)buf;
+    z.avail_out = sizeof(buf);
+    r = inflate(&z, Z_NO_FLUSH);
+    out->append(buf, sizeof(buf) - z.avail_out);
+  } while (r == Z_OK);
+  inflateEnd(&z);
+  return r == Z_STREAM_END && z.avail_in == 0;
+}
+
+void checkGzip(Stats &stats, const std::string &json,
+               const std::string &gzip) {
+  std::string inflated;
+  ++stats.gzipChecks;
+  if (!gunzip(gzip, &inflated) || inflated != json) {
+    if (!stats.gzipFailures) {
+      fprintf(stderr, "Gzip export doesn't match at record %zu\n",
+                      getMinMaxCount());
+    }
+    ++stats.gzipFailures;
+  }
+}
+
+// Check both exports after each day change, which is when the caches
+// change.
+void checkDayChange(Stats &stats) {
+  static size_t lastCount = 0;
+  static u32 lastDropped = 0;
+  TrackerMemory mem;
+  getTrackerMemory(&mem);
+  if (getMinMaxCount() == lastCount && mem.droppedRecords == lastDropped) {
+    return;
+  }
+  lastCount = getMinMaxCount();
+  lastDropped = mem.droppedRecords;
+  u64 ns = 0;
+  checkGzip(stats, exportJson(&ns), exportGzip(&ns));
+}
+
+void writeJson(const std::string &json, const char *path) {
+  FILE *f = strcmp(path, "-") ? fopen(path, "w") : stdout;
+  if (!f) {
+    perror(path);
+    exit(1);
+  }
+  fwrite(json.data(), 1, json.size(), f);
+  if (f != stdout) {
+    fclose(f);
+  }
+}
+
+// The device boots at the first sample, and gets the time from NTP
+// syncAfter seconds later.
+time_t bootEpoch = -1;
+
+void replaySample(Stats &stats, const Options &o, time_t epoch, Temp16 temp) {
+  if (bootEpoch < 0) {
+    bootEpoch = epoch;
+  }
+  hostSetTimerUs((int64_t)(epoch - bootEpoch) * 1000000);
+  now = epoch - bootEpoch < o.syncAfter ? 0 : epoch;
+  auto t0 = std::chrono::steady_clock::now();
+  bool accepted = tempFilterAccept(temp);
+  auto t1 = std::chrono::steady_clock::now();
+  if (accepted) {
+    registerTemp(temp);
+  }
+  auto t2 = std::chrono::steady_clock::now();
+  stats.filterNs +=
+      std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count();
+  stats.add(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(t2 - t0).count());
+  if (getMinMaxCount() > stats.peakRecords) {
+    stats.peakRecords = getMinMaxCount();
+  }
+  if (o.checkGzip) {
+    checkDayChange(stats);
+  }
+}
+
+// Daily and yearly cycles, plus noise, rounded to the 1/16 C resolution of
+// the DS18B20.
+void replaySynthetic(Stats &stats, const Options &o) {
+  std::mt19937 rng(1);
+  std::normal_distribution<float> noise(0.0f, 0.1f);
+  const u64 count = (u64)(o.syntheticDays * 86400 / o.period);
+  for (u64 i = 0; i < count; ++i) {
+    time_t t = o.start + (time_t)(i * o.period);
+    double day = (double)(t % 86400) / 86400;
+    double year = (double)(t % (365 * 86400)) / (365 * 86400);
+    float v = (float)(5 - 8 * std::cos(2 * M_PI * day) -
+                      15 * std::cos(2 * M_PI * year)) +
+              noise(rng);
+    replaySample(stats, o, t, (Temp16)std::lround(v * 16));
+  }
+}
+
+void replayTrace(Stats &stats, const Options &o) {
+  FILE *f = strcmp(o.tracePath, "-") ? fopen(o.tracePath, "r") : stdin;
+  if (!f) {
+    perror(o.tracePath);
+    exit(1);
+  }
+  char line[128];
+  while (fgets(line, sizeof(line), f)) {
+    long long epoch;
+    float v;
+    if (sscanf(line, "%lld,%f", &epoch, &v) != 2) {
+      // Allow a header line and blank lines.
+      continue;
+    }
+    replaySample(stats, o, (time_t)epoch, (Temp16)std::lround(v * 16));
+  }
+  if (f != stdin) {
+    fclose(f);
+  }
+}
+
+void report(const Stats &stats, double wallSeconds) {
+  TrackerMemory mem;
+  getTrackerMemory(&mem);
+  const AllocStats *alloc = allocGetStats(ALLOC_TRACKER);
+  printf("{\n"
+         "  \"samples\": %llu,\n"
+         "  \"wallSeconds\": %.3f,\n"
+         "  \"recordsKept\": %zu,\n"
+         "  \"peakRecords\": %zu,\n"
+         "  \"droppedRecords\": %u,\n"
+         "  \"recordBytes\": %u,\n"
+         "  \"budgetBytes\": %u,\n"
+         "  \"usedBytes\": %u,\n"
+         "  \"cacheUsedBytes\": %u,\n"
+         "  \"cachedRecords\": %u,\n"
+         "  \"allocs\": %u,\n"
+         "  \"allocPeakBytes\": %u,\n"
+         "  \"latencyNs\": { \"mean\": %llu, \"p50\": %llu, \"p90\": %llu, "
+         "\"p99\": %llu, \"p999\": %llu, \"max\": %llu },\n"
+         "  \"filterMeanNs\": %llu,\n"
+         "  \"exportNsPerRecord\": %llu,\n"
+         "  \"gzipNsPerRecord\": %llu,\n"
+         "  \"jsonBytes\": %zu,\n"
+         "  \"gzipBytes\": %zu,\n"
+         "  \"gzipCacheUsedBytes\": %u,\n"
+         "  \"gzipCachedRecords\": %u,\n"
+         "  \"gzipChecks\": %u,\n"
+         "  \"gzipFailures\": %u,\n"
+         "  \"logRecords\": %u,\n"
+         "  \"logDropped\": %u\n"
+         "}\n",
+         (unsigned long long)stats.samples, wallSeconds, getMinMaxCount(),
+         stats.peakRecords, mem.droppedRecords, mem.recordBytes,
+         mem.budgetBytes, mem.usedBytes, mem.cacheUsedBytes,
+         mem.cachedRecords, alloc->allocs, alloc->peakBytes,
+         (unsigned long long)(stats.samples ? stats.totalNs / stats.samples
+                                            : 0),
+         (unsigned long long)stats.percentile(50),
+         (unsigned long long)stats.percentile(90),
+         (unsigned long long)stats.percentile(99),
+         (unsigned long long)stats.percentile(99.9),
+         (unsigned long long)stats.maxNs,
+         (unsigned long long)(stats.samples ? stats.filterNs / stats.samples
+                                            : 0),
+         (unsigned long long)(getMinMaxCount()
+                                  ? stats.exportNs / getMinMaxCount()
+                                  : 0),
+         (unsigned long long)(getMinMaxCount()
+                                  ? stats.gzipNs / getMinMaxCount()
+                                  : 0),
+         stats.jsonBytes, stats.gzipBytes, mem.gzipCacheUsedBytes,
+         mem.gzipCachedRecords, stats.gzipChecks, stats.gzipFailures,
+         logGetStats()->records, logGetStats()->dropped);
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  Options o = parseArgs(argc, argv);
+
+  // The device has no timezone database, so localtime is UTC there.
+  setenv("TZ", "UTC", 1);
+  tzset();
+
+  Stats stats;
+  auto start = std::chrono::steady_clock::now();
+  if (o.tracePath) {
+    replayTrace(stats, o);
+  } else {
+    replaySynthetic(stats, o);
+  }
+  double wallSeconds = std::chrono::duration<double>(
+                           std::chrono::steady_clock::now() - start)
+                           .count();
+
+  std::string json = exportJson(&stats.exportNs);
+  std::string gzip = exportGzip(&stats.gzipNs);
+  stats.jsonBytes = json.size();
+  stats.gzipBytes = gzip.size();
+  checkGzip(stats, json, gzip);
+  if (o.jsonPath) {
+    writeJson(json, o.jsonPath);
+  }
+  report(stats, wallSeconds);
+  if (o.dumpLog) {
+    // Same as the /log handler.
+    s8 lineBuf[MAX_LINE_LENGTH];
+    u32 pos = logOldest();
+    while (logRead(&pos, lineBuf, sizeof(lineBuf))) {
+      fputs(lineBuf, stderr);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,316 @@
+// Collector for the firmware's publisher, to test it against. See
+// main/publisher.h for the protocol.
+//
+// Acknowledges each packet with the next sequence number it expects from
+// that device and boot, and writes each new message once, as a JSON line
+// tagged with where it came from. Resent messages are counted as
+// duplicates, and gaps, from messages dropped by a full outbox, as lost.
+// Packets and acks can be dropped at random, or for an outage, to exercise
+// the publisher's retries and outbox.
+//
+//   udp_collector --port 7070 --out messages.jsonl &
+//   emulator --speed 60 --publish 127.0.0.1:7070
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <random>
+#include <string>
+
+#include "int_types.h"
+
+namespace {
+
+const size_t MAX_PACKET_BYTES = 2048;
+const int POLL_MS = 100;
+
+struct Options {
+  u16 port = 7070;
+  const char *outPath = nullptr;
+  const char *jsonPath = nullptr;
+  double durationS = 0;
+  double dropRate = 0;
+  // Seconds from start, during which nothing is received or acknowledged.
+  double outageStartS = 0;
+  double outageLenS = 0;
+};
+
+struct Stream {
+  u32 expected = 0;
+  u64 messages = 0;
+  u64 samples = 0;
+  u64 days = 0;
+  u64 alerts = 0;
+  u64 duplicates = 0;
+  u64 lost = 0;
+  u64 packets = 0;
+};
+
+struct Stats {
+  u64 packets = 0;
+  u64 malformed = 0;
+  // Packets and acks dropped on purpose, at random or for the outage.
+  u64 droppedPackets = 0;
+  u64 droppedAcks = 0;
+  u64 acks = 0;
+};
+
+Options options;
+Stats stats;
+// By device, then boot.
+std::map<std::string, std::map<std::string, Stream>> streams;
+volatile sig_atomic_t interrupted = 0;
+
+void onSignal(int) { interrupted = 1; }
+
+void usage(const char *argv0) {
+  fprintf(stderr,
+          "Usage: %s [options]\n"
+          "  --port N            UDP port to listen on (default 7070)\n"
+          "  --out FILE          Append the messages to FILE as JSON lines\n"
+          "  --duration S        Seconds to run, 0 until SIGINT (default 0)\n"
+          "  --drop-rate P       Drop packets and acks with probability P\n"
+          "  --outage START:LEN  Drop everything for LEN seconds from START\n"
+          "  --json FILE         Write the report here instead of stdout\n",
+          argv0);
+  exit(2);
+}
+
+bool parseOptions(int argc, char **argv) {
+  for (int i = 1; i < argc; ++i) {
+    const char *arg = argv[i];
+    const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+    if (!value) {
+      return false;
+    }
+    ++i;
+    if (!strcmp(arg, "--port")) {
+      options.port = (u16)atoi(value);
+    } else if (!strcmp(arg, "--out")) {
+      options.outPath = value;
+    } else if (!strcmp(arg, "--duration")) {
+      options.durationS = atof(value);
+    } else if (!strcmp(arg, "--drop-rate")) {
+      options.dropRate = atof(value);
+    } else if (!strcmp(arg, "--outage")) {
+      if (sscanf(value, "%lf:%lf", &options.outageStartS,
+                 &options.outageLenS) != 2) {
+        return false;
+      }
+    } else if (!strcmp(arg, "--json")) {
+      options.jsonPath = value;
+    } else {
+      return false;
+    }
+  }
+  return options.dropRate >= 0 && options.dropRate < 1;
+}
+
+// The value of a string field in a header line.
+bool stringField(const std::string &line, const char *key, std::string *value) {
+  std::string quoted = std::string("\"") + key + "\":";
+  size_t pos = line.find(quoted);
+  if (pos == std::string::npos) {
+    return false;
+  }
+  size_t start = line.find('"', pos + quoted.size());
+  size_t end = start == std::string::npos ? start : line.find('"', start + 1);
+  if (end == std::string::npos) {
+    return false;
+  }
+  *value = line.substr(start + 1, end - start - 1);
+  return true;
+}
+
+// Take the packet's new messages. Returns the sequence number to ack, or
+// false if the packet is malformed.
+bool receive(const std::string &packet, FILE *out, std::string *boot,
+             u32 *ack) {
+  size_t headerEnd = packet.find('\n');
+  if (headerEnd == std::string::npos) {
+    return false;
+  }
+  std::string header = packet.substr(0, headerEnd);
+  std::string device;
+  size_t seqPos = header.find("\"seq\":");
+  if (!stringField(header, "device", &device) ||
+      !stringField(header, "boot", boot) || seqPos == std::string::npos) {
+    return false;
+  }
+  u32 seq = (u32)strtoul(header.c_str() + seqPos + 6, nullptr, 10);
+
+  auto &boots = streams[device];
+  bool known = boots.count(*boot) != 0;
+  Stream &s = boots[*boot];
+  if (!known) {
+    s.expected = seq;
+  }
+  ++s.packets;
+  // A packet starts with the device's oldest queued message, so anything
+  // before it that we haven't got was dropped.
+  if ((s32)(seq - s.expected) > 0) {
+    s.lost += seq - s.expected;
+    s.expected = seq;
+  }
+  size_t pos = headerEnd + 1;
+  for (u32 n = seq; pos < packet.size(); ++n) {
+    size_t end = packet.find('\n', pos);
+    if (end == std::string::npos) {
+      end = packet.size();
+    }
+    std::string message = packet.substr(pos, end - pos);
+    pos = end + 1;
+    if (n != s.expected) {
+      ++s.duplicates;
+      continue;
+    }
+    ++s.expected;
+    ++s.messages;
+    if (message.find("\"sample\":") != std::string::npos) {
+      ++s.samples;
+    } else if (message.find("\"day\":") != std::string::npos) {
+      ++s.days;
+    } else if (message.find("\"alert\":") != std::string::npos) {
+      ++s.alerts;
+    }
+    if (out) {
+      fprintf(out,
+              "{ \"device\": \"%s\", \"boot\": \"%s\", \"seq\": %u, "
+              "\"message\": %s }\n",
+              device.c_str(), boot->c_str(), n, message.c_str());
+    }
+  }
+  if (out) {
+    fflush(out);
+  }
+  *ack = s.expected;
+  return true;
+}
+
+void printReport(FILE *f) {
+  fprintf(f, "{\n");
+  fprintf(f,
+          "  \"packets\": %llu,\n  \"malformed\": %llu,\n"
+          "  \"droppedPackets\": %llu,\n  \"droppedAcks\": %llu,\n"
+          "  \"acks\": %llu,\n",
+          (unsigned long long)stats.packets,
+          (unsigned long long)stats.malformed,
+          (unsigned long long)stats.droppedPackets,
+          (unsigned long long)stats.droppedAcks,
+          (unsigned long long)stats.acks);
+  fprintf(f, "  \"streams\": [");
+  const char *sep = "\n";
+  for (const auto &device : streams) {
+    for (const auto &boot : device.second) {
+      const Stream &s = boot.second;
+      fprintf(f,
+              "%s    { \"device\": \"%s\", \"boot\": \"%s\", "
+              "\"packets\": %llu, \"messages\": %llu, \"samples\": %llu, "
+              "\"days\": %llu, \"alerts\": %llu, \"duplicates\": %llu, "
+              "\"lost\": %llu, \"nextSeq\": %u }",
+              sep, device.first.c_str(), boot.first.c_str(),
+              (unsigned long long)s.packets, (unsigned long long)s.messages,
+              (unsigned long long)s.samples, (unsigned long long)s.days,
+              (unsigned long long)s.alerts,
+              (unsigned long long)s.duplicates, (unsigned long long)s.lost,
+              s.expected);
+      sep = ",\n";
+    }
+  }
+  fprintf(f, "\n  ]\n}\n");
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  if (!parseOptions(argc, argv)) {
+    usage(argv[0]);
+  }
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(options.port);
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  if (fd < 0 || bind(fd, (const sockaddr *)&addr, sizeof(addr))) {
+    perror("bind");
+    return 1;
+  }
+  FILE *out = nullptr;
+  if (options.outPath && !(out = fopen(options.outPath, "a"))) {
+    perror(options.outPath);
+    return 1;
+  }
+  signal(SIGINT, onSignal);
+  signal(SIGTERM, onSignal);
+  fprintf(stderr, "Listening on UDP port %u\n", options.port);
+
+  std::mt19937 rng(1);
+  std::uniform_real_distribution<double> uniform(0, 1);
+  auto start = std::chrono::steady_clock::now();
+  char buf[MAX_PACKET_BYTES];
+  while (!interrupted) {
+    double elapsedS = std::chrono::duration<double>(
+                          std::chrono::steady_clock::now() - start)
+                          .count();
+    if (options.durationS && elapsedS >= options.durationS) {
+      break;
+    }
+    pollfd p = {fd, POLLIN, 0};
+    if (poll(&p, 1, POLL_MS) <= 0) {
+      continue;
+    }
+    sockaddr_in from;
+    socklen_t fromLen = sizeof(from);
+    ssize_t n =
+        recvfrom(fd, buf, sizeof(buf), 0, (sockaddr *)&from, &fromLen);
+    if (n <= 0) {
+      continue;
+    }
+    bool outage = elapsedS >= options.outageStartS &&
+                  elapsedS < options.outageStartS + options.outageLenS;
+    if (outage || uniform(rng) < options.dropRate) {
+      ++stats.droppedPackets;
+      continue;
+    }
+    ++stats.packets;
+    std::string boot;
+    u32 ack;
+    if (!receive(std::string(buf, n), out, &boot, &ack)) {
+      ++stats.malformed;
+      continue;
+    }
+    if (uniform(rng) < options.dropRate) {
+      ++stats.droppedAcks;
+      continue;
+    }
+    char reply[64];
+    int len = snprintf(reply, sizeof(reply),
+                       "{ \"boot\": \"%s\", \"ack\": %u }\n", boot.c_str(),
+                       ack);
+    sendto(fd, reply, len, 0, (const sockaddr *)&from, fromLen);
+    ++stats.acks;
+  }
+
+  if (out) {
+    fclose(out);
+  }
+  FILE *f = options.jsonPath ? fopen(options.jsonPath, "w") : stdout;
+  if (!f) {
+    perror(options.jsonPath);
+    return 1;
+  }
+  printReport(f);
+  if (f != stdout) {
+    fclose(f);
+  }
+  return 0;
+}
@@ -0,0 +1,337 @@
+// Threshold alerts. See alerts.h.
+//
+// Each sensor and kind is a small state machine, advanced by every sample,
+// so a check is a couple of compares. Transitions are found in a critical
+// section, and published after it. The sampler is the only task that
+// advances the states, so they are published in order.
+
+#include <stdio.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/timers.h"
+#include "driver/gpio.h"
+#include "nvs.h"
+#include "sdkconfig.h"
+
+#include "int_types.h"
+#include "user_config.h"
+#include "alerts.h"
+#include "display.h"
+#include "ds18b20.h"
+#include "ntp.h"
+#include "publisher.h"
+
+static const s8 *kindNames[ALERT_KIND_COUNT] = {"high", "low"};
+static const s8 *stateNames[] = {"normal", "pending", "raised"};
+
+const s8 *alertKindName(AlertKind kind) { return kindNames[kind]; }
+const s8 *alertStateName(AlertState state) { return stateNames[state]; }
+
+#ifdef CONFIG_ALERTS_ENABLED
+
+#ifndef CONFIG_PUBLISH_ENABLED
+#error "Alerts are sent by the publisher, enable CONFIG_PUBLISH_ENABLED"
+#endif
+
+#define SENSOR_COUNT CONFIG_ALERT_SENSORS
+#define HYSTERESIS TEMP16_FROM_DECI_C(CONFIG_ALERT_HYSTERESIS_DECI_C)
+#define MIN_DURATION_TICKS pdMS_TO_TICKS(CONFIG_ALERT_MIN_DURATION_S * 1000)
+#define BLINK_MS 250
+#define MAX_ALERT_MESSAGE_BYTES 160
+
+#define ALERTS_NVS_NAMESPACE "alerts"
+#define ALERTS_NVS_KEY_THRESHOLDS "rom_thresholds"
+// Sensors whose thresholds are kept, those set most recently.
+#define MAX_STORED CONFIG_DS18B20_MAX_SENSORS
+
+_Static_assert(CONFIG_ALERT_SENSORS <= CONFIG_DS18B20_MAX_SENSORS,
+               "Can't check more sensors than CONFIG_DS18B20_MAX_SENSORS");
+#if CONFIG_ALERT_LED_PIN >= 0
+_Static_assert(CONFIG_ALERT_LED_PIN != CONFIG_ONEWIRE_PIN &&
+                   CONFIG_ALERT_LED_PIN != CONFIG_TM1637_CLK_PIN &&
+                   CONFIG_ALERT_LED_PIN != CONFIG_TM1637_DIO_PIN,
+               "The alert LED must not be on the 1-Wire or display pins");
+#endif
+
+extern DS18B20_Sensors sensors;
+
+static SensorAlert alerts[SENSOR_COUNT];
+static TickType_t pendingSince[SENSOR_COUNT][ALERT_KIND_COUNT];
+static AlertStats stats;
+static TimerHandle_t blinkTimer = NULL;
+static bool blinkStarted = false;
+static bool blinkOn = false;
+
+static void blink(TimerHandle_t xTimer);
+static void showBlink(bool on);
+
+// A sensor's thresholds, as stored in NVS. They're kept by ROM code, like
+// the sensor cache, since a rescan can change the sensors' order on the bus.
+typedef struct {
+  u8 rom[8];
+  Temp16 threshold[ALERT_KIND_COUNT];
+} StoredThresholds;
+
+// Oldest set first. Changed in critical sections, since the sampler looks
+// sensors up in it.
+static StoredThresholds stored[MAX_STORED];
+static u8 storedCount = 0;
+
+static void loadThresholds() {
+  storedCount = 0;
+  nvs_handle handle;
+  if (nvs_open(ALERTS_NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+    return;
+  }
+  size_t len = sizeof(stored);
+  esp_err_t err =
+      nvs_get_blob(handle, ALERTS_NVS_KEY_THRESHOLDS, stored, &len);
+  nvs_close(handle);
+  if (err == ESP_OK && len % sizeof(stored[0]) == 0) {
+    storedCount = len / sizeof(stored[0]);
+  }
+}
+
+static void saveThresholds() {
+  StoredThresholds t[MAX_STORED];
+  taskENTER_CRITICAL();
+  u8 count = storedCount;
+  memcpy(t, stored, count * sizeof(t[0]));
+  taskEXIT_CRITICAL();
+  nvs_handle handle;
+  if (nvs_open(ALERTS_NVS_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK) {
+    INFO("Unable to open NVS for alert thresholds\n");
+    return;
+  }
+  nvs_set_blob(handle, ALERTS_NVS_KEY_THRESHOLDS, t, count * sizeof(t[0]));
+  nvs_commit(handle);
+  nvs_close(handle);
+}
+
+// Index in stored of the sensor's thresholds, storedCount if there are none.
+static u8 findStored(const u8 *rom) {
+  u8 i = 0;
+  while (i < storedCount && memcmp(stored[i].rom, rom, 8)) {
+    ++i;
+  }
+  return i;
+}
+
+// Give the alert of a bus index to the sensor now there, with its stored
+// thresholds or the defaults. An alert raised for the sensor that was there
+// before is dropped. In a critical section.
+static void bind(SensorAlert *a, const u8 *rom) {
+  for (int k = 0; k < ALERT_KIND_COUNT; ++k) {
+    if (a->state[k] == ALERT_RAISED) {
+      --stats.active;
+    }
+  }
+  memset(a, 0, sizeof(*a));
+  a->temp = TEMP16_INVALID;
+  memcpy(a->rom, rom, sizeof(a->rom));
+  u8 i = findStored(rom);
+  if (i < storedCount) {
+    memcpy(a->threshold, stored[i].threshold, sizeof(a->threshold));
+  } else {
+    a->threshold[ALERT_HIGH] = TEMP16_FROM_DECI_C(CONFIG_ALERT_HIGH_DECI_C);
+    a->threshold[ALERT_LOW] = TEMP16_FROM_DECI_C(CONFIG_ALERT_LOW_DECI_C);
+  }
+}
+
+void alertsStart() {
+  loadThresholds();
+  memset(&stats, 0, sizeof(stats));
+  for (u8 i = 0; i < SENSOR_COUNT; ++i) {
+    SensorAlert *a = &alerts[i];
+    memset(a, 0, sizeof(*a));
+    a->temp = TEMP16_INVALID;
+    if (i < sensors.count) {
+      bind(a, sensors.addresses + i * 8);
+    }
+  }
+
+#if CONFIG_ALERT_LED_PIN >= 0
+  gpio_config_t io_conf;
+  io_conf.intr_type = GPIO_INTR_DISABLE;
+  io_conf.mode = GPIO_MODE_OUTPUT;
+  io_conf.pin_bit_mask = 1 << CONFIG_ALERT_LED_PIN;
+  io_conf.pull_down_en = 0;
+  io_conf.pull_up_en = 0;
+  gpio_config(&io_conf);
+  gpio_set_level(CONFIG_ALERT_LED_PIN, 0);
+#endif
+  blinkTimer = xTimerCreate("alertBlink", pdMS_TO_TICKS(BLINK_MS), pdTRUE,
+                            NULL, blink);
+  configASSERT(blinkTimer);
+}
+
+// True if the temperature is at or beyond the threshold.
+static bool beyond(AlertKind kind, Temp16 temp, Temp16 threshold) {
+  return kind == ALERT_HIGH ? temp >= threshold : temp <= threshold;
+}
+
+// True once the temperature is back from the threshold by the hysteresis.
+static bool back(AlertKind kind, Temp16 temp, Temp16 threshold) {
+  return kind == ALERT_HIGH ? temp < threshold - HYSTERESIS
+                            : temp > threshold + HYSTERESIS;
+}
+
+static void publish(u8 sensor, AlertKind kind, bool raised, Temp16 temp,
+                    Temp16 threshold) {
+  const s8 *event = raised ? "raised" : "cleared";
+  s8 msg[MAX_ALERT_MESSAGE_BYTES];
+  s8 tempStr[10];
+  s8 thresholdStr[10] = "null";
+  s8 timeStr[16] = "null";
+  temp16Format(tempStr, sizeof(tempStr), temp);
+  if (threshold != TEMP16_INVALID) {
+    thresholdStr[0] = '"';
+    int n = temp16Format(thresholdStr + 1, sizeof(thresholdStr) - 2,
+                         threshold);
+    strcpy(thresholdStr + 1 + n, "\"");
+  }
+  if (haveTime()) {
+    snprintf(timeStr, sizeof(timeStr), "%ld", (long)getNow());
+  }
+  snprintf(msg, sizeof(msg),
+           "{ \"sensor\": %u, \"kind\": \"%s\", \"event\": \"%s\", "
+           "\"temp\": \"%s\", \"threshold\": %s, \"time\": %s }",
+           sensor, kindNames[kind], event, tempStr, thresholdStr, timeStr);
+  publisherAlert(msg);
+  INFO("Alert: sensor %d %s %s\n", sensor, kindNames[kind], event);
+}
+
+void alertsSample(u8 sensor, Temp16 temp) {
+  if (sensor >= SENSOR_COUNT || sensor >= sensors.count) {
+    return;
+  }
+  const u8 *rom = sensors.addresses + sensor * 8;
+  TickType_t now = xTaskGetTickCount();
+  // Raised or cleared by this sample.
+  bool changed[ALERT_KIND_COUNT] = {false};
+  Temp16 thresholds[ALERT_KIND_COUNT];
+  AlertState states[ALERT_KIND_COUNT];
+
+  taskENTER_CRITICAL();
+  SensorAlert *a = &alerts[sensor];
+  if (memcmp(a->rom, rom, sizeof(a->rom))) {
+    // A rescan put another sensor at this index.
+    bind(a, rom);
+  }
+  a->temp = temp;
+  for (int k = 0; k < ALERT_KIND_COUNT; ++k) {
+    Temp16 threshold = a->threshold[k];
+    AlertState s = a->state[k];
+    if (s == ALERT_RAISED) {
+      // Also cleared when the check has been turned off.
+      if (threshold == TEMP16_INVALID || back(k, temp, threshold)) {
+        s = ALERT_NORMAL;
+        ++stats.cleared;
+        --stats.active;
+        changed[k] = true;
+      }
+    } else if (threshold == TEMP16_INVALID || !beyond(k, temp, threshold)) {
+      s = ALERT_NORMAL;
+    } else {
+      if (s == ALERT_NORMAL) {
+        s = ALERT_PENDING;
+        pendingSince[sensor][k] = now;
+      }
+      if ((TickType_t)(now - pendingSince[sensor][k]) >= MIN_DURATION_TICKS) {
+        s = ALERT_RAISED;
+        ++a->raised;
+        ++stats.raised;
+        ++stats.active;
+        changed[k] = true;
+      }
+    }
+    a->state[k] = s;
+    states[k] = s;
+    thresholds[k] = threshold;
+  }
+  bool startBlink = stats.active && !blinkStarted;
+  bool stopBlink = !stats.active && blinkStarted;
+  blinkStarted = stats.active != 0;
+  taskEXIT_CRITICAL();
+
+  for (int k = 0; k < ALERT_KIND_COUNT; ++k) {
+    if (changed[k]) {
+      publish(sensor, k, states[k] == ALERT_RAISED, temp, thresholds[k]);
+    }
+  }
+  // Only the sampler starts and stops the timer, so the commands are in
+  // order. Stopped, it doesn't wake the CPU between samples.
+  if (startBlink) {
+    xTimerStart(blinkTimer, 0);
+  }
+  if (stopBlink) {
+    xTimerStop(blinkTimer, 0);
+    showBlink(false);
+  }
+}
+
+static void showBlink(bool on) {
+  blinkOn = on;
+  displayBlank(on);
+#if CONFIG_ALERT_LED_PIN >= 0
+  gpio_set_level(CONFIG_ALERT_LED_PIN, on);
+#endif
+}
+
+static void blink(TimerHandle_t xTimer) {
+  showBlink(stats.active ? !blinkOn : false);
+}
+
+u8 alertsSensorCount() { return SENSOR_COUNT; }
+
+void alertsGet(u8 sensor, SensorAlert *alert) {
+  taskENTER_CRITICAL();
+  *alert = alerts[sensor];
+  taskEXIT_CRITICAL();
+}
+
+bool alertsSetThresholds(u8 sensor, Temp16 high, Temp16 low) {
+  if (sensor >= SENSOR_COUNT ||
+      (high != TEMP16_INVALID && low != TEMP16_INVALID && low >= high)) {
+    return false;
+  }
+  taskENTER_CRITICAL();
+  SensorAlert *a = &alerts[sensor];
+  if (!a->rom[0]) {
+    taskEXIT_CRITICAL();
+    return false;
+  }
+  a->threshold[ALERT_HIGH] = high;
+  a->threshold[ALERT_LOW] = low;
+  // Move the sensor's entry to the end, making room by dropping the oldest.
+  u8 i = findStored(a->rom);
+  if (i == storedCount && storedCount == MAX_STORED) {
+    i = 0;
+  }
+  if (i < storedCount) {
+    memmove(&stored[i], &stored[i + 1],
+            (storedCount - i - 1) * sizeof(stored[0]));
+    --storedCount;
+  }
+  StoredThresholds *t = &stored[storedCount++];
+  memcpy(t->rom, a->rom, sizeof(t->rom));
+  memcpy(t->threshold, a->threshold, sizeof(t->threshold));
+  taskEXIT_CRITICAL();
+  saveThresholds();
+  return true;
+}
+
+const AlertStats *alertsGetStats() { return &stats; }
+
+#else
+
+void alertsStart() {}
+void alertsSample(u8 sensor, Temp16 temp) {}
+u8 alertsSensorCount() { return 0; }
+void alertsGet(u8 sensor, SensorAlert *alert) {}
+bool alertsSetThresholds(u8 sensor, Temp16 high, Temp16 low) { return false; }
+const AlertStats *alertsGetStats() { return NULL; }
+
+#endif
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "int_types.h"
+#include "temperature.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Threshold alerts, with CONFIG_ALERTS_ENABLED.
+//
+// Each checked sensor has a high and a low threshold. An alert is raised
+// when a sensor has been at or beyond a threshold for
+// CONFIG_ALERT_MIN_DURATION_S, and cleared once it's back by more than
+// CONFIG_ALERT_HYSTERESIS_DECI_C, so that a temperature that hovers at the
+// threshold doesn't raise it over and over. Samples are checked as the
+// sampler takes them, in constant time, and each raise and clear is pushed
+// to the collector right away, see publisherAlert(). While any alert is
+// raised, the display and CONFIG_ALERT_LED_PIN blink.
+
+typedef enum { ALERT_HIGH, ALERT_LOW, ALERT_KIND_COUNT } AlertKind;
+
+typedef enum {
+  ALERT_NORMAL,
+  // Beyond the threshold, for less than the minimum duration so far.
+  ALERT_PENDING,
+  ALERT_RAISED,
+} AlertState;
+
+typedef struct {
+  // Of the sensor at this index on the bus, when last checked, all 0 if
+  // there's none. Thresholds go with the ROM code, not the index.
+  u8 rom[8];
+  // TEMP16_INVALID when the check is off.
+  Temp16 threshold[ALERT_KIND_COUNT];
+  AlertState state[ALERT_KIND_COUNT];
+  // The last sample checked, TEMP16_INVALID if none yet.
+  Temp16 temp;
+  u32 raised;
+} SensorAlert;
+
+typedef struct {
+  u32 raised;
+  u32 cleared;
+  // Alerts raised now, of all sensors and kinds.
+  u8 active;
+} AlertStats;
+
+// Loads the thresholds from NVS, so call after nvs_flash_init().
+void alertsStart();
+// Check a sample of the given sensor, by index on the bus. Call from the
+// sampler.
+void alertsSample(u8 sensor, Temp16 temp);
+// Number of sensors checked, 0 if alerts are disabled.
+u8 alertsSensorCount();
+void alertsGet(u8 sensor, SensorAlert *alert);
+// Set a sensor's thresholds, TEMP16_INVALID to turn one off, and store them
+// in NVS under its ROM code, so they follow it wherever it's found on the
+// bus. The next sample is checked against them. Returns false if the sensor
+// isn't checked or isn't on the bus, or low isn't below high.
+bool alertsSetThresholds(u8 sensor, Temp16 high, Temp16 low);
+// Null if alerts are disabled.
+const AlertStats *alertsGetStats();
+const s8 *alertKindName(AlertKind kind);
+const s8 *alertStateName(AlertState state);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
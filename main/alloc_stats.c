@@ -0,0 +1,63 @@
+#include <stdlib.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+
+#include "alloc_stats.h"
+
+#ifdef CONFIG_ALLOC_TRACING
+
+static AllocStats stats[ALLOC_SUBSYSTEM_COUNT];
+
+void *allocTraced(AllocSubsystem subsystem, size_t size) {
+  void *ptr = malloc(size);
+  AllocStats *s = &stats[subsystem];
+  taskENTER_CRITICAL();
+  if (ptr) {
+    ++s->allocs;
+    s->liveBytes += size;
+    if (s->liveBytes > s->peakBytes) {
+      s->peakBytes = s->liveBytes;
+    }
+  } else {
+    ++s->failures;
+  }
+  taskEXIT_CRITICAL();
+  return ptr;
+}
+
+void freeTraced(AllocSubsystem subsystem, void *ptr, size_t size) {
+  if (!ptr) {
+    return;
+  }
+  free(ptr);
+  AllocStats *s = &stats[subsystem];
+  taskENTER_CRITICAL();
+  ++s->frees;
+  s->liveBytes -= size;
+  taskEXIT_CRITICAL();
+}
+
+const AllocStats *allocGetStats(AllocSubsystem subsystem) {
+  return &stats[subsystem];
+}
+
+#else
+
+void *allocTraced(AllocSubsystem subsystem, size_t size) {
+  return malloc(size);
+}
+
+void freeTraced(AllocSubsystem subsystem, void *ptr, size_t size) {
+  free(ptr);
+}
+
+const AllocStats *allocGetStats(AllocSubsystem subsystem) { return NULL; }
+
+#endif
+
+const char *allocSubsystemName(AllocSubsystem subsystem) {
+  static const char *names[ALLOC_SUBSYSTEM_COUNT] = {"tracker", "http"};
+  return names[subsystem];
+}
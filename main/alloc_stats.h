@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "int_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Subsystems that allocate from the heap through allocTraced().
+typedef enum {
+  ALLOC_TRACKER,
+  ALLOC_HTTP,
+  ALLOC_SUBSYSTEM_COUNT,
+} AllocSubsystem;
+
+typedef struct {
+  u32 allocs;
+  u32 frees;
+  u32 failures;
+  u32 liveBytes;
+  u32 peakBytes;
+} AllocStats;
+
+// malloc() and free() that count allocations against a subsystem when
+// CONFIG_ALLOC_TRACING is enabled. The caller passes the size to free, so
+// that no header is needed in front of each block.
+void *allocTraced(AllocSubsystem subsystem, size_t size);
+void freeTraced(AllocSubsystem subsystem, void *ptr, size_t size);
+
+// Returns NULL if tracing is disabled.
+const AllocStats *allocGetStats(AllocSubsystem subsystem);
+const char *allocSubsystemName(AllocSubsystem subsystem);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
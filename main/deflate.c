@@ -0,0 +1,192 @@
+#include <stdbool.h>
+#include <string.h>
+
+#include "deflate.h"
+
+#define MIN_MATCH 3
+#define MAX_MATCH 258
+
+// Length symbols 257 to 285: base length and extra bits.
+static const u16 LENGTH_BASE[] = {3,  4,  5,  6,   7,   8,   9,   10,  11, 13,
+                                  15, 17, 19, 23,  27,  31,  35,  43,  51, 59,
+                                  67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const u8 LENGTH_EXTRA[] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1,
+                                  1, 1, 2, 2, 2, 2, 3, 3, 3, 3,
+                                  4, 4, 4, 4, 5, 5, 5, 5, 0};
+// Distance symbols 0 to 19, enough for DEFLATE_MAX_WINDOW.
+static const u16 DIST_BASE[] = {1,  2,  3,  4,  5,  7,   9,   13,  17,  25,
+                                33, 49, 65, 97, 129, 193, 257, 385, 513, 769};
+static const u8 DIST_EXTRA[] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3,
+                                4, 4, 5, 5, 6, 6, 7, 7, 8, 8};
+
+// Nibble-wise CRC-32 table, to keep it out of the scarce DRAM.
+static const u32 CRC_NIBBLE[] = {
+    0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4,
+    0x4db26158, 0x5005713c, 0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
+    0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c};
+
+// Append the low count bits of value, least significant first.
+static void putBits(BitWriter *w, u32 value, u32 count) {
+  w->bits |= value << w->bitCount;
+  w->bitCount += count;
+  while (w->bitCount >= 8) {
+    if (w->len < w->max) {
+      w->out[w->len++] = (u8)w->bits;
+    } else {
+      w->overflow = true;
+    }
+    w->bits >>= 8;
+    w->bitCount -= 8;
+  }
+}
+
+// Huffman codes are sent most significant bit first.
+static void putCode(BitWriter *w, u32 code, u32 count) {
+  u32 reversed = 0;
+  for (u32 i = 0; i < count; ++i) {
+    reversed = (reversed << 1) | ((code >> i) & 1);
+  }
+  putBits(w, reversed, count);
+}
+
+// The fixed literal/length code, RFC 1951 section 3.2.6.
+static void putSymbol(BitWriter *w, u32 sym) {
+  if (sym < 144) {
+    putCode(w, 0x30 + sym, 8);
+  } else if (sym < 256) {
+    putCode(w, 0x190 + sym - 144, 9);
+  } else if (sym < 280) {
+    putCode(w, sym - 256, 7);
+  } else {
+    putCode(w, 0xc0 + sym - 280, 8);
+  }
+}
+
+static void putMatch(BitWriter *w, u32 length, u32 dist) {
+  u32 i = 0;
+  while (i + 1 < sizeof(LENGTH_BASE) / sizeof(LENGTH_BASE[0]) &&
+         LENGTH_BASE[i + 1] <= length) {
+    ++i;
+  }
+  putSymbol(w, 257 + i);
+  putBits(w, length - LENGTH_BASE[i], LENGTH_EXTRA[i]);
+  u32 d = 0;
+  while (d + 1 < sizeof(DIST_BASE) / sizeof(DIST_BASE[0]) &&
+         DIST_BASE[d + 1] <= dist) {
+    ++d;
+  }
+  putCode(w, d, 5);
+  putBits(w, dist - DIST_BASE[d], DIST_EXTRA[d]);
+}
+
+// Longest match for window[pos, end) that starts before pos, the nearest one
+// if there are several. Returns its length, 0 if less than MIN_MATCH.
+//
+// All the starts are tried. With a window of two lines that's cheap enough,
+// and on the history it compresses much better than a hash table of recent
+// positions, which only finds the latest candidate.
+static size_t findMatch(const u8 *window, size_t pos, size_t end,
+                        size_t *matchPos) {
+  if (pos + MIN_MATCH > end) {
+    return 0;
+  }
+  size_t maxLen = end - pos < MAX_MATCH ? end - pos : MAX_MATCH;
+  size_t best = 0;
+  for (size_t cand = 0; cand < pos; ++cand) {
+    size_t n = 0;
+    while (n < maxLen && window[cand + n] == window[pos + n]) {
+      ++n;
+    }
+    if (n >= MIN_MATCH && n >= best) {
+      best = n;
+      *matchPos = cand;
+    }
+  }
+  return best;
+}
+
+u32 bitsWritten(const BitWriter *w) { return w->len * 8 + w->bitCount; }
+
+void flushBits(BitWriter *w) {
+  if (w->bitCount) {
+    putBits(w, 0, 8 - w->bitCount);
+  }
+}
+
+void copyBits(BitWriter *w, const u8 *src, u32 first, u32 count) {
+  src += first / 8;
+  first %= 8;
+  if (first && count) {
+    u32 n = 8 - first < count ? 8 - first : count;
+    putBits(w, (*src++ >> first) & ((1 << n) - 1), n);
+    count -= n;
+  }
+  for (; count >= 8; count -= 8) {
+    putBits(w, *src++, 8);
+  }
+  if (count) {
+    putBits(w, *src & ((1 << count) - 1), count);
+  }
+}
+
+void deflateBegin(BitWriter *w) {
+  // BFINAL = 1, BTYPE = 01 (fixed Huffman).
+  putBits(w, 0x3, 3);
+}
+
+// Matching is one step lazy: a literal is sent instead of a match when the
+// next byte starts a longer one.
+void deflateData(BitWriter *w, const u8 *window, size_t dictLen, size_t len) {
+  size_t end = dictLen + len;
+  if (end > DEFLATE_MAX_WINDOW) {
+    w->overflow = true;
+    return;
+  }
+  size_t pos = dictLen;
+  while (pos < end) {
+    size_t matchPos = 0;
+    size_t nextPos = 0;
+    size_t matchLen = findMatch(window, pos, end, &matchPos);
+    if (matchLen && findMatch(window, pos + 1, end, &nextPos) > matchLen) {
+      matchLen = 0;
+    }
+    if (matchLen) {
+      putMatch(w, matchLen, pos - matchPos);
+      pos += matchLen;
+    } else {
+      putSymbol(w, window[pos]);
+      ++pos;
+    }
+  }
+}
+
+void deflateFinish(BitWriter *w) {
+  putSymbol(w, 256);
+  flushBits(w);
+}
+
+// Advance the CRC register without the pre and post inversion.
+static u32 crcRaw(u32 crc, const u8 *p, size_t len) {
+  for (size_t i = 0; i < len; ++i) {
+    crc ^= p[i];
+    crc = (crc >> 4) ^ CRC_NIBBLE[crc & 0xf];
+    crc = (crc >> 4) ^ CRC_NIBBLE[crc & 0xf];
+  }
+  return crc;
+}
+
+u32 crc32Update(u32 crc, const void *data, size_t len) {
+  return ~crcRaw(~crc, data, len);
+}
+
+// Appending bytes to A is linear in the CRC register, so the CRC of A + B is
+// A's CRC run through as many zero bytes as B has, xor B's CRC.
+u32 crc32Combine(u32 crcA, u32 crcB, size_t lenB) {
+  static const u8 zeros[16] = {0};
+  while (lenB) {
+    size_t n = lenB < sizeof(zeros) ? lenB : sizeof(zeros);
+    crcA = crcRaw(crcA, zeros, n);
+    lenB -= n;
+  }
+  return crcA ^ crcB;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "int_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Small DEFLATE (RFC 1951) compressor for the gzip'd history. A stream is a
+// single final block with the fixed Huffman codes, and matches are only
+// looked for within a window that the caller provides, usually the previous
+// JSON line, so it needs no state beyond a few hundred bytes of stack.
+//
+// As there are no per-block tables, the codes for a line don't depend on
+// what came before, so they can be stored and copied into a later stream
+// bit for bit, as long as the bytes they were compressed against come right
+// before them.
+
+// Largest window, dictionary plus data, that deflateData() takes.
+#define DEFLATE_MAX_WINDOW 1024
+// Largest number of bytes deflateData() writes for len bytes of data: 9 bits
+// per literal, plus the bits held from before.
+#define DEFLATE_DATA_BOUND(len) ((len) + (len) / 8 + 2)
+
+// Writes bits least significant first. Whole bytes go to out, and the last
+// bitCount bits are held in bits. Sets overflow instead of writing past max.
+typedef struct {
+  u8 *out;
+  size_t len;
+  size_t max;
+  u32 bits;
+  u32 bitCount;
+  bool overflow;
+} BitWriter;
+
+// Number of bits written so far, held ones included.
+u32 bitsWritten(const BitWriter *w);
+// Write the held bits as a last, partial byte, padded with zeros. Only for
+// storing codes: the writer mustn't be used after that.
+void flushBits(BitWriter *w);
+// Copy count bits of src, starting from bit first.
+void copyBits(BitWriter *w, const u8 *src, u32 first, u32 count);
+
+// Start the block.
+void deflateBegin(BitWriter *w);
+// Compress window[dictLen, dictLen + len), with window[0, dictLen) as the
+// dictionary.
+void deflateData(BitWriter *w, const u8 *window, size_t dictLen, size_t len);
+// End the block, and pad it to a byte boundary.
+void deflateFinish(BitWriter *w);
+
+// CRC-32 as used by gzip and zlib. Start with 0.
+u32 crc32Update(u32 crc, const void *data, size_t len);
+// CRC-32 of the concatenation of two byte strings, from their CRCs and the
+// length of the second.
+u32 crc32Combine(u32 crcA, u32 crcB, size_t lenB);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
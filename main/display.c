@@ -0,0 +1,175 @@
+// Rotate the display through a set of frames: the current temperature,
+// today's min and max, and indicators for problems.
+//
+// The frames are rendered when a new sample arrives, and shown by a timer,
+// so the rotation speed does not depend on the sample period. While blanked,
+// e.g. for an alert's blinking, the rotation goes on, unseen.
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/timers.h"
+#include "sdkconfig.h"
+
+#include <string.h>
+
+#include "int_types.h"
+#include "user_config.h"
+#include "display.h"
+#include "ntp.h"
+#include "temperature.h"
+#include "temperature_tracker.h"
+#include "tm1637.h"
+
+// current, Lo, min, Hi, max, status
+#define MAX_FRAMES 6
+// Show "Err" only when the sensor keeps failing, not for a single glitch.
+#define ERROR_AFTER_FAILED_UPDATES 3
+
+typedef struct {
+  // Same format as tm1637DisplaySegments(), rightmost digit first.
+  u8 segments[4];
+} Frame;
+
+static Frame frames[MAX_FRAMES];
+static u8 frameCount = 0;
+static u8 frameIdx = 0;
+static u8 failedUpdates = 0;
+static TimerHandle_t frameTimer = NULL;
+static bool blanked = false;
+
+static void renderTemp(Frame *f, Temp16 temp);
+static void renderText(Frame *f, u8 g0, u8 g1, u8 g2, u8 g3);
+static void showNextFrame(TimerHandle_t xTimer);
+static void show(const Frame *f);
+
+void displayInit() {
+  // Dashes until there's a reading.
+  renderText(&frames[0], TM1637_GLYPH_MINUS, TM1637_GLYPH_MINUS,
+             TM1637_GLYPH_MINUS, TM1637_GLYPH_MINUS);
+  frameCount = 1;
+  tm1637SetSegments(frames[0].segments);
+
+  frameTimer = xTimerCreate("displayTimer",
+                            pdMS_TO_TICKS(CONFIG_DISPLAY_FRAME_MS), pdTRUE,
+                            NULL, showNextFrame);
+  configASSERT(frameTimer);
+  xTimerStart(frameTimer, 0);
+}
+
+// Render the frames for a new sample. If the sample failed, the last good
+// reading stays in the first frame.
+void displayUpdate(Temp16 temp, bool sensorOk) {
+  Frame next[MAX_FRAMES];
+  u8 n = 0;
+
+  if (sensorOk) {
+    failedUpdates = 0;
+    renderTemp(&next[n++], temp);
+  } else {
+    if (failedUpdates < ERROR_AFTER_FAILED_UPDATES) {
+      ++failedUpdates;
+    }
+    next[n++] = frames[0];
+  }
+#ifdef CONFIG_DISPLAY_SHOW_MIN_MAX
+  Temp16 minTemp;
+  Temp16 maxTemp;
+  if (getCurrentMinMax(&minTemp, &maxTemp)) {
+    renderText(&next[n++], TM1637_GLYPH_L, TM1637_GLYPH_O_LOWER,
+               TM1637_GLYPH_BLANK, TM1637_GLYPH_BLANK);
+    renderTemp(&next[n++], minTemp);
+    renderText(&next[n++], TM1637_GLYPH_H, TM1637_GLYPH_I_LOWER,
+               TM1637_GLYPH_BLANK, TM1637_GLYPH_BLANK);
+    renderTemp(&next[n++], maxTemp);
+  }
+#endif
+  if (failedUpdates >= ERROR_AFTER_FAILED_UPDATES) {
+    // "Err". Hex digit E.
+    renderText(&next[n++], 0x0e, TM1637_GLYPH_R_LOWER, TM1637_GLYPH_R_LOWER,
+               TM1637_GLYPH_BLANK);
+  } else if (!haveTime()) {
+    renderText(&next[n++], TM1637_GLYPH_N_LOWER, TM1637_GLYPH_O_LOWER,
+               TM1637_GLYPH_BLANK, TM1637_GLYPH_T_LOWER);
+  }
+
+  taskENTER_CRITICAL();
+  memcpy(frames, next, n * sizeof(Frame));
+  frameCount = n;
+  if (frameIdx >= frameCount) {
+    frameIdx = 0;
+  }
+  bool showNow = frameIdx == 0;
+  taskEXIT_CRITICAL();
+
+  // Don't wait for the timer to show a new current temperature.
+  if (showNow) {
+    show(&next[0]);
+  }
+}
+
+void displayBlank(bool blank) {
+  Frame f;
+  taskENTER_CRITICAL();
+  bool changed = blank != blanked;
+  blanked = blank;
+  f = frames[frameIdx];
+  taskEXIT_CRITICAL();
+  if (changed) {
+    show(&f);
+  }
+}
+
+static void showNextFrame(TimerHandle_t xTimer) {
+  Frame f;
+  taskENTER_CRITICAL();
+  frameIdx = (frameIdx + 1) % frameCount;
+  f = frames[frameIdx];
+  taskEXIT_CRITICAL();
+  show(&f);
+}
+
+static void show(const Frame *f) {
+  static const u8 blank[4] = {TM1637_GLYPH_BLANK, TM1637_GLYPH_BLANK,
+                              TM1637_GLYPH_BLANK, TM1637_GLYPH_BLANK};
+  tm1637SetSegments(blanked ? blank : f->segments);
+}
+
+// Render a temperature with one decimal, using a blank digit in place of the
+// decimal point. E.g., "23 5" and "-4 5". Values of 100 and above, or -10 and
+// below, are shown without decimals, e.g. " -12".
+static void renderTemp(Frame *f, Temp16 temp) {
+  int v = temp16ToDeciC(temp);
+  bool negative = v < 0;
+  if (negative) {
+    v = -v;
+  }
+  int whole = v / 10;
+  u8 *s = f->segments;
+
+  if (whole >= 100 || (negative && whole >= 10)) {
+    s[0] = (u8)(whole % 10);
+    s[1] = (u8)(whole / 10 % 10);
+    s[2] = negative ? TM1637_GLYPH_MINUS : (u8)(whole / 100 % 10);
+    s[3] = TM1637_GLYPH_BLANK;
+    return;
+  }
+
+  s[0] = (u8)(v % 10);
+  s[1] = TM1637_GLYPH_BLANK;
+  s[2] = (u8)(whole % 10);
+  if (negative) {
+    s[3] = TM1637_GLYPH_MINUS;
+  } else if (whole >= 10) {
+    s[3] = (u8)(whole / 10);
+  } else {
+    s[3] = TM1637_GLYPH_BLANK;
+  }
+}
+
+// Glyphs from left to right.
+static void renderText(Frame *f, u8 g0, u8 g1, u8 g2, u8 g3) {
+  f->segments[3] = g0;
+  f->segments[2] = g1;
+  f->segments[1] = g2;
+  f->segments[0] = g3;
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "temperature.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void displayInit();
+void displayUpdate(Temp16 temp, bool sensorOk);
+// Blank the display, or show the current frame again.
+void displayBlank(bool blank);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
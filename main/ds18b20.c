@@ -3,9 +3,14 @@
 // https://github.com/candale/esp826_ds18b20
 
 #include "math.h"
+#include <stdbool.h>
+#include <string.h>
 
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 #include "esp8266/rom_functions.h"
 #include "nvs.h"
+#include "sdkconfig.h"
 #include "rom/ets_sys.h"
 #include "os.h"
 
@@ -13,6 +18,7 @@
 #include "user_config.h"
 #include "ds18b20.h"
 #include "onewire.h"
+#include "temperature.h"
 
 #define DS18B20_CONVERT_T 0x44
 #define DS18B20_WRITE_SCRATCHPAD 0x4E
@@ -29,52 +35,305 @@
 #define DS18B20_ROM_IDENTIFIER 0x28
 
 #define ADDR_LEN 8
-#define DS18B20_GROW_RATIO 2
-#define DS18B20_INIT_ADDR_LENGTH 5
-#define DS18B20_ADDR_SIZE ADDR_LEN * sizeof(u8)
+#define DS18B20_ADDR_SIZE (ADDR_LEN * sizeof(u8))
 
-
-struct onewire_search_state onewire_state;
+// ROM codes found by the last search are kept in NVS, so that the next boot
+// only has to check that they are still there.
+#define DS18B20_NVS_NAMESPACE "ds18b20"
+#define DS18B20_NVS_KEY_ROMS "roms"
 
 
 int ds18b20_get_all(DS18B20_Sensors *sensors);
+int ds18b20_search(u8 *addresses, u8 max);
+u8 is_present(u8 *address);
+u8 load_cached_roms(u8 *addresses);
+void save_cached_roms(const DS18B20_Sensors *sensors);
+bool verify_sensors(DS18B20_Sensors *sensors);
+bool update_sensors(DS18B20_Sensors *sensors, const u8 *addresses, int count);
 void ds18b20_request_temperatures(DS18B20_Sensors *sensors);
-float ds18b20_read(DS18B20_Sensors *, u8 target);
 u8 ds18b20_set_resolution(DS18B20_Sensors *sensors, u8 target, u8 resolution);
 u8 ds18b20_get_resolution(DS18B20_Sensors *sensors, int target);
+void write_scratchpad(DS18B20_Sensors *sensors, u8 *address, u8 th, u8 tl,
+                      u8 config);
+u8 read_scratchpad(u8 *address, u8 *data);
+u8 is_connected(u8 *address, u8 *data);
+bool read_raw(DS18B20_Sensors *sensors, u8 target, Temp16 *raw);
+void update_extremes(DS18B20_Sensors *sensors, u8 target, Temp16 raw);
+int find_sensor(DS18B20_Sensors *sensors, const u8 *address);
+void ds18b20_recover_bus(DS18B20_Sensors *sensors);
 
 
+// Requires NVS to be initialized.
 void ds18b20_setup(DS18B20_Sensors* sensors) {
   onewire_init();
 
-  sensors->addresses = (u8 *)os_zalloc(DS18B20_ADDR_SIZE * DS18B20_INIT_ADDR_LENGTH);
-  sensors->count = 0;
-  sensors->length = DS18B20_INIT_ADDR_LENGTH;
-  sensors->parasite_mode = 0;
+  os_memset(sensors, 0, sizeof(*sensors));
+
+  // Checking the cached sensors takes one short transaction per sensor,
+  // while a search takes 64 read-read-write steps per sensor.
+  sensors->count = load_cached_roms(sensors->addresses);
+  if (sensors->count && verify_sensors(sensors)) {
+    sensors->from_cache = 1;
+    INFO("Using %d cached sensors\n", sensors->count);
+  } else {
+    int m = ds18b20_get_all(sensors);
+    INFO("Found %d sensors\n", m);
+    save_cached_roms(sensors);
+  }
 
-  int m = ds18b20_get_all(sensors);
-  INFO("Found %d sensors\n", m);
   INFO("Changing resolution to 12 bit\n");
 
   ds18b20_set_resolution(sensors, 0, DS18B20_TEMP_12_BIT);
 }
 
+// Run a single conversion and read the result. Returns NaN if the read
+// failed. Outliers are left for the caller to filter out.
 float ds18b2_get_temperature(DS18B20_Sensors* sensors) {
-  // We're not able to generate completely stable onewire signals, so we
-  // occasionally get bogus temperature values.
-  for (int tries = 0; tries < 10; ++tries) {
-    ds18b20_request_temperatures(sensors);
-    float tempCelcius = ds18b20_read(sensors, 0);
-    if (!isnan(tempCelcius) && -50 <= tempCelcius && tempCelcius <= 50) {
-      INFO("Successfully read temperature: %f\n", tempCelcius);
-      return tempCelcius;
+  ds18b20_request_temperatures(sensors);
+  Temp16 t = ds18b20_read_temperature(sensors);
+  return t == TEMP16_INVALID ? NAN : temp16ToCelcius(t);
+}
+
+// Read the result of a conversion started with ds18b20_start_conversion()
+// at least DS18B20_CONVERSION_MS earlier. Returns TEMP16_INVALID if the read
+// failed.
+Temp16 ds18b20_read_temperature(DS18B20_Sensors* sensors) {
+  // Noise on long wires, or a sensor being unplugged, occasionally makes a
+  // read fail. Instead of retrying, we report the failure and, if it keeps
+  // happening, reset and search the bus again.
+  Temp16 temp = ds18b20_read(sensors, 0);
+  if (temp != TEMP16_INVALID) {
+    sensors->consecutive_failures = 0;
+    return temp;
+  }
+
+  ++sensors->read_failures;
+  INFO("Reading temperature failed. failures=%d\n", sensors->read_failures);
+  if (++sensors->consecutive_failures >= CONFIG_DS18B20_RECOVER_AFTER_FAILURES) {
+    ds18b20_recover_bus(sensors);
+  }
+  return TEMP16_INVALID;
+}
+
+// Reinitialize the pin and rediscover the sensors. Also picks up a sensor
+// that was missing at boot.
+void ds18b20_recover_bus(DS18B20_Sensors *sensors) {
+  INFO("Recovering onewire bus\n");
+  ++sensors->bus_recoveries;
+  sensors->consecutive_failures = 0;
+
+  onewire_init();
+  onewire_reset();
+
+  u8 found[DS18B20_MAX_SENSORS * ADDR_LEN];
+  int m = ds18b20_search(found, DS18B20_MAX_SENSORS);
+  INFO("Found %d sensors\n", m);
+  if (m > 0) {
+    update_sensors(sensors, found, m);
+    ds18b20_set_resolution(sensors, 0, DS18B20_TEMP_12_BIT);
+  }
+}
+
+// Search the bus again, to detect sensors that were added or removed. Returns
+// true if the list of sensors changed.
+bool ds18b20_rescan(DS18B20_Sensors *sensors) {
+  u8 found[DS18B20_MAX_SENSORS * ADDR_LEN];
+  ++sensors->rescans;
+  int m = ds18b20_search(found, DS18B20_MAX_SENSORS);
+  if (m <= 0) {
+    // Keep the current list rather than act on a failed search. An empty
+    // bus is left to the read failures and ds18b20_recover_bus(), so that
+    // the cache and the extremes survive a glitch.
+    return false;
+  }
+  bool changed = update_sensors(sensors, found, m);
+  if (changed) {
+    INFO("Sensors changed. count=%d\n", sensors->count);
+    if (sensors->count) {
+      ds18b20_set_resolution(sensors, 0, DS18B20_TEMP_12_BIT);
+    }
+  }
+  return changed;
+}
+
+// Per sensor extremes with the DS18B20 alarm function.
+//
+// Each sensor's TH and TL are set to the integer part of its max and min for
+// the current period. After a broadcast conversion, only sensors whose
+// reading is within or beyond the whole degree of an extreme raise an alarm,
+// so an alarm search finds every sensor that may have a new extreme, and
+// only those are read. The alarm compares only the integer part, which is why
+// TH and TL must be the floor of the extremes: the result is exact, but
+// sensors close to an extreme are read even when they don't beat it.
+
+// Forget the extremes. Each sensor is read directly on the next scan.
+void ds18b20_alarm_new_period(DS18B20_Sensors *sensors) {
+  os_memset(sensors->has_extremes, 0, sizeof(sensors->has_extremes));
+}
+
+// Finding a sensor with the alarm search costs more bus time than reading it
+// directly, so the search only pays off while few sensors are in alarm. When
+// more than this percentage of the sensors are near an extreme, all of them
+// are read directly instead.
+#define DS18B20_ALARM_SEARCH_MAX_PERCENT 40
+
+// Update the extremes after a conversion started with
+// ds18b20_start_conversion() has completed.
+void ds18b20_alarm_scan(DS18B20_Sensors *sensors) {
+  u8 read[DS18B20_MAX_SENSORS] = {0};
+  u8 hits = 0;
+  Temp16 raw;
+
+  ++sensors->alarm_scans;
+
+  for (u8 i = 0; i < sensors->count; ++i) {
+    if ((sensors->alarm_direct || !sensors->has_extremes[i]) &&
+        read_raw(sensors, i, &raw)) {
+      read[i] = 1;
+      // The sensor's own test, against the extremes before this reading.
+      if (!sensors->has_extremes[i] ||
+          (raw >> 4) >= (sensors->max_raw[i] >> 4) ||
+          (raw >> 4) <= (sensors->min_raw[i] >> 4)) {
+        ++hits;
+      }
+      update_extremes(sensors, i, raw);
+    }
+  }
+
+  if (!sensors->alarm_direct) {
+    struct onewire_search_state state;
+    onewire_init_search_state(&state);
+    while (!state.lastDeviceFlag) {
+      u8 search_status = onewire_alarm_search(&state);
+      if (search_status != ONEWIRE_SEARCH_FOUND) {
+        // ONEWIRE_SEARCH_NO_DEVICES means no sensor has an alarm.
+        break;
+      }
+      int i = find_sensor(sensors, state.address);
+      if (i < 0 || read[i]) {
+        continue;
+      }
+      ++hits;
+      if (read_raw(sensors, i, &raw)) {
+        read[i] = 1;
+        update_extremes(sensors, i, raw);
+      }
+    }
+  }
+
+  // The number of sensors near an extreme changes slowly, so this scan's
+  // count decides how the next one reads.
+  sensors->alarm_direct =
+      hits * 100 > sensors->count * DS18B20_ALARM_SEARCH_MAX_PERCENT;
+}
+
+bool read_raw(DS18B20_Sensors *sensors, u8 target, Temp16 *raw) {
+  *raw = ds18b20_read(sensors, target);
+  if (*raw == TEMP16_INVALID) {
+    return false;
+  }
+  ++sensors->alarm_reads;
+  return true;
+}
+
+void update_extremes(DS18B20_Sensors *sensors, u8 target, Temp16 raw) {
+  bool changed = false;
+  if (!sensors->has_extremes[target]) {
+    sensors->min_raw[target] = raw;
+    sensors->max_raw[target] = raw;
+    sensors->has_extremes[target] = 1;
+    changed = true;
+  }
+  if (raw < sensors->min_raw[target]) {
+    sensors->min_raw[target] = raw;
+    changed = true;
+  }
+  if (raw > sensors->max_raw[target]) {
+    sensors->max_raw[target] = raw;
+    changed = true;
+  }
+  if (changed) {
+    // Arithmetic shift, so this is the floor also for negative values.
+    write_scratchpad(sensors, sensors->addresses + target * DS18B20_ADDR_SIZE,
+                     (u8)(s8)(sensors->max_raw[target] >> 4),
+                     (u8)(s8)(sensors->min_raw[target] >> 4),
+                     DS18B20_TEMP_12_BIT);
+  }
+}
+
+int find_sensor(DS18B20_Sensors *sensors, const u8 *address) {
+  for (u8 i = 0; i < sensors->count; ++i) {
+    if (!memcmp(sensors->addresses + i * DS18B20_ADDR_SIZE, address,
+                DS18B20_ADDR_SIZE)) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// Replace the list of sensors, and update the cache if it changed.
+bool update_sensors(DS18B20_Sensors *sensors, const u8 *addresses, int count) {
+  if (count == sensors->count &&
+      !memcmp(addresses, sensors->addresses, count * DS18B20_ADDR_SIZE)) {
+    return false;
+  }
+  // A bit error can end a search early, so a sensor it didn't find is only
+  // dropped if it doesn't answer either.
+  for (u8 i = 0; i < sensors->count; ++i) {
+    u8 *address = sensors->addresses + i * DS18B20_ADDR_SIZE;
+    bool found = false;
+    for (int j = 0; j < count && !found; ++j) {
+      found = !memcmp(address, addresses + j * DS18B20_ADDR_SIZE,
+                      DS18B20_ADDR_SIZE);
+    }
+    if (!found && is_present(address)) {
+      INFO("Sensor %d missed by the search, keeping the list\n", i);
+      return false;
+    }
+  }
+  os_memcpy(sensors->addresses, addresses, count * DS18B20_ADDR_SIZE);
+  sensors->count = count;
+  save_cached_roms(sensors);
+  // Indexes may have moved.
+  ds18b20_alarm_new_period(sensors);
+  return true;
+}
+
+// Check that each cached sensor answers a MATCH ROM read.
+bool verify_sensors(DS18B20_Sensors *sensors) {
+  for (u8 i = 0; i < sensors->count; ++i) {
+    if (!is_present(sensors->addresses + i * DS18B20_ADDR_SIZE)) {
+      INFO("Cached sensor %d did not respond\n", i);
+      return false;
     }
-    INFO("Reading temperature failed. Received \"%f\". Retrying...\n", tempCelcius);
-    os_delay_us(1000);
   }
-  rom_software_reboot();
-  // Just to make the compiler happy.
-  return 0.0f;
+  return true;
+}
+
+u8 load_cached_roms(u8 *addresses) {
+  nvs_handle handle;
+  if (nvs_open(DS18B20_NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+    return 0;
+  }
+  size_t len = DS18B20_MAX_SENSORS * DS18B20_ADDR_SIZE;
+  esp_err_t err = nvs_get_blob(handle, DS18B20_NVS_KEY_ROMS, addresses, &len);
+  nvs_close(handle);
+  if (err != ESP_OK || len % DS18B20_ADDR_SIZE) {
+    return 0;
+  }
+  return len / DS18B20_ADDR_SIZE;
+}
+
+void save_cached_roms(const DS18B20_Sensors *sensors) {
+  nvs_handle handle;
+  if (nvs_open(DS18B20_NVS_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK) {
+    INFO("Unable to open NVS for caching sensors\n");
+    return;
+  }
+  nvs_set_blob(handle, DS18B20_NVS_KEY_ROMS, sensors->addresses,
+               sensors->count * DS18B20_ADDR_SIZE);
+  nvs_commit(handle);
+  nvs_close(handle);
 }
 
 u8 read_scratchpad(u8 *address, u8 *data) {
@@ -90,18 +349,46 @@ u8 read_scratchpad(u8 *address, u8 *data) {
   return onewire_reset() == 1;
 }
 
+// Quick check for a sensor. Reads the scratchpad only up to the config
+// register, where the fixed bits can't be produced by an empty bus (which
+// reads as all ones).
+u8 is_present(u8 *address) {
+  u8 data[5];
+  onewire_reset();
+  onewire_select(address);
+  onewire_write_byte(DS18B20_READ_SCRATCHPAD, 0);
+  for (u8 i = 0; i < sizeof(data); i++) {
+    data[i] = onewire_read_byte();
+  }
+  // No need to end with a reset, as the next command starts with one.
+  return (data[4] & 0x9F) == 0x1F;
+}
+
 u8 is_connected(u8 *address, u8 *data) {
   u8 result = read_scratchpad(address, data);
   return result && crc8(data, 8) == data[8];
 }
 
 int ds18b20_get_all(DS18B20_Sensors *sensors) {
-  onewire_init_search_state(&onewire_state);
+  int m = ds18b20_search(sensors->addresses, DS18B20_MAX_SENSORS);
+  sensors->count = m > 0 ? m : 0;
+  return m;
+}
+
+// Search the bus and store the ROM codes of up to max DS18B20s in addresses.
+// Returns the number found, or -1 if the search failed.
+int ds18b20_search(u8 *addresses, u8 max) {
+  struct onewire_search_state state;
+  int count = 0;
+
+  onewire_init_search_state(&state);
 
-  while (!onewire_state.lastDeviceFlag) {
-    u8 search_status = onewire_search(&onewire_state);
+  while (!state.lastDeviceFlag) {
+    u8 search_status = onewire_search(&state);
     if (search_status == ONEWIRE_SEARCH_NO_DEVICES) {
-      return 0;
+      // Only an empty bus before the first sensor. Later, it's a glitch that
+      // cut the search short.
+      return count ? -1 : 0;
     }
 
     if (search_status != ONEWIRE_SEARCH_FOUND) {
@@ -109,31 +396,21 @@ int ds18b20_get_all(DS18B20_Sensors *sensors) {
     }
 
     // If it is not a DS18B20
-    if (onewire_state.address[0] != DS18B20_ROM_IDENTIFIER) {
+    if (state.address[0] != DS18B20_ROM_IDENTIFIER) {
       continue;
     }
 
-    os_memcpy(sensors->addresses + (sensors->count) * DS18B20_ADDR_SIZE,
-              onewire_state.address, DS18B20_ADDR_SIZE);
-
-    if (sensors->count + 1 >= sensors->length) {
-      u8 new_length;
-      if (sensors->length * DS18B20_GROW_RATIO > 0xFF) {
-        new_length = 0xFF;
-      } else {
-        new_length = sensors->length * DS18B20_GROW_RATIO;
-      }
-
-      sensors->addresses = (u8 *)os_realloc(
-          sensors->addresses, sensors->length * DS18B20_ADDR_SIZE +
-                                  (new_length * DS18B20_ADDR_SIZE));
-
-      sensors->length = new_length;
+    if (count == max) {
+      INFO("Ignoring sensors beyond the first %d\n", max);
+      break;
     }
-    sensors->count++;
+
+    os_memcpy(addresses + count * DS18B20_ADDR_SIZE, state.address,
+              DS18B20_ADDR_SIZE);
+    count++;
   }
 
-  return sensors->count;
+  return count;
 }
 
 u8 ds18b20_set_resolution(DS18B20_Sensors *sensors, u8 target, u8 resolution) {
@@ -145,21 +422,16 @@ u8 ds18b20_set_resolution(DS18B20_Sensors *sensors, u8 target, u8 resolution) {
     return 0;
   }
 
-  if (ds18b20_get_resolution(sensors, target) == resolution) {
-    return 1;
-  }
-
   u8 *target_addr = sensors->addresses + target * DS18B20_ADDR_SIZE;
+  u8 data[12];
+  read_scratchpad(target_addr, data);
 
-  onewire_reset();
-  onewire_select(target_addr);
+  if (data[4] == resolution) {
+    return 1;
+  }
 
-  // Write scratchpad
-  onewire_write_byte(DS18B20_WRITE_SCRATCHPAD, sensors->parasite_mode);
-  onewire_write_byte(0x00, sensors->parasite_mode); // user byte 1
-  onewire_write_byte(0x00, sensors->parasite_mode); // user byte 2
-  onewire_write_byte(resolution, sensors->parasite_mode);
-  onewire_reset();
+  // Keep the alarm thresholds
+  write_scratchpad(sensors, target_addr, data[2], data[3], resolution);
 
   // Persist resolution to EEPROM
   onewire_select(target_addr);
@@ -169,6 +441,19 @@ u8 ds18b20_set_resolution(DS18B20_Sensors *sensors, u8 target, u8 resolution) {
   return 1;
 }
 
+// Write the TH and TL alarm thresholds and the config register. Ends with a
+// reset.
+void write_scratchpad(DS18B20_Sensors *sensors, u8 *address, u8 th, u8 tl,
+                      u8 config) {
+  onewire_reset();
+  onewire_select(address);
+  onewire_write_byte(DS18B20_WRITE_SCRATCHPAD, sensors->parasite_mode);
+  onewire_write_byte(th, sensors->parasite_mode);
+  onewire_write_byte(tl, sensors->parasite_mode);
+  onewire_write_byte(config, sensors->parasite_mode);
+  onewire_reset();
+}
+
 u8 ds18b20_get_resolution(DS18B20_Sensors *sensors, int target) {
   u8 data[12];
 
@@ -178,35 +463,35 @@ u8 ds18b20_get_resolution(DS18B20_Sensors *sensors, int target) {
   return data[4];
 }
 
-void ds18b20_request_temperatures(DS18B20_Sensors *sensors) {
-  // Tell sensor to prepare data
+// Tell all sensors to start a conversion, and return without waiting for it
+// to complete.
+void ds18b20_start_conversion(DS18B20_Sensors *sensors) {
   onewire_reset();
   onewire_rom_skip();
   onewire_write_byte(DS18B20_CONVERT_T, sensors->parasite_mode);
+}
 
-  // Wait for it to process the data. May take up to 750 ms
-  for (int i = 0; i < 790; ++i) {
-    //    os_delay_us(790 * 1000);
-    os_delay_us(1000);
-  }
+void ds18b20_request_temperatures(DS18B20_Sensors *sensors) {
+  // Tell sensor to prepare data
+  ds18b20_start_conversion(sensors);
+
+  // Wait for it to process the data. May take up to 750 ms. Blocked rather
+  // than spinning, so that the CPU can sleep through it.
+  vTaskDelay(pdMS_TO_TICKS(DS18B20_CONVERSION_MS));
 }
 
-float ds18b20_read(DS18B20_Sensors *sensors, u8 target) {
+// Read the temperature register of a sensor, in 1/16 C. Returns
+// TEMP16_INVALID if the read failed.
+Temp16 ds18b20_read(DS18B20_Sensors *sensors, u8 target) {
   u8 *target_addr = sensors->addresses + target * DS18B20_ADDR_SIZE;
   u8 data[12];
-  //    u8 i;
 
+  // Use the CRC checked scratchpad directly. Reading it again would return
+  // data that has not been checked.
   if (!is_connected(target_addr, data)) {
-    return NAN;
+    return TEMP16_INVALID;
   }
 
-  read_scratchpad(target_addr, data);
-
-  u32 lsb = data[0];
-  u32 msb = data[1];
-
-  // Taken from Arduino DallasTemperature
-  s16 raw_temp = (((s16)msb) << 11) | (((s16)lsb) << 3);
-
-  return raw_temp * 0.0078125;
+  // The register is already two's complement 1/16 C.
+  return (Temp16)(((u16)data[1] << 8) | data[0]);
 }
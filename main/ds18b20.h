@@ -1,15 +1,60 @@
 #pragma once
 
 #include "stddef.h"
+#include <stdbool.h>
+
+#include "sdkconfig.h"
+
 #include "int_types.h"
+#include "temperature.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DS18B20_MAX_SENSORS CONFIG_DS18B20_MAX_SENSORS
 
 typedef struct _sensors {
-  u8 *addresses;
+  // 8 byte ROM codes.
+  u8 addresses[DS18B20_MAX_SENSORS * 8];
   u8 count;
-  size_t length;
   // not currently used
   u8 parasite_mode;
+  // The sensors were taken from the NVS cache instead of a search.
+  u8 from_cache;
+  u32 rescans;
+  // Per sensor min and max for the current period in 1/16 C, kept by
+  // ds18b20_alarm_scan().
+  Temp16 min_raw[DS18B20_MAX_SENSORS];
+  Temp16 max_raw[DS18B20_MAX_SENSORS];
+  u8 has_extremes[DS18B20_MAX_SENSORS];
+  // Too many sensors were near an extreme for the alarm search to pay off,
+  // so the next scan reads all sensors directly.
+  u8 alarm_direct;
+  u32 alarm_scans;
+  // Scratchpad reads done by alarm scans.
+  u32 alarm_reads;
+  // Read failures (missing sensor or bad CRC) and resulting bus recoveries.
+  u32 read_failures;
+  u32 bus_recoveries;
+  u8 consecutive_failures;
 } DS18B20_Sensors;
 
+// Time for a 12 bit conversion, with some margin.
+#define DS18B20_CONVERSION_MS 790
+
 void ds18b20_setup(DS18B20_Sensors*);
 float ds18b2_get_temperature(DS18B20_Sensors*);
+void ds18b20_start_conversion(DS18B20_Sensors*);
+Temp16 ds18b20_read_temperature(DS18B20_Sensors*);
+// Read one sensor's result of the last conversion, without the failure
+// counting and recovery of ds18b20_read_temperature(). Returns
+// TEMP16_INVALID if the read failed.
+Temp16 ds18b20_read(DS18B20_Sensors*, u8 target);
+bool ds18b20_rescan(DS18B20_Sensors*);
+void ds18b20_alarm_new_period(DS18B20_Sensors*);
+void ds18b20_alarm_scan(DS18B20_Sensors*);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,214 @@
+#include <string.h>
+
+#include "sdkconfig.h"
+
+#include "deflate.h"
+#include "history_export.h"
+#include "temperature_tracker.h"
+
+#define EXPORT_LINE_LENGTH 256
+// Output is collected into chunks of this size, so that the HTTP server
+// isn't handed a chunk per line.
+#define EXPORT_CHUNK_BYTES 512
+
+typedef struct {
+  ExportWrite write;
+  void *ctx;
+  bool failed;
+  size_t len;
+  s8 buf[EXPORT_CHUNK_BYTES];
+} Output;
+
+static void flush(Output *o) {
+  if (o->len && !o->failed && !o->write(o->ctx, o->buf, o->len)) {
+    o->failed = true;
+  }
+  o->len = 0;
+}
+
+static void put(Output *o, const void *data, size_t len) {
+  const s8 *p = data;
+  while (len) {
+    if (o->len == sizeof(o->buf)) {
+      flush(o);
+    }
+    size_t n = sizeof(o->buf) - o->len;
+    n = len < n ? len : n;
+    memcpy(o->buf + o->len, p, n);
+    o->len += n;
+    p += n;
+    len -= n;
+  }
+}
+
+// Render a day's line, with the separator that follows every day but the
+// current one. Returns the length, 0 if the days have moved since the range
+// was taken, when the export has to stop rather than skip or repeat one.
+static size_t renderLine(s8 *buf, const RenderedRange *range, size_t idx,
+                         const s8 *separator) {
+  if (!getMinMaxLineSince(buf, EXPORT_LINE_LENGTH - 4, idx, range->shifts)) {
+    return 0;
+  }
+  size_t len = strlen(buf);
+  strcpy(buf + len, separator);
+  return len + strlen(separator);
+}
+
+// Copy a cache range to the output. Returns false if its start was dropped
+// while copying.
+typedef int (*CacheRead)(u32 *pos, u32 endPos, s8 *buf, size_t maxLen);
+
+static bool putCached(Output *o, const RenderedRange *range, CacheRead read) {
+  u32 pos = range->startPos;
+  int len;
+  do {
+    if (o->len == sizeof(o->buf)) {
+      flush(o);
+    }
+    len = read(&pos, range->endPos, o->buf + o->len, sizeof(o->buf) - o->len);
+    if (len > 0) {
+      o->len += len;
+    }
+  } while (len > 0);
+  return len == 0;
+}
+
+// Days older than the cache are formatted here, then the cached days are
+// copied, then the current day is formatted.
+bool exportHistoryJson(ExportWrite write, void *ctx) {
+  Output o = {write, ctx, false, 0};
+  s8 line[EXPORT_LINE_LENGTH];
+  RenderedRange cached;
+  getRenderedRange(&cached);
+  size_t currentIdx = cached.firstLine + cached.lines;
+
+  put(&o, "[\n", 2);
+  for (size_t i = 0; i < cached.firstLine && !o.failed; ++i) {
+    size_t len = renderLine(line, &cached, i, ",\n");
+    if (!len) {
+      return false;
+    }
+    put(&o, line, len);
+  }
+  if (!putCached(&o, &cached, readRendered)) {
+    return false;
+  }
+  if (currentIdx < cached.records) {
+    size_t len = renderLine(line, &cached, currentIdx, "");
+    if (!len) {
+      return false;
+    }
+    put(&o, line, len);
+  }
+  put(&o, "\n]\n", 3);
+  flush(&o);
+  return !o.failed;
+}
+
+#ifdef CONFIG_HTTP_GZIP
+
+// The deflate codes are written straight into the output buffer. The window
+// holds the text of the last line, as the dictionary, then the next one.
+typedef struct {
+  Output *out;
+  BitWriter bits;
+  u32 crc;
+  u32 plainBytes;
+  size_t dictLen;
+  u8 window[EXPORT_LINE_LENGTH * 2];
+} GzipState;
+
+// Flush the output if fewer than n bytes are left, keeping the held bits.
+static void makeRoom(GzipState *g, size_t n) {
+  if (g->bits.max - g->bits.len < n) {
+    g->out->len = g->bits.len;
+    flush(g->out);
+    g->bits.len = 0;
+  }
+}
+
+// Deflate the len bytes after the dictionary, and make them the dictionary
+// for the next line.
+static void putDeflated(GzipState *g, size_t len) {
+  makeRoom(g, DEFLATE_DATA_BOUND(len));
+  const u8 *data = g->window + g->dictLen;
+  deflateData(&g->bits, g->window, g->dictLen, len);
+  g->crc = crc32Update(g->crc, data, len);
+  g->plainBytes += len;
+  memmove(g->window, data, len);
+  g->dictLen = len;
+}
+
+// Copy the cached codes. Returns false if their start was dropped while
+// copying.
+static bool putCachedBits(GzipState *g, const RenderedRange *range) {
+  u32 pos = range->startPos;
+  int n;
+  do {
+    makeRoom(g, EXPORT_CHUNK_BYTES / 4);
+    n = readDeflated(&pos, range->endPos, &g->bits);
+  } while (n > 0);
+  return n == 0;
+}
+
+static void putLe32(Output *o, u32 v) {
+  u8 b[4] = {(u8)v, (u8)(v >> 8), (u8)(v >> 16), (u8)(v >> 24)};
+  put(o, b, sizeof(b));
+}
+
+// Same text as exportHistoryJson(), in a gzip member (RFC 1952) of a single
+// deflate block. Cached days are copied already deflated, and only the rest
+// is deflated here, a line at a time.
+bool exportHistoryGzip(ExportWrite write, void *ctx) {
+  // ID1, ID2, deflate, no flags, no time, no extra flags, unknown OS.
+  static const u8 header[] = {0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 0xff};
+  Output o = {write, ctx, false, 0};
+  GzipState g = {&o, {(u8 *)o.buf, 0, sizeof(o.buf), 0, 0, false}, 0, 0, 0};
+  RenderedRange cached;
+  getDeflatedRange(&cached);
+  size_t currentIdx = cached.firstLine + cached.lines;
+
+  put(&o, header, sizeof(header));
+  g.bits.len = o.len;
+  deflateBegin(&g.bits);
+  memcpy(g.window, "[\n", 2);
+  putDeflated(&g, 2);
+  for (size_t i = 0; i < cached.firstLine && !o.failed; ++i) {
+    size_t len = renderLine((s8 *)g.window + g.dictLen, &cached, i, ",\n");
+    if (!len) {
+      return false;
+    }
+    putDeflated(&g, len);
+  }
+  if (cached.lines) {
+    if (!putCachedBits(&g, &cached)) {
+      return false;
+    }
+    g.crc = crc32Combine(g.crc, cached.plainCrc, cached.plainBytes);
+    g.plainBytes += cached.plainBytes;
+    // The last cached day is the dictionary for the current one.
+    g.dictLen = renderLine((s8 *)g.window, &cached, currentIdx - 1, ",\n");
+    if (!g.dictLen) {
+      return false;
+    }
+  }
+  size_t len = 0;
+  if (currentIdx < cached.records) {
+    len = renderLine((s8 *)g.window + g.dictLen, &cached, currentIdx, "");
+    if (!len) {
+      return false;
+    }
+  }
+  memcpy(g.window + g.dictLen + len, "\n]\n", 3);
+  putDeflated(&g, len + 3);
+  makeRoom(&g, 2);
+  deflateFinish(&g.bits);
+  o.len = g.bits.len;
+
+  putLe32(&o, g.crc);
+  putLe32(&o, g.plainBytes);
+  flush(&o);
+  return !o.failed;
+}
+
+#endif
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "int_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// The history as a JSON array, plain or gzip'd, written in chunks through a
+// callback. Shared by the HTTP handler and the host tools, so that they
+// produce the same bytes.
+
+// Called with each chunk. Returns false to stop.
+typedef bool (*ExportWrite)(void *ctx, const s8 *data, size_t len);
+
+// Return false if a write failed, or the days moved while writing, e.g. the
+// oldest was dropped at a day change, in which case the output is
+// incomplete. No day is ever skipped or repeated.
+bool exportHistoryJson(ExportWrite write, void *ctx);
+// Needs CONFIG_HTTP_GZIP.
+bool exportHistoryGzip(ExportWrite write, void *ctx);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,194 @@
+// Merge an uploaded history into the tracker. See history_import.h.
+//
+// Each line of the export is one day, so the upload is split into lines as
+// it arrives, and each is checked and merged on its own.
+
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "os.h"
+#include "sdkconfig.h"
+
+#include "user_config.h"
+#include "history_import.h"
+#include "temperature.h"
+#include "temperature_tracker.h"
+
+#define PLAUSIBLE_MIN TEMP16_FROM_C(CONFIG_TEMP_PLAUSIBLE_MIN)
+#define PLAUSIBLE_MAX TEMP16_FROM_C(CONFIG_TEMP_PLAUSIBLE_MAX)
+
+// Longest value of a field, a temperature.
+#define MAX_VALUE_LENGTH 10
+
+static bool stopped(const HistoryImport *imp) {
+  return imp->invalidLine || imp->notReady;
+}
+
+void importHistoryBegin(HistoryImport *imp) {
+  memset(imp, 0, sizeof(*imp));
+}
+
+// Copy the value of a string field. Returns false if there's no such field,
+// or its value doesn't fit.
+static bool field(const s8 *line, const s8 *key, s8 *value, size_t maxLen) {
+  s8 quoted[16];
+  int keyLen = snprintf(quoted, sizeof(quoted), "\"%s\"", key);
+  const s8 *p = strstr(line, quoted);
+  if (!p) {
+    return false;
+  }
+  p += keyLen;
+  while (*p == ' ') {
+    ++p;
+  }
+  if (*p++ != ':') {
+    return false;
+  }
+  while (*p == ' ') {
+    ++p;
+  }
+  if (*p++ != '"') {
+    return false;
+  }
+  const s8 *end = strchr(p, '"');
+  if (!end || (size_t)(end - p) >= maxLen) {
+    return false;
+  }
+  memcpy(value, p, end - p);
+  value[end - p] = 0;
+  return true;
+}
+
+// True if s has a digit wherever the pattern has a 'd', and the pattern's
+// other characters elsewhere.
+static bool matches(const s8 *s, const s8 *pattern) {
+  for (; *pattern; ++s, ++pattern) {
+    if (*pattern == 'd' ? !isdigit((int)*s) : *s != *pattern) {
+      return false;
+    }
+  }
+  return !*s;
+}
+
+// The two digit number at s.
+static int number2(const s8 *s) { return (s[0] - '0') * 10 + s[1] - '0'; }
+
+static bool validDate(const s8 *s) {
+  static const u8 monthDays[12] = {31, 28, 31, 30, 31, 30,
+                                   31, 31, 30, 31, 30, 31};
+  if (!matches(s, "dddd-dd-dd")) {
+    return false;
+  }
+  int year = number2(s) * 100 + number2(s + 2);
+  int month = number2(s + 5);
+  int day = number2(s + 8);
+  if (month < 1 || month > 12) {
+    return false;
+  }
+  bool leap = (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+  return day >= 1 && day <= monthDays[month - 1] + (month == 2 && leap);
+}
+
+static bool validTime(const s8 *s) {
+  return matches(s, "dd:dd:dd") && number2(s) < 24 && number2(s + 3) < 60 &&
+         number2(s + 6) < 60;
+}
+
+static bool validTemp(const s8 *s, Temp16 *t) {
+  return temp16Parse(s, t) && *t >= PLAUSIBLE_MIN && *t <= PLAUSIBLE_MAX;
+}
+
+// Merge the day on a line, which is NUL terminated at len. Lines without a
+// day, of the array's brackets or empty, are skipped. Returns false if the
+// import stops.
+static bool takeLine(HistoryImport *imp, s8 *line, size_t len) {
+  ++imp->lineNo;
+  while (len && isspace((int)line[len - 1])) {
+    --len;
+  }
+  if (len && line[len - 1] == ',') {
+    --len;
+  }
+  line[len] = 0;
+  const s8 *p = line;
+  while (isspace((int)*p)) {
+    ++p;
+  }
+  if (!*p || !strcmp(p, "[") || !strcmp(p, "]")) {
+    return true;
+  }
+
+  s8 period[MAX_VALUE_LENGTH + 1];
+  s8 minTime[MAX_VALUE_LENGTH + 1];
+  s8 maxTime[MAX_VALUE_LENGTH + 1];
+  s8 minStr[MAX_VALUE_LENGTH + 1];
+  s8 maxStr[MAX_VALUE_LENGTH + 1];
+  Temp16 minTemp;
+  Temp16 maxTemp;
+  if (*p != '{' || line[len - 1] != '}' ||
+      !field(p, "period", period, sizeof(period)) ||
+      !field(p, "minTime", minTime, sizeof(minTime)) ||
+      !field(p, "minTemp", minStr, sizeof(minStr)) ||
+      !field(p, "maxTime", maxTime, sizeof(maxTime)) ||
+      !field(p, "maxTemp", maxStr, sizeof(maxStr)) || !validDate(period) ||
+      !validTime(minTime) || !validTime(maxTime) ||
+      !validTemp(minStr, &minTemp) || !validTemp(maxStr, &maxTemp) ||
+      minTemp > maxTemp) {
+    imp->invalidLine = imp->lineNo;
+    return false;
+  }
+
+  switch (importDay(period, minTime, minTemp, maxTime, maxTemp)) {
+  case IMPORT_ADDED:
+    ++imp->added;
+    break;
+  case IMPORT_MERGED:
+    ++imp->merged;
+    break;
+  case IMPORT_UNCHANGED:
+    ++imp->unchanged;
+    break;
+  case IMPORT_SKIPPED:
+    ++imp->skipped;
+    break;
+  case IMPORT_NOT_READY:
+    imp->notReady = true;
+    return false;
+  }
+  ++imp->days;
+  return true;
+}
+
+bool importHistoryData(HistoryImport *imp, const s8 *data, size_t len) {
+  while (len && !stopped(imp)) {
+    const s8 *nl = memchr(data, '\n', len);
+    size_t n = nl ? (size_t)(nl - data) : len;
+    if (imp->partialLen + n >= sizeof(imp->partial)) {
+      // Longer than any day's line.
+      imp->invalidLine = imp->lineNo + 1;
+      break;
+    }
+    memcpy(imp->partial + imp->partialLen, data, n);
+    imp->partialLen += n;
+    if (!nl) {
+      break;
+    }
+    takeLine(imp, imp->partial, imp->partialLen);
+    imp->partialLen = 0;
+    data += n + 1;
+    len -= n + 1;
+  }
+  return !stopped(imp);
+}
+
+bool importHistoryEnd(HistoryImport *imp) {
+  if (!stopped(imp) && imp->partialLen) {
+    takeLine(imp, imp->partial, imp->partialLen);
+    imp->partialLen = 0;
+  }
+  finishImport();
+  INFO("Imported history. days=%u added=%u merged=%u invalidLine=%u\n",
+       imp->days, imp->added, imp->merged, imp->invalidLine);
+  return !stopped(imp);
+}
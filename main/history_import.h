@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "int_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Merge a history, as exported by exportHistoryJson(), into the tracker, e.g.
+// from a unit this one replaces. The upload is fed in chunks, as it arrives,
+// and each day is merged as soon as its line is complete, so only one line is
+// ever held. See importDay() for how days are merged.
+//
+// Every line is checked, and the import stops at the first that isn't a day.
+// The days before it stay merged. Merging is idempotent, so a fixed upload
+// can simply be sent again.
+
+#define IMPORT_LINE_LENGTH 256
+
+typedef struct {
+  // Days read, and what became of them. An added day may have been dropped
+  // again, to make room for a newer one of the same upload.
+  u32 days;
+  u32 added;
+  u32 merged;
+  u32 unchanged;
+  u32 skipped;
+  // Line of the first invalid one, from 1, 0 if none.
+  u32 invalidLine;
+  // Stopped because no day has started yet, see IMPORT_NOT_READY.
+  bool notReady;
+  u32 lineNo;
+  // The start of a line that hasn't fully arrived.
+  size_t partialLen;
+  s8 partial[IMPORT_LINE_LENGTH];
+} HistoryImport;
+
+void importHistoryBegin(HistoryImport *imp);
+// Take the next bytes of the upload. Returns false once the import has
+// stopped, after which the rest is ignored.
+bool importHistoryData(HistoryImport *imp, const s8 *data, size_t len);
+// Take the last line, which needn't end with a newline, and cache the
+// changed days again. Call even if the import stopped. Returns false if it
+// did.
+bool importHistoryEnd(HistoryImport *imp);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -7,21 +7,42 @@
 #include <nvs_flash.h>
 #include <rom/ets_sys.h>
 #include <esp_http_server.h>
+#include <esp_heap_caps.h>
+#include <esp_system.h>
 
 
+#include <ctype.h>
+#include <stdarg.h>
+
 #include "user_config.h"
+#include "alerts.h"
+#include "alloc_stats.h"
 #include "ds18b20.h"
+#include "history_export.h"
+#include "history_import.h"
+#include "log_ring.h"
 #include "ntp.h"
+#include "power.h"
+#include "publisher.h"
+#include "sampler.h"
+#include "startup.h"
+#include "temperature.h"
+#include "temperature_filter.h"
 #include "temperature_tracker.h"
 
-os_timer_t read_timer;
-
 
 static httpd_handle_t server = NULL;
 extern DS18B20_Sensors sensors;
 
 
 esp_err_t get_temperature_handler(httpd_req_t *req);
+esp_err_t get_diag_handler(httpd_req_t *req);
+esp_err_t get_sensors_handler(httpd_req_t *req);
+esp_err_t get_heap_handler(httpd_req_t *req);
+esp_err_t get_log_handler(httpd_req_t *req);
+esp_err_t get_alerts_handler(httpd_req_t *req);
+esp_err_t post_alerts_handler(httpd_req_t *req);
+esp_err_t post_history_handler(httpd_req_t *req);
 
 static void disconnect_handler(void* arg, esp_event_base_t event_base,
     s32 event_id, void* event_data);
@@ -32,23 +53,44 @@ static void connect_handler(void* arg, esp_event_base_t event_base,
 httpd_handle_t start_webserver();
 
 
-const u32 MAX_TEMPERATURE_LINE_LENGTH = 256;
+#define MAX_TEMPERATURE_LINE_LENGTH 256
+#define MAX_DIAG_LENGTH 1536
+#define MAX_ETAG_LENGTH 28
+#define MAX_ACCEPT_ENCODING_LENGTH 128
+#define MAX_IF_NONE_MATCH_LENGTH 128
+#define MAX_QUERY_LENGTH 64
+#define MAX_AUTHORIZATION_LENGTH 128
+// Read from the socket at a time, for an uploaded history.
+#define IMPORT_CHUNK_LENGTH 512
 
+// Part of the history's ETag, so that tags from before a reboot don't match
+// the restarted version count.
+static u32 etag_boot_id = 0;
 
-void service_init()
+
+// Connect to WiFi. Blocks until we have an IP address, so call from a task
+// that nothing else waits on.
+void network_init()
 {
-  ESP_ERROR_CHECK(nvs_flash_init());
   ESP_ERROR_CHECK(esp_netif_init());
   ESP_ERROR_CHECK(esp_event_loop_create_default());
 
   // Connect to network using SSID and key specified in
   // idf.py menuconfig > Example Connection Information
   ESP_ERROR_CHECK(example_connect());
+  startupMark(STARTUP_NETWORK);
+}
 
+void http_start()
+{
+  etag_boot_id = esp_random();
   ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &connect_handler, &server));
   ESP_ERROR_CHECK(esp_event_handler_register(WIFI_EVENT, WIFI_EVENT_STA_DISCONNECTED, &disconnect_handler, &server));
 
   server = start_webserver();
+  if (server) {
+    startupMark(STARTUP_HTTP);
+  }
 }
 
 
@@ -59,9 +101,54 @@ httpd_uri_t temperature = {
     .handler   = get_temperature_handler,
 };
 
+httpd_uri_t diag = {
+    .uri       = "/diag",
+    .method    = HTTP_GET,
+    .handler   = get_diag_handler,
+};
+
+httpd_uri_t sensors_uri = {
+    .uri       = "/sensors",
+    .method    = HTTP_GET,
+    .handler   = get_sensors_handler,
+};
+
+httpd_uri_t heap_uri = {
+    .uri       = "/heap",
+    .method    = HTTP_GET,
+    .handler   = get_heap_handler,
+};
+
+httpd_uri_t log_uri = {
+    .uri       = "/log",
+    .method    = HTTP_GET,
+    .handler   = get_log_handler,
+};
+
+httpd_uri_t alerts_uri = {
+    .uri       = "/alerts",
+    .method    = HTTP_GET,
+    .handler   = get_alerts_handler,
+};
+
+httpd_uri_t alerts_post_uri = {
+    .uri       = "/alerts",
+    .method    = HTTP_POST,
+    .handler   = post_alerts_handler,
+};
+
+httpd_uri_t history_post_uri = {
+    .uri       = "/",
+    .method    = HTTP_POST,
+    .handler   = post_history_handler,
+};
+
 httpd_handle_t start_webserver() {
   httpd_handle_t server = NULL;
   httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+  // The history export keeps its output chunk and, for gzip, the deflate
+  // window on the stack.
+  config.stack_size = 6144;
 
   // Start the httpd server
   INFO("Starting server on port: '%d'", config.server_port);
@@ -69,6 +156,15 @@ httpd_handle_t start_webserver() {
     // Set URI handlers
     INFO("Registering URI handlers");
     httpd_register_uri_handler(server, &temperature);
+    httpd_register_uri_handler(server, &diag);
+    httpd_register_uri_handler(server, &sensors_uri);
+    httpd_register_uri_handler(server, &heap_uri);
+    httpd_register_uri_handler(server, &log_uri);
+    httpd_register_uri_handler(server, &alerts_uri);
+    httpd_register_uri_handler(server, &alerts_post_uri);
+    if (CONFIG_HTTP_IMPORT_TOKEN[0]) {
+      httpd_register_uri_handler(server, &history_post_uri);
+    }
     return server;
   }
 
@@ -82,6 +178,54 @@ void stop_webserver(httpd_handle_t server)
   httpd_stop(server);
 }
 
+// Append to a response in buf, of size bytes, at *len. What doesn't fit is
+// cut off, and *len stays within the buffer, so later appends are dropped
+// too instead of writing past the end.
+__attribute__((format(printf, 4, 5)))
+static void append(s8 *buf, size_t size, size_t *len, const char *format,
+                   ...) {
+  va_list args;
+  va_start(args, format);
+  int n = vsnprintf(buf + *len, size - *len, format, args);
+  va_end(args);
+  if (n > 0) {
+    *len += n;
+  }
+  if (*len >= size) {
+    *len = size - 1;
+  }
+}
+
+// True if the request's If-None-Match lists the ETag, or is "*".
+static bool etag_matches(httpd_req_t *req, const s8 *etag) {
+  s8 buf[MAX_IF_NONE_MATCH_LENGTH];
+  size_t len = httpd_req_get_hdr_value_len(req, "If-None-Match");
+  if (len == 0 || len >= sizeof(buf) ||
+      httpd_req_get_hdr_value_str(req, "If-None-Match", buf, sizeof(buf)) !=
+          ESP_OK) {
+    return false;
+  }
+  return strcmp(buf, "*") == 0 || strstr(buf, etag) != NULL;
+}
+
+// True if the request's Accept-Encoding includes gzip, and it's enabled.
+static bool accepts_gzip(httpd_req_t *req) {
+#ifdef CONFIG_HTTP_GZIP
+  s8 buf[MAX_ACCEPT_ENCODING_LENGTH];
+  size_t len = httpd_req_get_hdr_value_len(req, "Accept-Encoding");
+  return len > 0 && len < sizeof(buf) &&
+         httpd_req_get_hdr_value_str(req, "Accept-Encoding", buf,
+                                     sizeof(buf)) == ESP_OK &&
+         strstr(buf, "gzip") != NULL;
+#else
+  return false;
+#endif
+}
+
+static bool send_export_chunk(void *ctx, const s8 *data, size_t len) {
+  return httpd_resp_send_chunk(ctx, data, len) == ESP_OK;
+}
+
 /* An HTTP GET handler */
 esp_err_t get_temperature_handler(httpd_req_t *req) {
   char*  buf;
@@ -91,54 +235,543 @@ esp_err_t get_temperature_handler(httpd_req_t *req) {
    * extra byte for null termination */
   buf_len = httpd_req_get_hdr_value_len(req, "Host") + 1;
   if (buf_len > 1) {
-    buf = malloc(buf_len);
+    buf = allocTraced(ALLOC_HTTP, buf_len);
     /* Copy null terminated value string into buffer */
     if (httpd_req_get_hdr_value_str(req, "Host", buf, buf_len) == ESP_OK) {
-      INFO("Found header => Host: %s", buf);
+      INFO_TEXT("Found header => Host: %s", buf);
     }
-    free(buf);
+    freeTraced(ALLOC_HTTP, buf, buf_len);
   }
 
   buf_len = httpd_req_get_hdr_value_len(req, "Test-Header-2") + 1;
   if (buf_len > 1) {
-    buf = malloc(buf_len);
+    buf = allocTraced(ALLOC_HTTP, buf_len);
     if (httpd_req_get_hdr_value_str(req, "Test-Header-2", buf, buf_len) == ESP_OK) {
-      INFO("Found header => Test-Header-2: %s", buf);
+      INFO_TEXT("Found header => Test-Header-2: %s", buf);
     }
-    free(buf);
+    freeTraced(ALLOC_HTTP, buf, buf_len);
   }
 
   buf_len = httpd_req_get_hdr_value_len(req, "Test-Header-1") + 1;
   if (buf_len > 1) {
-    buf = malloc(buf_len);
+    buf = allocTraced(ALLOC_HTTP, buf_len);
     if (httpd_req_get_hdr_value_str(req, "Test-Header-1", buf, buf_len) == ESP_OK) {
-      INFO("Found header => Test-Header-1: %s", buf);
+      INFO_TEXT("Found header => Test-Header-1: %s", buf);
+    }
+    freeTraced(ALLOC_HTTP, buf, buf_len);
+  }
+
+  httpd_resp_set_type(req, "text/json");
+
+  bool gzip = accepts_gzip(req);
+  if (gzip) {
+    httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+  }
+  httpd_resp_set_hdr(req, "Vary", "Accept-Encoding");
+
+  // Clients that poll with If-None-Match only get the history when it has
+  // changed. The version is read before the history, so a change while
+  // sending gives a stale tag and the next poll a full response. The gzip'd
+  // response is a different representation, so it has its own tag.
+  // httpd_resp_set_hdr() keeps the pointer until the response is sent, so
+  // the tag must live until the handler returns.
+  s8 etag[MAX_ETAG_LENGTH];
+  snprintf(etag, sizeof(etag), "\"%08x-%08x%s\"", etag_boot_id,
+           getTrackerVersion(), gzip ? "-gz" : "");
+  httpd_resp_set_hdr(req, "ETag", etag);
+  httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+  if (etag_matches(req, etag)) {
+    httpd_resp_set_status(req, "304 Not Modified");
+    httpd_resp_send(req, NULL, 0);
+    return ESP_OK;
+  }
+
+#ifdef CONFIG_HTTP_GZIP
+  bool ok = gzip ? exportHistoryGzip(send_export_chunk, req)
+                 : exportHistoryJson(send_export_chunk, req);
+#else
+  bool ok = exportHistoryJson(send_export_chunk, req);
+#endif
+  if (!ok) {
+    // The client went away, or the oldest cached days were dropped at a day
+    // change while sending. Fail, so that the connection is closed and the
+    // client sees an incomplete response rather than a gap.
+    INFO("Couldn't send the whole history. Aborting response");
+    return ESP_FAIL;
+  }
+  httpd_resp_send_chunk(req, NULL, 0);
+
+  return ESP_OK;
+}
+
+// Return counters that show how well sampling is going, as JSON. With
+// "?resetWindow=1", the sampler's windowMaxLatenessUs restarts from 0 once
+// it has been read.
+esp_err_t get_diag_handler(httpd_req_t *req) {
+  s8 buf[MAX_DIAG_LENGTH];
+  size_t len = 0;
+  s8 query[MAX_QUERY_LENGTH];
+  s8 value[4];
+  size_t query_len = httpd_req_get_url_query_len(req);
+  bool reset_window =
+      query_len > 0 && query_len < sizeof(query) &&
+      httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+      httpd_query_key_value(query, "resetWindow", value, sizeof(value)) ==
+          ESP_OK &&
+      !strcmp(value, "1");
+  const TempFilterStats *filter = tempFilterGetStats();
+
+  append(buf, sizeof(buf), &len,
+         "{\n"
+         "  \"filter\": { "
+         "\"accepted\": %u, "
+         "\"rejectedImplausible\": %u, "
+         "\"rejectedOutlier\": %u"
+         " },\n",
+         filter->accepted, filter->rejectedImplausible,
+         filter->rejectedOutlier);
+  append(buf, sizeof(buf), &len,
+         "  \"sensor\": { "
+         "\"count\": %u, "
+         "\"readFailures\": %u, "
+         "\"busRecoveries\": %u, "
+         "\"fromCache\": %s, "
+         "\"rescans\": %u, "
+         "\"alarmScans\": %u, "
+         "\"alarmReads\": %u"
+         " },\n",
+         sensors.count, sensors.read_failures,
+         sensors.bus_recoveries,
+         sensors.from_cache ? "true" : "false", sensors.rescans,
+         sensors.alarm_scans, sensors.alarm_reads);
+  const SamplerStats *sampler = samplerGetStats();
+  append(buf, sizeof(buf), &len,
+         "  \"sampler\": { "
+         "\"periodMs\": %u, "
+         "\"cycles\": %u, "
+         "\"missedDeadlines\": %u, "
+         "\"lastLatenessUs\": %u, "
+         "\"maxLatenessUs\": %u, "
+         "\"windowMaxLatenessUs\": %u, "
+         "\"totalLatenessUs\": %llu, "
+         "\"meanLatenessUs\": %u, "
+         "\"lastProcessUs\": %u, "
+         "\"maxProcessUs\": %u, "
+         "\"meanProcessUs\": %u"
+         " },\n",
+         CONFIG_SAMPLE_PERIOD_MS, sampler->cycles,
+         sampler->missedDeadlines, sampler->lastLatenessUs,
+         sampler->maxLatenessUs, sampler->windowMaxLatenessUs,
+         (unsigned long long)sampler->totalLatenessUs,
+         sampler->cycles
+             ? (u32)(sampler->totalLatenessUs / sampler->cycles)
+             : 0,
+         sampler->lastProcessUs, sampler->maxProcessUs,
+         sampler->cycles
+             ? (u32)(sampler->totalProcessUs / sampler->cycles)
+             : 0);
+  if (reset_window) {
+    samplerResetWindow();
+  }
+  const LogStats *log = logGetStats();
+  append(buf, sizeof(buf), &len,
+         "  \"log\": { "
+         "\"records\": %u, "
+         "\"dropped\": %u, "
+         "\"rejected\": %u"
+         " },\n",
+         log->records, log->dropped, log->rejected);
+  // Null if publishing is disabled.
+  const PublisherStats *pub = publisherGetStats();
+  if (pub) {
+    append(buf, sizeof(buf), &len,
+           "  \"publisher\": { "
+           "\"queued\": %u, "
+           "\"acked\": %u, "
+           "\"dropped\": %u, "
+           "\"packets\": %u, "
+           "\"ackTimeouts\": %u, "
+           "\"sendErrors\": %u, "
+           "\"outboxBytes\": %u, "
+           "\"outboxMessages\": %u, "
+           "\"lastAckMs\": %u, "
+           "\"alerts\": %u, "
+           "\"lastAlertWaitUs\": %u, "
+           "\"maxAlertWaitUs\": %u"
+           " },\n",
+           pub->queued, pub->acked, pub->dropped, pub->packets,
+           pub->ackTimeouts, pub->sendErrors, pub->outboxBytes,
+           pub->outboxMessages, pub->lastAckMs, pub->alerts,
+           pub->lastAlertWaitUs, pub->maxAlertWaitUs);
+  } else {
+    append(buf, sizeof(buf), &len, "  \"publisher\": null,\n");
+  }
+  // Null if the low-power mode is disabled.
+  const PowerStats *power = powerGetStats();
+  if (power) {
+    append(buf, sizeof(buf), &len,
+           "  \"power\": { "
+           "\"cycles\": %u, "
+           "\"lastAwakeUs\": %u, "
+           "\"maxAwakeUs\": %u, "
+           "\"meanAwakeUs\": %u, "
+           "\"lastCurrentUa\": %u, "
+           "\"meanCurrentUa\": %u"
+           " },\n",
+           power->cycles, power->lastAwakeUs, power->maxAwakeUs,
+           power->cycles
+               ? (u32)(power->totalAwakeUs / power->cycles)
+               : 0,
+           power->lastCurrentUa, power->meanCurrentUa);
+  } else {
+    append(buf, sizeof(buf), &len, "  \"power\": null,\n");
+  }
+  // Time since boot when each startup stage completed, null if it hasn't.
+  append(buf, sizeof(buf), &len, "  \"startupMs\": { ");
+  for (int i = 0; i < STARTUP_STAGE_COUNT; ++i) {
+    const char *sep = i + 1 < STARTUP_STAGE_COUNT ? ", " : "";
+    if (startupReached(i)) {
+      append(buf, sizeof(buf), &len, "\"%s\": %u%s",
+             startupStageName(i), startupGetMs(i), sep);
+    } else {
+      append(buf, sizeof(buf), &len, "\"%s\": null%s",
+             startupStageName(i), sep);
     }
-    free(buf);
   }
+  append(buf, sizeof(buf), &len, " }\n}\n");
 
   httpd_resp_set_type(req, "text/json");
+  httpd_resp_send(req, buf, len);
+  return ESP_OK;
+}
 
-  s8 lineBuf[MAX_TEMPERATURE_LINE_LENGTH + 2];
+// Return the sensors on the bus, with today's min and max for each if
+// CONFIG_DS18B20_ALARM_MODE is enabled, as JSON.
+esp_err_t get_sensors_handler(httpd_req_t *req) {
+  s8 lineBuf[MAX_TEMPERATURE_LINE_LENGTH];
 
-  // Return tracked temps as JSON
+  httpd_resp_set_type(req, "text/json");
   httpd_resp_send_chunk(req, "[\n", 2);
-  for (size_t i = 0; i < getMinMaxCount(); ++i) {
-    getMinMaxLine(lineBuf, MAX_TEMPERATURE_LINE_LENGTH, i);
-    size_t lineLen = strlen(lineBuf);
-    if (i < getMinMaxCount() - 1) {
-      strcpy(lineBuf + lineLen, ",\n");
+  for (u8 i = 0; i < sensors.count; ++i) {
+    const u8 *a = sensors.addresses + i * 8;
+    size_t len = 0;
+    append(lineBuf, sizeof(lineBuf), &len,
+           "{ \"rom\": \"%02x%02x%02x%02x%02x%02x%02x%02x\"", a[0], a[1],
+           a[2], a[3], a[4], a[5], a[6], a[7]);
+    if (sensors.has_extremes[i]) {
+      s8 minStr[10];
+      s8 maxStr[10];
+      temp16Format(minStr, sizeof(minStr), sensors.min_raw[i]);
+      temp16Format(maxStr, sizeof(maxStr), sensors.max_raw[i]);
+      append(lineBuf, sizeof(lineBuf), &len,
+             ", \"minTemp\": \"%s\", \"maxTemp\": \"%s\"", minStr, maxStr);
+    }
+    append(lineBuf, sizeof(lineBuf), &len, " }%s\n",
+           i + 1 < sensors.count ? "," : "");
+    httpd_resp_send_chunk(req, lineBuf, len);
+  }
+  httpd_resp_send_chunk(req, "]\n", 2);
+  httpd_resp_send_chunk(req, lineBuf, 0);
+  return ESP_OK;
+}
+
+// Return the tracker's memory budget and, with CONFIG_ALLOC_TRACING, the
+// heap use of each subsystem, as JSON.
+esp_err_t get_heap_handler(httpd_req_t *req) {
+  s8 buf[MAX_DIAG_LENGTH];
+  size_t len = 0;
+  TrackerMemory mem;
+  getTrackerMemory(&mem);
+
+  append(buf, sizeof(buf), &len,
+         "{\n"
+         "  \"freeBytes\": %u,\n"
+         "  \"minFreeBytes\": %u,\n"
+         "  \"tracker\": { "
+         "\"budgetBytes\": %u, "
+         "\"usedBytes\": %u, "
+         "\"recordBytes\": %u, "
+         "\"records\": %u, "
+         "\"maxRecords\": %u, "
+         "\"droppedRecords\": %u, "
+         "\"cacheBudgetBytes\": %u, "
+         "\"cacheUsedBytes\": %u, "
+         "\"cachedRecords\": %u, "
+         "\"gzipCacheBudgetBytes\": %u, "
+         "\"gzipCacheUsedBytes\": %u, "
+         "\"gzipCachedRecords\": %u, "
+         "\"gzipCachePlainBytes\": %u"
+         " },\n",
+         (unsigned)heap_caps_get_free_size(MALLOC_CAP_8BIT),
+         (unsigned)esp_get_minimum_free_heap_size(), mem.budgetBytes,
+         mem.usedBytes, mem.recordBytes, mem.records, mem.maxRecords,
+         mem.droppedRecords, mem.cacheBudgetBytes,
+         mem.cacheUsedBytes, mem.cachedRecords,
+         mem.gzipCacheBudgetBytes, mem.gzipCacheUsedBytes,
+         mem.gzipCachedRecords, mem.gzipCachePlainBytes);
+  // Null if tracing is disabled.
+  if (!allocGetStats(ALLOC_TRACKER)) {
+    append(buf, sizeof(buf), &len, "  \"alloc\": null\n}\n");
+  } else {
+    append(buf, sizeof(buf), &len, "  \"alloc\": {\n");
+    for (int i = 0; i < ALLOC_SUBSYSTEM_COUNT; ++i) {
+      const AllocStats *a = allocGetStats(i);
+      append(buf, sizeof(buf), &len,
+             "    \"%s\": { "
+             "\"allocs\": %u, "
+             "\"frees\": %u, "
+             "\"failures\": %u, "
+             "\"liveBytes\": %u, "
+             "\"peakBytes\": %u"
+             " }%s\n",
+             allocSubsystemName(i), a->allocs, a->frees, a->failures,
+             a->liveBytes, a->peakBytes,
+             i + 1 < ALLOC_SUBSYSTEM_COUNT ? "," : "");
     }
-    httpd_resp_send_chunk(req, lineBuf, strlen(lineBuf));
+    append(buf, sizeof(buf), &len, "  }\n}\n");
+  }
+
+  httpd_resp_set_type(req, "text/json");
+  httpd_resp_send(req, buf, len);
+  return ESP_OK;
+}
+
+// Return the log ring, oldest first, one "<ms since boot> <message>" line per
+// record. Records are formatted here, not when they were logged.
+esp_err_t get_log_handler(httpd_req_t *req) {
+  s8 lineBuf[MAX_TEMPERATURE_LINE_LENGTH];
+  httpd_resp_set_type(req, "text/plain");
+  u32 pos = logOldest();
+  size_t len;
+  while ((len = logRead(&pos, lineBuf, sizeof(lineBuf)))) {
+    httpd_resp_send_chunk(req, lineBuf, len);
   }
-  httpd_resp_send_chunk(req, "\n]\n", 3);
   httpd_resp_send_chunk(req, lineBuf, 0);
+  return ESP_OK;
+}
+
+// A temperature as a JSON string, or null if it's invalid.
+static void format_temp_json(s8 *buf, size_t maxLen, Temp16 t) {
+  if (t == TEMP16_INVALID) {
+    snprintf(buf, maxLen, "null");
+    return;
+  }
+  buf[0] = '"';
+  int n = temp16Format(buf + 1, maxLen - 2, t);
+  snprintf(buf + 1 + n, maxLen - 1 - n, "\"");
+}
 
+// Return each checked sensor's thresholds, last sample and alert states,
+// as JSON.
+esp_err_t get_alerts_handler(httpd_req_t *req) {
+  s8 lineBuf[MAX_TEMPERATURE_LINE_LENGTH];
+  // Null if alerts are disabled.
+  const AlertStats *stats = alertsGetStats();
+  if (!stats) {
+    httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Alerts are disabled");
+    return ESP_OK;
+  }
+
+  httpd_resp_set_type(req, "text/json");
+  int len = snprintf(lineBuf, sizeof(lineBuf),
+                     "{\n"
+                     "  \"raised\": %u,\n"
+                     "  \"cleared\": %u,\n"
+                     "  \"active\": %u,\n"
+                     "  \"sensors\": [\n",
+                     stats->raised, stats->cleared, stats->active);
+  httpd_resp_send_chunk(req, lineBuf, len);
+  u8 count = alertsSensorCount();
+  for (u8 i = 0; i < count; ++i) {
+    SensorAlert a;
+    alertsGet(i, &a);
+    s8 highStr[12];
+    s8 lowStr[12];
+    s8 tempStr[12];
+    format_temp_json(highStr, sizeof(highStr), a.threshold[ALERT_HIGH]);
+    format_temp_json(lowStr, sizeof(lowStr), a.threshold[ALERT_LOW]);
+    format_temp_json(tempStr, sizeof(tempStr), a.temp);
+    s8 romStr[20] = "null";
+    if (a.rom[0]) {
+      const u8 *r = a.rom;
+      snprintf(romStr, sizeof(romStr),
+               "\"%02x%02x%02x%02x%02x%02x%02x%02x\"", r[0], r[1], r[2],
+               r[3], r[4], r[5], r[6], r[7]);
+    }
+    len = snprintf(lineBuf, sizeof(lineBuf),
+                   "    { \"sensor\": %u, \"rom\": %s, \"high\": %s, "
+                   "\"low\": %s, \"temp\": %s, \"highState\": \"%s\", "
+                   "\"lowState\": \"%s\", \"raised\": %u }%s\n",
+                   i, romStr, highStr, lowStr, tempStr,
+                   alertStateName(a.state[ALERT_HIGH]),
+                   alertStateName(a.state[ALERT_LOW]), a.raised,
+                   i + 1 < count ? "," : "");
+    httpd_resp_send_chunk(req, lineBuf, len);
+  }
+  httpd_resp_send_chunk(req, "  ]\n}\n", 6);
+  httpd_resp_send_chunk(req, lineBuf, 0);
   return ESP_OK;
 }
+
+// Parse a threshold in degrees, with at most one decimal, e.g. "30" or
+// "-4.5", or "off". Returns false if it's neither, or out of the DS18B20's
+// range.
+static bool parse_threshold(const s8 *s, Temp16 *t) {
+  if (strcmp(s, "off") == 0) {
+    *t = TEMP16_INVALID;
+    return true;
+  }
+  bool negative = *s == '-';
+  if (negative) {
+    ++s;
+  }
+  if (!isdigit((int)*s)) {
+    return false;
+  }
+  int deciC = 0;
+  while (isdigit((int)*s) && deciC < 10000) {
+    deciC = deciC * 10 + (*s++ - '0') * 10;
+  }
+  if (*s == '.' && isdigit((int)s[1])) {
+    deciC += s[1] - '0';
+    s += 2;
+  }
+  if (*s) {
+    return false;
+  }
+  deciC = negative ? -deciC : deciC;
+  if (deciC < -550 || deciC > 1250) {
+    return false;
+  }
+  *t = TEMP16_FROM_DECI_C(deciC);
+  return true;
+}
+
+// Set a sensor's thresholds, from the query, e.g.
+// "POST /alerts?sensor=0&high=30.5&low=off". A threshold that isn't given
+// is left as it is. Returns the alerts like a GET.
+esp_err_t post_alerts_handler(httpd_req_t *req) {
+  s8 query[MAX_QUERY_LENGTH];
+  s8 value[16];
+  size_t len = httpd_req_get_url_query_len(req);
+  if (len == 0 || len >= sizeof(query) ||
+      httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK ||
+      httpd_query_key_value(query, "sensor", value, sizeof(value)) !=
+          ESP_OK ||
+      !isdigit((int)value[0])) {
+    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Expected ?sensor=N");
+    return ESP_OK;
+  }
+  u32 sensor = (u32)atoi(value);
+  if (sensor >= alertsSensorCount()) {
+    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST,
+                        "Sensor isn't checked for alerts");
+    return ESP_OK;
+  }
+  SensorAlert a;
+  alertsGet(sensor, &a);
+  if (!a.rom[0]) {
+    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST,
+                        "No sensor at that index on the bus");
+    return ESP_OK;
+  }
+  Temp16 high = a.threshold[ALERT_HIGH];
+  Temp16 low = a.threshold[ALERT_LOW];
+  if ((httpd_query_key_value(query, "high", value, sizeof(value)) ==
+           ESP_OK &&
+       !parse_threshold(value, &high)) ||
+      (httpd_query_key_value(query, "low", value, sizeof(value)) == ESP_OK &&
+       !parse_threshold(value, &low)) ||
+      !alertsSetThresholds(sensor, high, low)) {
+    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST,
+                        "Thresholds must be degrees or off, and low below "
+                        "high");
+    return ESP_OK;
+  }
+  INFO("Alert thresholds of sensor %d set to %d and %d /16 C\n", sensor,
+       high, low);
+  return get_alerts_handler(req);
+}
+
+// True if the request carries "Authorization: Bearer <token>". The compare
+// takes as long wherever the token differs, so it can't be guessed a
+// character at a time.
+static bool has_import_token(httpd_req_t *req) {
+  static const s8 prefix[] = "Bearer ";
+  static const s8 token[] = CONFIG_HTTP_IMPORT_TOKEN;
+  s8 buf[MAX_AUTHORIZATION_LENGTH];
+  size_t len = httpd_req_get_hdr_value_len(req, "Authorization");
+  if (len != sizeof(prefix) - 1 + sizeof(token) - 1 ||
+      httpd_req_get_hdr_value_str(req, "Authorization", buf, sizeof(buf)) !=
+          ESP_OK ||
+      strncmp(buf, prefix, sizeof(prefix) - 1)) {
+    return false;
+  }
+  u8 diff = 0;
+  for (size_t i = 0; i < sizeof(token) - 1; ++i) {
+    diff |= buf[sizeof(prefix) - 1 + i] ^ token[i];
+  }
+  return diff == 0;
+}
+
+// Merge an uploaded history, in the format of GET /, e.g.
+// "curl -H 'Authorization: Bearer <token>' --data-binary @history.json".
+// The body is read a chunk at a time, so it can be of any length. Responds
+// with what became of the days, or 400 with the first invalid line.
+esp_err_t post_history_handler(httpd_req_t *req) {
+  if (!has_import_token(req)) {
+    httpd_resp_set_status(req, "401 Unauthorized");
+    httpd_resp_set_hdr(req, "WWW-Authenticate", "Bearer");
+    httpd_resp_send(req, NULL, 0);
+    return ESP_OK;
+  }
+
+  HistoryImport imp;
+  s8 buf[IMPORT_CHUNK_LENGTH];
+  importHistoryBegin(&imp);
+  size_t left = req->content_len;
+  while (left) {
+    int n = httpd_req_recv(req, buf, left < sizeof(buf) ? left : sizeof(buf));
+    if (n <= 0) {
+      // Gone, or stalled for the server's receive timeout, so there's no one
+      // to answer. What arrived is merged.
+      importHistoryEnd(&imp);
+      return ESP_FAIL;
+    }
+    left -= n;
+    // Once stopped, the rest is still read, so the connection stays usable.
+    importHistoryData(&imp, buf, n);
+  }
+  importHistoryEnd(&imp);
+
+  if (imp.notReady) {
+    httpd_resp_set_status(req, "503 Service Unavailable");
+    httpd_resp_send(req, "No day has started yet, try again later\n",
+                    HTTPD_RESP_USE_STRLEN);
+    return ESP_OK;
+  }
+  if (imp.invalidLine) {
+    snprintf(buf, sizeof(buf), "Line %u isn't a day, %u days before it "
+             "were merged", imp.invalidLine, imp.days);
+    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, buf);
+    return ESP_OK;
+  }
+  int len = snprintf(buf, sizeof(buf),
+                     "{\n  \"days\": %u,\n  \"added\": %u,\n"
+                     "  \"merged\": %u,\n  \"unchanged\": %u,\n"
+                     "  \"skipped\": %u\n}\n",
+                     imp.days, imp.added, imp.merged, imp.unchanged,
+                     imp.skipped);
+  httpd_resp_set_type(req, "text/json");
+  httpd_resp_send(req, buf, len);
+  return ESP_OK;
+}
+
 void disconnect_handler(void *arg, esp_event_base_t event_base,
                         s32 event_id, void *event_data) {
   httpd_handle_t* server = (httpd_handle_t*) arg;
+  // The publisher keeps queuing, and sends when we're back.
+  publisherSetNetworkUp(false);
   if (*server) {
     INFO("Stopping webserver");
     stop_webserver(*server);
@@ -148,6 +781,7 @@ void disconnect_handler(void *arg, esp_event_base_t event_base,
 void connect_handler(void *arg, esp_event_base_t event_base, s32 event_id,
                      void *event_data) {
   httpd_handle_t* server = (httpd_handle_t*) arg;
+  publisherSetNetworkUp(true);
   if (*server == NULL) {
     INFO("Starting webserver");
     *server = start_webserver();
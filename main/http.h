@@ -1,4 +1,4 @@
 #pragma once
 
-void service_init();
-
+void network_init();
+void http_start();
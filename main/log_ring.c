@@ -0,0 +1,240 @@
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+
+#include "log_ring.h"
+
+#define LOG_RING_BYTES CONFIG_LOG_RING_BYTES
+// Longest logText() record, including the terminator.
+#define LOG_TEXT_MAX 96
+#define LOG_ALIGN (sizeof(uintptr_t))
+
+_Static_assert((LOG_RING_BYTES & (LOG_RING_BYTES - 1)) == 0,
+               "CONFIG_LOG_RING_BYTES must be a power of two");
+
+typedef struct {
+  // NULL for a text record.
+  const char *format;
+  u32 ticks;
+  u16 payloadBytes;
+  u8 argc;
+} LogHeader;
+
+// Records start on a pointer boundary, so that headers that don't wrap
+// around the end can be accessed in place. Positions count up from 0 and are only
+// reduced modulo the ring size when accessing it, so they can be compared.
+static u8 ring[LOG_RING_BYTES] __attribute__((aligned(LOG_ALIGN)));
+static u32 writePos = 0;
+static u32 oldestPos = 0;
+static LogStats stats;
+
+static u32 recordBytes(u32 payloadBytes) {
+  return (sizeof(LogHeader) + payloadBytes + LOG_ALIGN - 1) & ~(LOG_ALIGN - 1);
+}
+
+static void ringCopyIn(u32 pos, const void *src, size_t n) {
+  u32 off = pos & (LOG_RING_BYTES - 1);
+  size_t first = n < LOG_RING_BYTES - off ? n : LOG_RING_BYTES - off;
+  memcpy(ring + off, src, first);
+  memcpy(ring, (const u8 *)src + first, n - first);
+}
+
+static void ringCopyOut(void *dst, u32 pos, size_t n) {
+  u32 off = pos & (LOG_RING_BYTES - 1);
+  size_t first = n < LOG_RING_BYTES - off ? n : LOG_RING_BYTES - off;
+  memcpy(dst, ring + off, first);
+  memcpy((u8 *)dst + first, ring, n - first);
+}
+
+static void append(const LogHeader *h, const void *payload) {
+  u32 size = recordBytes(h->payloadBytes);
+  if (size > LOG_RING_BYTES) {
+    ++stats.rejected;
+    return;
+  }
+  taskENTER_CRITICAL();
+  while (writePos + size - oldestPos > LOG_RING_BYTES) {
+    u32 off = oldestPos & (LOG_RING_BYTES - 1);
+    u16 payloadBytes;
+    if (off + sizeof(LogHeader) <= LOG_RING_BYTES) {
+      payloadBytes = ((const LogHeader *)(ring + off))->payloadBytes;
+    } else {
+      LogHeader oldest;
+      ringCopyOut(&oldest, oldestPos, sizeof(oldest));
+      payloadBytes = oldest.payloadBytes;
+    }
+    oldestPos += recordBytes(payloadBytes);
+    ++stats.dropped;
+  }
+  u32 off = writePos & (LOG_RING_BYTES - 1);
+  if (off + sizeof(*h) <= LOG_RING_BYTES) {
+    *(LogHeader *)(ring + off) = *h;
+  } else {
+    ringCopyIn(writePos, h, sizeof(*h));
+  }
+  ringCopyIn(writePos + sizeof(*h), payload, h->payloadBytes);
+  writePos += size;
+  ++stats.records;
+  taskEXIT_CRITICAL();
+}
+
+void logWrite(const char *format, int argc, ...) {
+  if (argc > LOG_MAX_ARGS) {
+    ++stats.rejected;
+    return;
+  }
+  uintptr_t args[LOG_MAX_ARGS];
+  va_list ap;
+  va_start(ap, argc);
+  for (int i = 0; i < argc; ++i) {
+    args[i] = va_arg(ap, uintptr_t);
+  }
+  va_end(ap);
+  LogHeader h = {format, xTaskGetTickCount(), argc * sizeof(uintptr_t), argc};
+  append(&h, args);
+}
+
+void logText(const char *format, ...) {
+  s8 text[LOG_TEXT_MAX];
+  va_list ap;
+  va_start(ap, format);
+  int n = vsnprintf(text, sizeof(text), format, ap);
+  va_end(ap);
+  if (n < 0) {
+    return;
+  }
+  if (n >= (int)sizeof(text)) {
+    n = sizeof(text) - 1;
+  }
+  LogHeader h = {NULL, xTaskGetTickCount(), n, 0};
+  append(&h, text);
+}
+
+u32 logOldest() { return oldestPos; }
+
+const LogStats *logGetStats() { return &stats; }
+
+// Add the snprintf() result to len, without going past the buffer.
+static size_t advance(size_t len, int n, size_t maxLen) {
+  if (n < 0) {
+    return len;
+  }
+  return len + n < maxLen ? len + n : maxLen - 1;
+}
+
+// Format the arguments of a record, one conversion at a time, since they
+// can't be passed on as a va_list.
+static size_t formatArgs(s8 *buf, size_t maxLen, const char *format,
+                         const uintptr_t *args, int argc) {
+  size_t len = 0;
+  int arg = 0;
+  const char *p = format;
+  while (*p && len + 1 < maxLen) {
+    if (*p != '%') {
+      buf[len++] = *p++;
+      continue;
+    }
+    // Copy the conversion, such as "%-5lu", to print this argument alone.
+    s8 spec[16];
+    size_t n = 0;
+    spec[n++] = *p++;
+    while (*p && strchr("-+ #0123456789.hlz", *p) && n < sizeof(spec) - 2) {
+      spec[n++] = *p++;
+    }
+    s8 conv = *p;
+    if (conv) {
+      ++p;
+    }
+    spec[n++] = conv;
+    spec[n] = 0;
+
+    bool isLong = strchr(spec, 'l') != NULL;
+    bool isSize = strchr(spec, 'z') != NULL;
+    uintptr_t v = arg < argc ? args[arg] : 0;
+    int w;
+    switch (conv) {
+    case '%':
+      w = snprintf(buf + len, maxLen - len, "%%");
+      break;
+    case 's':
+      w = snprintf(buf + len, maxLen - len, spec, (const char *)v);
+      ++arg;
+      break;
+    case 'c':
+    case 'd':
+    case 'i':
+      w = isLong ? snprintf(buf + len, maxLen - len, spec, (long)v)
+                 : snprintf(buf + len, maxLen - len, spec, (int)v);
+      ++arg;
+      break;
+    case 'u':
+    case 'x':
+    case 'X':
+    case 'o':
+      w = isSize   ? snprintf(buf + len, maxLen - len, spec, (size_t)v)
+          : isLong ? snprintf(buf + len, maxLen - len, spec, (unsigned long)v)
+                   : snprintf(buf + len, maxLen - len, spec, (unsigned)v);
+      ++arg;
+      break;
+    case 'p':
+      w = snprintf(buf + len, maxLen - len, spec, (void *)v);
+      ++arg;
+      break;
+    default:
+      w = snprintf(buf + len, maxLen - len, "?");
+      ++arg;
+      break;
+    }
+    len = advance(len, w, maxLen);
+  }
+  buf[len] = 0;
+  return len;
+}
+
+size_t logRead(u32 *pos, s8 *buf, size_t maxLen) {
+  LogHeader h;
+  union {
+    uintptr_t args[LOG_MAX_ARGS];
+    s8 text[LOG_TEXT_MAX];
+  } payload;
+
+  taskENTER_CRITICAL();
+  if ((s32)(*pos - oldestPos) < 0) {
+    *pos = oldestPos;
+  }
+  if (*pos == writePos) {
+    taskEXIT_CRITICAL();
+    return 0;
+  }
+  ringCopyOut(&h, *pos, sizeof(h));
+  ringCopyOut(&payload, *pos + sizeof(h), h.payloadBytes);
+  *pos += recordBytes(h.payloadBytes);
+  taskEXIT_CRITICAL();
+
+  size_t len = advance(0,
+                       snprintf(buf, maxLen, "%u ",
+                                (unsigned)(h.ticks * portTICK_PERIOD_MS)),
+                       maxLen);
+  if (h.format) {
+    len += formatArgs(buf + len, maxLen - len, h.format, payload.args, h.argc);
+  } else {
+    len = advance(len,
+                  snprintf(buf + len, maxLen - len, "%.*s",
+                           (int)h.payloadBytes, payload.text),
+                  maxLen);
+  }
+  // One record per line, whether or not the message ended with a newline.
+  while (len > 0 && buf[len - 1] == '\n') {
+    --len;
+  }
+  if (len + 1 < maxLen) {
+    buf[len++] = '\n';
+  }
+  buf[len] = 0;
+  return len;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "int_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Deferred log. Each record keeps the format string pointer, the tick count
+// and the raw arguments in a RAM ring. Nothing is formatted until the log is
+// read, so logging costs a copy of a few words. The oldest records are
+// dropped when the ring is full.
+//
+// Arguments are stored as uintptr_t, so they must be integers, or strings
+// that outlive the log, such as literals. 64-bit and floating point
+// arguments are not supported. Use logText() for strings in buffers that
+// will be reused.
+
+#define LOG_MAX_ARGS 4
+
+typedef struct {
+  u32 records;
+  u32 dropped;
+  // Records too big for the ring, or with too many arguments.
+  u32 rejected;
+} LogStats;
+
+void logWrite(const char *format, int argc, ...);
+// Format now, into a text record.
+void logText(const char *format, ...);
+
+// Position of the oldest record in the ring.
+u32 logOldest();
+// Format the record at *pos into buf as a line, and advance *pos to the next
+// record. Skips ahead if the record at *pos has been dropped. Returns the
+// line length, or 0 if there are no more records.
+size_t logRead(u32 *pos, s8 *buf, size_t maxLen);
+const LogStats *logGetStats();
+
+// Count the arguments of INFO(), and convert each to uintptr_t.
+#define LOG_NARGS(...) LOG_NARGS_(0, ##__VA_ARGS__, 4, 3, 2, 1, 0)
+#define LOG_NARGS_(_0, _1, _2, _3, _4, n, ...) n
+#define LOG_CAT(a, b) LOG_CAT_(a, b)
+#define LOG_CAT_(a, b) a##b
+#define LOG_ARGS_0()
+#define LOG_ARGS_1(a) , (uintptr_t)(a)
+#define LOG_ARGS_2(a, b) , (uintptr_t)(a), (uintptr_t)(b)
+#define LOG_ARGS_3(a, b, c) , (uintptr_t)(a), (uintptr_t)(b), (uintptr_t)(c)
+#define LOG_ARGS_4(a, b, c, d)                                                 \
+  , (uintptr_t)(a), (uintptr_t)(b), (uintptr_t)(c), (uintptr_t)(d)
+
+#define LOG_WRITE(format, ...)                                                 \
+  logWrite(format, LOG_NARGS(__VA_ARGS__)                                      \
+                       LOG_CAT(LOG_ARGS_, LOG_NARGS(__VA_ARGS__))(__VA_ARGS__))
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
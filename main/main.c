@@ -11,36 +11,60 @@
 
 #include "int_types.h"
 #include "user_config.h"
+#include "alerts.h"
 #include "ds18b20.h"
+#include "display.h"
 #include "http.h"
 #include "ntp.h"
+#include "power.h"
+#include "publisher.h"
+#include "sampler.h"
+#include "startup.h"
 #include "tm1637.h"
+#include "temperature_filter.h"
 #include "temperature_tracker.h"
 
 const int LED = 2;
 
-os_timer_t read_timer;
-uint8_t ucDisplayTaskParams;
 DS18B20_Sensors sensors;
 
 
 void blinkLedOnce();
-void displayTemp(float tempCelcius);
-void tempDisplayTask(void *pvParameters);
+static void networkTask(void *pvParameters);
 
 
+// Startup is staged so that a reading is shown within a second of power-on,
+// whether or not WiFi comes up. The display and sensor are set up here, and
+// the network, HTTP server and NTP in their own tasks. See startup.h.
 void app_main() {
-  ds18b20_setup(&sensors);
-  service_init();
-  init_ntp();
+  startupInit();
 
   tm1637Init();
   tm1637SetBrightness(8);
+  tm1637StartTask();
+  displayInit();
+  startupMark(STARTUP_DISPLAY);
+
+  // The sensor setup reads its cache from NVS.
+  ESP_ERROR_CHECK(nvs_flash_init());
+  ds18b20_setup(&sensors);
+  tempFilterInit();
+  startupMark(STARTUP_SENSOR);
+
+  // After deep sleep, carry on with the day's extremes.
+  restoreCurrentPeriod();
+  // Before the sampler, which queues messages for them. Reads NVS.
+  alertsStart();
+  publisherStart();
+  // Runs above the display task, so that sampling never waits on the display.
+  samplerStart();
 
   TaskHandle_t xHandle = NULL;
-  xTaskCreate(tempDisplayTask, "tempDisplayTask", 4096, &ucDisplayTaskParams,
-              tskIDLE_PRIORITY, &xHandle);
+  xTaskCreate(networkTask, "networkTask", 4096, NULL, tskIDLE_PRIORITY,
+              &xHandle);
   configASSERT(xHandle);
+  // Waits for the network by itself.
+  init_ntp();
 
   //  while (true) {
   //    float tempCelcius = ds18b2_get_temperature();
@@ -63,34 +87,12 @@ void app_main() {
   //  }
 }
 
-void tempDisplayTask(void *pvParameters) {
-//  int q = 0;
-//  u32 timePeriodBufSize = 32;
-//  s8 timePeriodBuf[timePeriodBufSize];
-//
-  while (true) {
-//    q += 1;
-//    snprintf(timePeriodBuf, timePeriodBufSize, "%d", q );
-    float tempCelcius = ds18b2_get_temperature(&sensors);
-    registerTemp(tempCelcius);
-    displayTemp(tempCelcius);
-    vTaskDelay(pdMS_TO_TICKS(1000));
-  }
-}
-
-void displayTemp(float tempCelcius) {
-  u8 s[4];
-  int v = (int)(tempCelcius * 10);
-
-  for (int i = 0; i < 4; ++i) {
-    if (i == 1) {
-      s[i] = 0x10; // space
-    } else {
-      s[i] = (u8)(v % 10);
-      v /= 10;
-    }
-  }
-  tm1637DisplaySegments(s);
+// Connecting can take many seconds, or block until WiFi is back.
+static void networkTask(void *pvParameters) {
+  network_init();
+  powerStart();
+  http_start();
+  vTaskDelete(NULL);
 }
 
 // LED
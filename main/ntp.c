@@ -9,11 +9,13 @@
 #include "int_types.h"
 #include "user_config.h"
 #include "ntp.h"
+#include "startup.h"
 
 time_t now = 0;
 s8 strftime_buf[64];
 uint8_t ucNtpUpdateTaskParams;
 void getLocalNow(struct tm *timeinfo);
+void getLocalAt(time_t t, struct tm *timeinfo);
 void NtpUpdateTask(void *pvParameters);
 void time_sync_notification_cb(struct timeval *tv);
 
@@ -64,14 +66,9 @@ void time_sync_notification_cb(struct timeval *tv);
   Also tried doing the setting in main.c.
 */
 
+// Start the NTP task. SNTP is started by the task once the network is up, so
+// this can be called before connecting.
 void init_ntp() {
-  INFO("Initializing SNTP\n");
-
-  sntp_setoperatingmode(SNTP_OPMODE_POLL);
-  sntp_setservername(0, "pool.ntp.org");
-  sntp_set_time_sync_notification_cb(time_sync_notification_cb);
-  sntp_init();
-
   TaskHandle_t xHandle = NULL;
   xTaskCreate(NtpUpdateTask, "NtpUpdateTask", 2048, &ucNtpUpdateTaskParams,
               tskIDLE_PRIORITY, &xHandle);
@@ -82,6 +79,17 @@ bool haveTime() {
   return now != 0;
 }
 
+// Advance `now` to the current system time. `now` is only set directly from
+// NTP once an hour, so without this every timestamp within the hour would be
+// the same. Call before each sample.
+void updateNow() {
+  if (haveTime()) {
+    time(&now);
+  }
+}
+
+time_t getNow() { return now; }
+
 s8 *getCurrentLocalDateTime() {
   // Was unable to get timezone support working (see other notes in this file).
   // So, just doing a quick-n-dirty subtract of 6 hours from UTC to get MDT
@@ -106,7 +114,31 @@ s8 *getCurrentLocalTime() {
   return strftime_buf;
 }
 
+// Same as getCurrentLocalDate() and getCurrentLocalTime(), but for a time
+// other than now. Used for samples taken before the first NTP sync.
+s8 *getLocalDateAt(time_t t) {
+  struct tm timeinfo;
+  getLocalAt(t, &timeinfo);
+  strftime(strftime_buf, sizeof(strftime_buf), "%Y-%m-%d", &timeinfo);
+  return strftime_buf;
+}
+
+s8 *getLocalTimeAt(time_t t) {
+  struct tm timeinfo;
+  getLocalAt(t, &timeinfo);
+  strftime(strftime_buf, sizeof(strftime_buf), "%H:%M:%S", &timeinfo);
+  return strftime_buf;
+}
+
 void NtpUpdateTask(void *pvParameters) {
+  startupWait(STARTUP_NETWORK, portMAX_DELAY);
+
+  INFO("Initializing SNTP\n");
+  sntp_setoperatingmode(SNTP_OPMODE_POLL);
+  sntp_setservername(0, "pool.ntp.org");
+  sntp_set_time_sync_notification_cb(time_sync_notification_cb);
+  sntp_init();
+
   while (true) {
     // wait for time to be set
     struct tm timeinfo = {0};
@@ -118,17 +150,25 @@ void NtpUpdateTask(void *pvParameters) {
            retry_count);
       vTaskDelay(pdMS_TO_TICKS(1000));
     }
+    if (retry == retry_count && !haveTime()) {
+      // The system clock is still counting from 1970. Don't use it.
+      continue;
+    }
 
     time(&now);
     localtime_r(&now, &timeinfo);
+    startupMark(STARTUP_TIME);
 
-    INFO("Time received from NTP server: %s\n", getCurrentLocalDateTime());
+    INFO_TEXT("Time received from NTP server: %s\n",
+              getCurrentLocalDateTime());
     vTaskDelay(pdMS_TO_TICKS(60 * 60 * 1000));
   }
 }
 
-void getLocalNow(struct tm *timeinfo) {
-  time_t mdt = now - 6 * 60 * 60;
+void getLocalNow(struct tm *timeinfo) { getLocalAt(now, timeinfo); }
+
+void getLocalAt(time_t t, struct tm *timeinfo) {
+  time_t mdt = t - 6 * 60 * 60;
   localtime_r(&mdt, timeinfo);
 }
 
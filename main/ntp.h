@@ -8,9 +8,13 @@ extern "C" {
 
 void init_ntp();
 bool haveTime();
+void updateNow();
+time_t getNow();
 s8* getCurrentLocalDateTime();
 s8* getCurrentLocalDate();
 s8* getCurrentLocalTime();
+s8* getLocalDateAt(time_t t);
+s8* getLocalTimeAt(time_t t);
 
 #ifdef __cplusplus
 } // extern "C"
@@ -1,20 +1,65 @@
 // Based on various snippets in the public domain.
 
 #include "driver/gpio.h"
+#include "driver/soc.h"
+#include "esp8266/eagle_soc.h"
 #include "os.h"
 #include "rom/ets_sys.h"
+#include "sdkconfig.h"
 #include "xtensa/xtruntime.h"
 
+#include "user_config.h"
 #include "onewire.h"
 
-// For dev board
-//#define ONEWIRE_PIN 14ULL
-// For deploying on a bare-bones board, like the ESP-01
-#define ONEWIRE_PIN 2ULL
-
-
-void release();
-void lowPulse(u16 lengthUsec);
+#define ONEWIRE_PIN CONFIG_ONEWIRE_PIN
+
+// GPIO16 is an RTC pin, and is not in the GPIO registers used below.
+_Static_assert(ONEWIRE_PIN < 16, "The onewire pin must be GPIO0-15");
+#define ONEWIRE_MASK (1 << ONEWIRE_PIN)
+
+// The pin is open drain, so it's always an output: writing 0 pulls the bus
+// low, and writing 1 releases it to the pull-up. The input register shows
+// the bus level either way. Register writes take a single store, where the
+// GPIO driver calls took long enough to skew the slot timing.
+#define BUS_LOW() GPIO_REG_WRITE(GPIO_OUT_W1TC_ADDRESS, ONEWIRE_MASK)
+#define BUS_RELEASE() GPIO_REG_WRITE(GPIO_OUT_W1TS_ADDRESS, ONEWIRE_MASK)
+#define BUS_LEVEL() ((GPIO_REG_READ(GPIO_IN_ADDRESS) & ONEWIRE_MASK) != 0)
+
+// Slot timing, in microseconds from the falling edge that starts the slot.
+// A read slot must be sampled within 15 us.
+#define WRITE_ONE_LOW_US 6
+#define WRITE_ZERO_LOW_US 60
+#define READ_LOW_US 3
+#define READ_SAMPLE_US 12
+#define SLOT_US 65
+
+// A wait within a slot, worked out by onewire_calibrate(), so that there's
+// no division to do while interrupts are masked.
+struct onewire_wait {
+  // From the cycle counter at the falling edge.
+  u32 cycles;
+  // Left to the ROM delay, with the last microseconds spun on the counter.
+  u32 delay_us;
+};
+
+// The timing above in CPU cycles, measured at boot by onewire_calibrate().
+// Edges and samples are timed from the cycle counter at the falling edge,
+// so the time spent between them doesn't add up.
+struct onewire_timing {
+  u32 cycles_per_us;
+  // Cycles from reading the counter to the pin changing.
+  u32 edge_cycles;
+  struct onewire_wait write_one_low;
+  struct onewire_wait write_zero_low;
+  struct onewire_wait read_low;
+  struct onewire_wait read_sample;
+};
+
+static struct onewire_timing timing;
+
+static void onewire_calibrate();
+static void wait_until(u32 start, u32 cycles);
+static void wait_for(u32 start, const struct onewire_wait *w);
 
 // Configure a GPIO pin for use in the onewire protocol. The pin is open
 // drain with pull-up.
@@ -27,29 +72,60 @@ void onewire_init() {
   io_conf.pull_up_en = 1;
   gpio_config(&io_conf);
 
-  release();
+  BUS_RELEASE();
+  if (!timing.cycles_per_us) {
+    onewire_calibrate();
+  }
+}
+
+// A wait until us after the falling edge, that starts at from_us. As in
+// wait_until(), the ROM delay stops short of it.
+static void make_wait(struct onewire_wait *w, u32 us, u32 from_us) {
+  w->cycles = us * timing.cycles_per_us - timing.edge_cycles;
+  w->delay_us = us - from_us > 2 ? us - from_us - 2 : 0;
 }
 
-// Release the output. If nothing on the bus is pulling it down, it will be high
-// due to pull-up.
-void release() {
-  //  INFO("Release\n");
-  gpio_set_direction(ONEWIRE_PIN, GPIO_MODE_OUTPUT_OD);
-  gpio_set_level(ONEWIRE_PIN, 1);
+// Measure the CPU clock against the ROM delay, which works at either CPU
+// frequency, and the cost of an edge, and convert the slot timing to cycles.
+static void onewire_calibrate() {
+  u32 start = soc_get_ccount();
+  os_delay_us(1000);
+  timing.cycles_per_us = (soc_get_ccount() - start + 500) / 1000;
+
+  // Releasing the bus while it's released is harmless.
+  start = soc_get_ccount();
+  for (u8 i = 0; i < 16; ++i) {
+    soc_get_ccount();
+    BUS_RELEASE();
+  }
+  timing.edge_cycles = (soc_get_ccount() - start) / 16;
+
+  make_wait(&timing.write_one_low, WRITE_ONE_LOW_US, 0);
+  make_wait(&timing.write_zero_low, WRITE_ZERO_LOW_US, 0);
+  make_wait(&timing.read_low, READ_LOW_US, 0);
+  make_wait(&timing.read_sample, READ_SAMPLE_US, READ_LOW_US);
+  INFO("Onewire timing: %d cycles/us, %d cycles/edge\n", timing.cycles_per_us,
+       timing.edge_cycles);
 }
 
-void lowPulse(u16 lengthUsec) {
-  gpio_set_direction(ONEWIRE_PIN, GPIO_MODE_OUTPUT_OD);
-  gpio_set_level(ONEWIRE_PIN, 0);
-  os_delay_us(lengthUsec);
-  release();
+// Busy wait until the given number of cycles after start. The ROM delay
+// covers most of the wait, and the cycle counter the last microseconds.
+static void wait_until(u32 start, u32 cycles) {
+  s32 left = (s32)(start + cycles - soc_get_ccount());
+  if (left > (s32)(2 * timing.cycles_per_us)) {
+    os_delay_us(left / timing.cycles_per_us - 1);
+  }
+  while ((s32)(start + cycles - soc_get_ccount()) > 0) {
+  }
 }
 
-int getLevel() {
-  //  INFO("getLevel: %d\n", level);
-  gpio_set_direction(ONEWIRE_PIN, GPIO_MODE_INPUT);
-  int level = gpio_get_level(ONEWIRE_PIN);
-  return level;
+// The same, for the waits in a slot, while interrupts are masked.
+static void wait_for(u32 start, const struct onewire_wait *w) {
+  if (w->delay_us) {
+    os_delay_us(w->delay_us);
+  }
+  while ((s32)(start + w->cycles - soc_get_ccount()) > 0) {
+  }
 }
 
 // Reset the search state
@@ -64,10 +140,9 @@ void onewire_init_search_state(struct onewire_search_state *state) {
 // and we return a 0;
 // Returns 1 if a device asserted a presence pulse, 0 otherwise.
 u32 onewire_reset() {
-  //  INFO("onewire_reset()\n");
   u32 result;
   u8 retries = 125;
-  release();
+  BUS_RELEASE();
   // Wait for the bus to get high (which it should because of the pull-up
   // resistor).
   do {
@@ -75,78 +150,85 @@ u32 onewire_reset() {
       return 0;
     }
     os_delay_us(2);
-  } while (!getLevel());
-  // Transmit the reset pulse by pulling the bus low for at least 480 us.
-  lowPulse(500);
+  } while (!BUS_LEVEL());
+  // Transmit the reset pulse by pulling the bus low for at least 480 us. A
+  // longer pulse is still a reset, so interrupts can stay enabled.
+  BUS_LOW();
+  os_delay_us(500);
   // Release the bus, and wait, then check for a presence pulse, which should
   // start 15-60 us after the reset, and will last 60-240 us.
   // So 65us after the reset the bus must be high.
+  uint32_t savedLevel = XTOS_DISABLE_ALL_INTERRUPTS;
+  BUS_RELEASE();
   os_delay_us(65);
-  result = !getLevel();
-  //  INFO("Reset result: %d\n", result);
+  result = !BUS_LEVEL();
+  XTOS_RESTORE_INTLEVEL(savedLevel);
   // After sending the reset pulse, the master (we) must wait at least another
   // 480 us.
   os_delay_us(490);
   return result;
 }
 
-// Write a byte. The writing code uses the active drivers to raise the
-// pin high, if you need power after the write (e.g. DS18S20 in
-// parasite power mode) then set 'power' to 1, otherwise the pin will
-// go tri-state at the end of the write to avoid heating in a short or
-// other mishap.
+// Write a byte. Each slot ends with the bus released, so it is left high by
+// the pull-up, which also powers sensors in parasite power mode. 'power' is
+// kept for compatibility.
 void onewire_write_byte(u8 v, u32 power) {
-  uint32_t savedLevel = XTOS_DISABLE_ALL_INTERRUPTS;
   u8 bitMask;
   for (bitMask = 0x01; bitMask; bitMask <<= 1) {
     onewire_write_bit((bitMask & v) ? 1 : 0);
   }
-  if (power) {
-    release();
-  }
-  XTOS_RESTORE_INTLEVEL(savedLevel);
 }
 
-// Write a bit. Port and bit is used to cut lookup time and provide
-// more certain timing.
+// Write a bit. Interrupts are disabled only while the bus is low, where an
+// interrupt would change the meaning of the slot. The recovery time after it
+// may get longer without harm.
 void onewire_write_bit(u32 v) {
   uint32_t savedLevel = XTOS_DISABLE_ALL_INTERRUPTS;
-  if (v) {
-    lowPulse(10);
-    os_delay_us(55);
-  } else {
-    lowPulse(65);
-    os_delay_us(5);
-  }
+  u32 start = soc_get_ccount();
+  BUS_LOW();
+  wait_for(start, v ? &timing.write_one_low : &timing.write_zero_low);
+  BUS_RELEASE();
   XTOS_RESTORE_INTLEVEL(savedLevel);
+  wait_until(start, SLOT_US * timing.cycles_per_us);
 }
 
 u8 onewire_read_byte() {
-  uint32_t savedLevel = XTOS_DISABLE_ALL_INTERRUPTS;
   u8 bitMask;
   u8 r = 0;
   for (bitMask = 0x01; bitMask; bitMask <<= 1) {
     if (onewire_read_bit())
       r |= bitMask;
   }
-  XTOS_RESTORE_INTLEVEL(savedLevel);
   return r;
 }
 
+// Read a bit. Interrupts are disabled from the start of the slot until the
+// bus is sampled.
 u32 onewire_read_bit() {
-  // Nested XTOS_DISABLE_ALL_INTERRUPTS appears to work as expected.
-  uint32_t savedLevel = XTOS_DISABLE_ALL_INTERRUPTS;
   u32 r;
-  lowPulse(3);
-  os_delay_us(10);
-  r = getLevel();
-  os_delay_us(53);
+  uint32_t savedLevel = XTOS_DISABLE_ALL_INTERRUPTS;
+  u32 start = soc_get_ccount();
+  BUS_LOW();
+  wait_for(start, &timing.read_low);
+  BUS_RELEASE();
+  wait_for(start, &timing.read_sample);
+  r = BUS_LEVEL();
   XTOS_RESTORE_INTLEVEL(savedLevel);
+  wait_until(start, SLOT_US * timing.cycles_per_us);
   return r;
 }
 
 /* pass array of 8 bytes in */
 u32 onewire_search(struct onewire_search_state *state) {
+  return onewire_search_cmd(state, ONEWIRE_SEARCH_ROM);
+}
+
+// Search for devices with an alarm condition only.
+u32 onewire_alarm_search(struct onewire_search_state *state) {
+  return onewire_search_cmd(state, ONEWIRE_ALARMSEARCH);
+}
+
+u32 onewire_search_cmd(struct onewire_search_state *state, u8 cmd) {
   //  INFO("onewire_search() %d\n", 0);
   // If last search returned the last device (no conflicts).
   if (state->lastDeviceFlag) {
@@ -161,7 +243,7 @@ u32 onewire_search(struct onewire_search_state *state) {
   }
 
   // issue the search command
-  onewire_write_byte(ONEWIRE_SEARCH_ROM, 0);
+  onewire_write_byte(cmd, 0);
 
   u8 search_direction;
   s32 last_zero = -1;
@@ -236,7 +318,7 @@ u32 onewire_search(struct onewire_search_state *state) {
 }
 
 // Do a ROM select
-void onewire_select(const u8 *rom) {
+void onewire_select(const u8 rom[8]) {
   u8 i = 0;
   onewire_write_byte(ONEWIRE_MATCH_ROM, 0); // Choose ROM
   for (i = 0; i < 8; i++) {
@@ -37,6 +37,8 @@ u8 onewire_read_byte();
 u32 onewire_read_bit();
 
 u32 onewire_search(struct onewire_search_state* state);
+u32 onewire_alarm_search(struct onewire_search_state* state);
+u32 onewire_search_cmd(struct onewire_search_state* state, u8 cmd);
 void onewire_select(const u8 rom[8]);
 void onewire_rom_skip();
 
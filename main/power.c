@@ -0,0 +1,102 @@
+// Low-power mode. See power.h.
+//
+// The light sleep itself is FreeRTOS's: with CONFIG_ENABLE_FREERTOS_SLEEP,
+// the idle task sleeps until the next task is due, so there's nothing to do
+// here but keep the tasks blocked, and count what keeps them awake.
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+#include "sdkconfig.h"
+
+#include "int_types.h"
+#include "user_config.h"
+#include "ds18b20.h"
+#include "power.h"
+
+#ifdef CONFIG_POWER_SAVE_ENABLED
+
+// Supply current of a DS18B20 while converting, from the datasheet.
+#define CONVERSION_UA 1000
+
+extern DS18B20_Sensors sensors;
+
+static PowerStats stats;
+// Counted so far in the current cycle, and when it started.
+static u32 awakeUs = 0;
+static s64 cycleStartUs = 0;
+
+void powerStart() {
+#ifdef CONFIG_POWER_WIFI_MAX_MODEM
+  esp_err_t err = esp_wifi_set_ps(WIFI_PS_MAX_MODEM);
+#else
+  esp_err_t err = esp_wifi_set_ps(WIFI_PS_MIN_MODEM);
+#endif
+  if (err != ESP_OK) {
+    INFO("Unable to set WiFi sleep mode. err=%d\n", err);
+  }
+}
+
+void powerAwake(u32 us) {
+  taskENTER_CRITICAL();
+  awakeUs += us;
+  taskEXIT_CRITICAL();
+}
+
+// Average current over a cycle, in uA, with the CPU awake for awake of it.
+// Each sensor converts for part of every cycle.
+static u32 estimateUa(u64 awake, u64 cycle, u32 cycles) {
+  if (!cycle) {
+    return 0;
+  }
+  if (awake > cycle) {
+    awake = cycle;
+  }
+  u64 conversion = (u64)DS18B20_CONVERSION_MS * 1000 * cycles;
+  if (conversion > cycle) {
+    conversion = cycle;
+  }
+  u64 charge = awake * CONFIG_POWER_ACTIVE_UA +
+               (cycle - awake) * CONFIG_POWER_SLEEP_UA +
+               conversion * CONVERSION_UA * sensors.count;
+  return (u32)(charge / cycle) + CONFIG_POWER_RADIO_UA;
+}
+
+void powerCycle() {
+  s64 now = esp_timer_get_time();
+  taskENTER_CRITICAL();
+  u32 awake = awakeUs;
+  awakeUs = 0;
+  taskEXIT_CRITICAL();
+  if (!cycleStartUs) {
+    // The time before the first cycle is startup, not a sample cycle.
+    cycleStartUs = now;
+    return;
+  }
+  u32 cycle = (u32)(now - cycleStartUs);
+  cycleStartUs = now;
+
+  ++stats.cycles;
+  stats.lastAwakeUs = awake;
+  stats.lastCycleUs = cycle;
+  if (awake > stats.maxAwakeUs) {
+    stats.maxAwakeUs = awake;
+  }
+  stats.totalAwakeUs += awake;
+  stats.totalCycleUs += cycle;
+  stats.lastCurrentUa = estimateUa(awake, cycle, 1);
+  stats.meanCurrentUa =
+      estimateUa(stats.totalAwakeUs, stats.totalCycleUs, stats.cycles);
+}
+
+const PowerStats *powerGetStats() { return &stats; }
+
+#else
+
+void powerStart() {}
+void powerAwake(u32 us) {}
+void powerCycle() {}
+const PowerStats *powerGetStats() { return NULL; }
+
+#endif
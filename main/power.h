@@ -0,0 +1,47 @@
+#pragma once
+
+#include "int_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Low-power mode, with CONFIG_POWER_SAVE_ENABLED, for battery-backed units.
+//
+// The CPU light-sleeps whenever every task is blocked, which is most of each
+// sample cycle: the conversion runs while the sampler waits for its next
+// deadline (see sampler.c), and the display and publisher only wake when
+// there's something to do. The WiFi radio sleeps between beacons, waking for
+// every DTIM beacon or every listen interval, see CONFIG_POWER_WIFI_SLEEP.
+//
+// The tasks that busy-wait, the sampler on the 1-Wire bus and the display
+// on the TM1637, count the time they keep the CPU awake. From the awake
+// fraction of each sample cycle, and the currents in the configuration,
+// comes an estimate of the average supply current. HTTP requests and the
+// display's LEDs aren't counted.
+
+typedef struct {
+  u32 cycles;
+  // Awake time counted in the last complete cycle, and its length.
+  u32 lastAwakeUs;
+  u32 lastCycleUs;
+  u32 maxAwakeUs;
+  u64 totalAwakeUs;
+  u64 totalCycleUs;
+  // Estimated average current of the last cycle, and of all of them.
+  u32 lastCurrentUa;
+  u32 meanCurrentUa;
+} PowerStats;
+
+// Set the WiFi sleep mode. Call once connected.
+void powerStart();
+// Count time that a task kept the CPU awake, towards the current cycle.
+void powerAwake(u32 us);
+// Close the cycle and start the next. Call from the sampler, as it wakes.
+void powerCycle();
+// Null if the low-power mode is disabled.
+const PowerStats *powerGetStats();
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
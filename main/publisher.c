@@ -0,0 +1,363 @@
+// Push samples and closed days to a UDP collector. See publisher.h for the
+// protocol.
+//
+// Sending is stop-and-wait: one packet, then up to ACK_TIMEOUT_MS for its
+// acknowledgement, which is plenty for a few messages a minute. While the
+// collector doesn't answer, or the network is down, messages accumulate in
+// the outbox, and retries back off up to MAX_BACKOFF_S. When a batch is
+// acknowledged and more is queued, the next packet goes right away, so a
+// backlog drains at a packet per round trip. An alert is sent as soon as
+// it's queued, without waiting for the batch, or for a retry's backoff.
+
+#include <stdio.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "lwip/netdb.h"
+#include "lwip/sockets.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+
+#include "int_types.h"
+#include "user_config.h"
+#include "ntp.h"
+#include "publisher.h"
+#include "startup.h"
+#include "temperature_tracker.h"
+
+#ifdef CONFIG_PUBLISH_ENABLED
+
+#define OUTBOX_BYTES CONFIG_PUBLISH_OUTBOX_BYTES
+#define BATCH_TICKS pdMS_TO_TICKS(CONFIG_PUBLISH_BATCH_S * 1000)
+// Fits in a single Ethernet frame, so that packets are never fragmented.
+#define MAX_PACKET_BYTES 512
+#define MAX_HEADER_BYTES 80
+#define MAX_MESSAGE_BYTES 192
+#define MAX_ACK_BYTES 64
+#define ACK_TIMEOUT_MS 1000
+#define ACK_POLL_MS 50
+#define MAX_BACKOFF_S 64
+
+_Static_assert(OUTBOX_BYTES >= MAX_PACKET_BYTES,
+               "CONFIG_PUBLISH_OUTBOX_BYTES must hold a full packet");
+
+// Queued messages, each ending with '\n', oldest first. The first has
+// sequence number firstSeq.
+static s8 outbox[OUTBOX_BYTES];
+static size_t outboxLen = 0;
+static u32 outboxMessages = 0;
+static u32 firstSeq = 0;
+// When the outbox last went from empty to not.
+static TickType_t pendingSince = 0;
+// The sequence number of the latest alert, and when it was queued, while
+// it hasn't been sent. 0 if there's none.
+static u32 alertSeq = 0;
+static s64 alertQueuedUs = 0;
+
+// Closed records queued so far, see getClosedCount().
+static u32 queuedClosed = 0;
+static time_t lastSampleSlot = 0;
+
+static PublisherStats stats;
+static TaskHandle_t task = NULL;
+static volatile bool networkUp = false;
+// Set when the network comes back, to retry right away.
+static volatile bool retryNow = false;
+static const s8 *collectorHost = CONFIG_PUBLISH_HOST;
+static u16 collectorPort = CONFIG_PUBLISH_PORT;
+static s8 deviceId[13];
+static u32 bootId;
+
+static void publisherTask(void *pvParameters);
+
+// Call in a critical section.
+static void dropFirst() {
+  size_t n = (const s8 *)memchr(outbox, '\n', outboxLen) - outbox + 1;
+  memmove(outbox, outbox + n, outboxLen - n);
+  outboxLen -= n;
+  --outboxMessages;
+  ++firstSeq;
+}
+
+// Queue a message, making room by dropping the oldest ones.
+static void queue(const s8 *msg, size_t len) {
+  taskENTER_CRITICAL();
+  while (outboxLen && outboxLen + len > OUTBOX_BYTES) {
+    dropFirst();
+    ++stats.dropped;
+  }
+  if (!outboxLen) {
+    pendingSince = xTaskGetTickCount();
+  }
+  memcpy(outbox + outboxLen, msg, len);
+  outboxLen += len;
+  ++outboxMessages;
+  ++stats.queued;
+  taskEXIT_CRITICAL();
+}
+
+static void dropAcked(u32 ack) {
+  taskENTER_CRITICAL();
+  while (outboxMessages && (s32)(ack - firstSeq) > 0) {
+    dropFirst();
+    ++stats.acked;
+  }
+  taskEXIT_CRITICAL();
+}
+
+// The header, then as many whole messages from the start of the outbox as
+// fit. Returns the length, 0 if the outbox is empty, and the sequence number
+// after the last message.
+static size_t buildPacket(s8 *buf, u32 *endSeq) {
+  taskENTER_CRITICAL();
+  size_t len = 0;
+  u32 seq = firstSeq;
+  *endSeq = seq;
+  while (len < outboxLen) {
+    const s8 *end = memchr(outbox + len, '\n', outboxLen - len);
+    size_t n = end - (outbox + len) + 1;
+    if (len + n > MAX_PACKET_BYTES - MAX_HEADER_BYTES) {
+      break;
+    }
+    len += n;
+    ++*endSeq;
+  }
+  size_t headerLen = 0;
+  if (len) {
+    headerLen = snprintf(buf, MAX_HEADER_BYTES,
+                         "{ \"device\": \"%s\", \"boot\": \"%08x\", "
+                         "\"seq\": %u }\n",
+                         deviceId, bootId, seq);
+    memcpy(buf + headerLen, outbox, len);
+  }
+  taskEXIT_CRITICAL();
+  return len ? headerLen + len : 0;
+}
+
+// A batch is due when the oldest message has waited long enough, a packet
+// is full, or an alert is waiting.
+static bool batchDue() {
+  taskENTER_CRITICAL();
+  bool due = outboxLen &&
+             ((TickType_t)(xTaskGetTickCount() - pendingSince) >=
+                  BATCH_TICKS ||
+              outboxLen >= MAX_PACKET_BYTES - MAX_HEADER_BYTES ||
+              alertQueuedUs);
+  taskEXIT_CRITICAL();
+  return due;
+}
+
+static int openSocket(struct sockaddr_in *collector) {
+  struct addrinfo hints = {0};
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_DGRAM;
+  struct addrinfo *info = NULL;
+  if (getaddrinfo(collectorHost, NULL, &hints, &info) || !info) {
+    INFO_TEXT("Can't resolve collector %s\n", collectorHost);
+    return -1;
+  }
+  *collector = *(struct sockaddr_in *)info->ai_addr;
+  collector->sin_port = htons(collectorPort);
+  freeaddrinfo(info);
+  return socket(AF_INET, SOCK_DGRAM, 0);
+}
+
+// Wait for the acknowledgement of this boot's messages. Acks are polled
+// for, instead of blocking in recvfrom(), so that the task keeps to the
+// RTOS delays.
+static bool waitAck(int sock, u32 *ack) {
+  s8 buf[MAX_ACK_BYTES];
+  for (u32 waitedMs = 0; waitedMs < ACK_TIMEOUT_MS; waitedMs += ACK_POLL_MS) {
+    vTaskDelay(pdMS_TO_TICKS(ACK_POLL_MS));
+    int n;
+    while ((n = recvfrom(sock, buf, sizeof(buf) - 1, MSG_DONTWAIT, NULL,
+                         NULL)) > 0) {
+      buf[n] = '\0';
+      unsigned boot;
+      unsigned seq;
+      if (sscanf(buf, "{ \"boot\": \"%8x\", \"ack\": %u }", &boot, &seq) ==
+              2 &&
+          boot == bootId) {
+        *ack = seq;
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+void publisherStart() {
+  u8 mac[6];
+  esp_read_mac(mac, ESP_MAC_WIFI_STA);
+  snprintf(deviceId, sizeof(deviceId), "%02x%02x%02x%02x%02x%02x", mac[0],
+           mac[1], mac[2], mac[3], mac[4], mac[5]);
+  bootId = esp_random();
+  memset(&stats, 0, sizeof(stats));
+  // Days already in the history, e.g. restored ones, aren't published.
+  queuedClosed = getClosedCount();
+
+  xTaskCreate(publisherTask, "publisherTask", 4096, NULL, tskIDLE_PRIORITY,
+              &task);
+  configASSERT(task);
+}
+
+void publisherSample(Temp16 temp) {
+  s8 msg[MAX_MESSAGE_BYTES];
+  s8 line[MAX_MESSAGE_BYTES - 16];
+  // Closed days first, so that a day's last sample follows its record.
+  for (u32 closed = getClosedCount(); queuedClosed < closed; ++queuedClosed) {
+    if (getClosedLine(queuedClosed, line, sizeof(line))) {
+      queue(msg, snprintf(msg, sizeof(msg), "{ \"day\": %s }\n", line));
+    }
+  }
+#if CONFIG_PUBLISH_SAMPLE_PERIOD_S > 0
+  if (!haveTime()) {
+    return;
+  }
+  time_t now = getNow();
+  time_t slot = now / CONFIG_PUBLISH_SAMPLE_PERIOD_S;
+  if (slot == lastSampleSlot) {
+    return;
+  }
+  lastSampleSlot = slot;
+  s8 tempStr[10];
+  temp16Format(tempStr, sizeof(tempStr), temp);
+  queue(msg, snprintf(msg, sizeof(msg),
+                      "{ \"sample\": { \"time\": %ld, \"temp\": \"%s\" } }\n",
+                      (long)now, tempStr));
+#endif
+}
+
+void publisherAlert(const s8 *alert) {
+  s8 msg[MAX_MESSAGE_BYTES];
+  int len = snprintf(msg, sizeof(msg), "{ \"alert\": %s }\n", alert);
+  if (len >= (int)sizeof(msg)) {
+    return;
+  }
+  queue(msg, len);
+  taskENTER_CRITICAL();
+  alertSeq = firstSeq + outboxMessages - 1;
+  if (!alertQueuedUs) {
+    alertQueuedUs = esp_timer_get_time();
+  }
+  ++stats.alerts;
+  taskEXIT_CRITICAL();
+  retryNow = true;
+  if (task) {
+    xTaskNotifyGive(task);
+  }
+}
+
+// Record how long the alert waited, once a packet with it has been sent.
+static void alertSent(u32 endSeq) {
+  taskENTER_CRITICAL();
+  if (alertQueuedUs && (s32)(endSeq - alertSeq) > 0) {
+    u32 waitedUs = (u32)(esp_timer_get_time() - alertQueuedUs);
+    stats.lastAlertWaitUs = waitedUs;
+    if (waitedUs > stats.maxAlertWaitUs) {
+      stats.maxAlertWaitUs = waitedUs;
+    }
+    alertQueuedUs = 0;
+  }
+  taskEXIT_CRITICAL();
+}
+
+void publisherSetNetworkUp(bool up) {
+  networkUp = up;
+  if (up) {
+    retryNow = true;
+    if (task) {
+      xTaskNotifyGive(task);
+    }
+  }
+}
+
+void publisherSetCollector(const s8 *host, u16 port) {
+  collectorHost = host;
+  collectorPort = port;
+}
+
+const PublisherStats *publisherGetStats() {
+  stats.outboxBytes = outboxLen;
+  stats.outboxMessages = outboxMessages;
+  return &stats;
+}
+
+static void publisherTask(void *pvParameters) {
+  startupWait(STARTUP_NETWORK, portMAX_DELAY);
+  networkUp = true;
+
+  int sock = -1;
+  struct sockaddr_in collector;
+  s8 packet[MAX_PACKET_BYTES];
+  u32 backoffS = 0;
+  TickType_t retryAt = 0;
+  bool more = false;
+  while (true) {
+    if (!more) {
+      ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(1000));
+    }
+    more = false;
+    if (retryNow) {
+      retryNow = false;
+      backoffS = 0;
+    }
+    if (!networkUp || (backoffS && (s32)(xTaskGetTickCount() - retryAt) < 0) ||
+        !batchDue()) {
+      continue;
+    }
+
+    u32 endSeq;
+    size_t len = buildPacket(packet, &endSeq);
+    bool acked = false;
+    if (sock < 0) {
+      sock = openSocket(&collector);
+    }
+    if (sock >= 0 && sendto(sock, packet, len, 0,
+                            (struct sockaddr *)&collector,
+                            sizeof(collector)) == (int)len) {
+      ++stats.packets;
+      alertSent(endSeq);
+      u32 ack;
+      acked = waitAck(sock, &ack);
+      if (acked) {
+        dropAcked(ack);
+        stats.lastAckMs = (u32)(esp_timer_get_time() / 1000);
+      } else {
+        ++stats.ackTimeouts;
+      }
+    } else {
+      ++stats.sendErrors;
+      // Look the collector up again next time.
+      if (sock >= 0) {
+        close(sock);
+        sock = -1;
+      }
+    }
+
+    if (acked) {
+      backoffS = 0;
+      more = outboxMessages != 0;
+    } else {
+      backoffS = backoffS ? backoffS * 2 : 1;
+      if (backoffS > MAX_BACKOFF_S) {
+        backoffS = MAX_BACKOFF_S;
+      }
+      retryAt = xTaskGetTickCount() + pdMS_TO_TICKS(backoffS * 1000);
+      INFO("No ack from collector. Retrying in %u s\n", backoffS);
+    }
+  }
+}
+
+#else
+
+void publisherStart() {}
+void publisherSample(Temp16 temp) {}
+void publisherAlert(const s8 *alert) {}
+void publisherSetNetworkUp(bool up) {}
+void publisherSetCollector(const s8 *host, u16 port) {}
+const PublisherStats *publisherGetStats() { return NULL; }
+
+#endif
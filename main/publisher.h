@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "int_types.h"
+#include "temperature.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Push samples and closed days to a collector over UDP, with
+// CONFIG_PUBLISH_ENABLED, so that a central system doesn't have to poll
+// every thermometer.
+//
+// Messages are queued in a RAM outbox and sent in batches. Each packet is
+// text: a header line, then one message per line, all JSON:
+//
+//   { "device": "5ccf7f0a1b2c", "boot": "1a2b3c4d", "seq": 120 }
+//   { "sample": { "time": 1700000000, "temp": "21.50" } }
+//   { "day": { "period": "2023-11-14", "minTime": ... } }
+//   { "alert": { "sensor": 0, "kind": "high", "event": "raised", ... } }
+//
+// device is the station MAC, boot is random per boot, and seq is the
+// sequence number of the first message, counting up from 0 at boot. The
+// collector answers each packet with the sequence number it expects next:
+//
+//   { "boot": "1a2b3c4d", "ack": 122 }
+//
+// Messages stay queued until acknowledged, and a packet always starts with
+// the oldest queued message, so a gap in seq means messages were dropped
+// because the outbox was full. Resent messages have the same seq, for the
+// collector to skip. Alerts are sent right away, without waiting for the
+// batch. See host/udp_collector.cpp.
+
+typedef struct {
+  u32 queued;
+  u32 acked;
+  // Dropped from a full outbox before they were acknowledged.
+  u32 dropped;
+  u32 packets;
+  u32 ackTimeouts;
+  // Failed lookups of the collector, or sends.
+  u32 sendErrors;
+  u32 outboxBytes;
+  u32 outboxMessages;
+  // Time since boot of the last acknowledgement, 0 if none yet.
+  u32 lastAckMs;
+  // Alerts queued, and how long they waited to be sent.
+  u32 alerts;
+  u32 lastAlertWaitUs;
+  u32 maxAlertWaitUs;
+} PublisherStats;
+
+void publisherStart();
+// Queue the sample, if one is due, and the days closed since the last call.
+// Call from the sampler after registerTemp().
+void publisherSample(Temp16 temp);
+// Queue an alert, a JSON object, and send it right away. See alerts.h.
+void publisherAlert(const s8 *alert);
+// From the WiFi event handlers. Nothing is sent while the network is down,
+// and the outbox is sent as soon as it's back.
+void publisherSetNetworkUp(bool up);
+// Defaults to CONFIG_PUBLISH_HOST and CONFIG_PUBLISH_PORT. The host must
+// outlive the publisher.
+void publisherSetCollector(const s8 *host, u16 port);
+// Null if publishing is disabled.
+const PublisherStats *publisherGetStats();
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,216 @@
+// Take temperature samples at a fixed rate.
+//
+// Deadlines are absolute (vTaskDelayUntil), so the sample period does not
+// drift with the time spent on processing. The conversion for the next
+// sample is started right after reading the previous one, so it runs while we
+// process the result and sleep, instead of blocking the task for 750 ms.
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+
+#include <string.h>
+
+#include "int_types.h"
+#include "user_config.h"
+#include "alerts.h"
+#include "display.h"
+#include "ds18b20.h"
+#include "ntp.h"
+#include "power.h"
+#include "publisher.h"
+#include "sampler.h"
+#include "startup.h"
+#include "temperature.h"
+#include "temperature_filter.h"
+#include "temperature_tracker.h"
+
+#define SAMPLE_PERIOD_TICKS pdMS_TO_TICKS(CONFIG_SAMPLE_PERIOD_MS)
+// The tick count is read after the conversion starts, which may be up to a
+// tick after the tick began, hence the extra one.
+#define CONVERSION_TICKS (pdMS_TO_TICKS(DS18B20_CONVERSION_MS) + 1)
+
+#define RESCAN_PERIOD_TICKS pdMS_TO_TICKS(CONFIG_DS18B20_RESCAN_PERIOD_S * 1000)
+// Bus time for a search, per sensor found. Measured with the 1-Wire
+// simulator (host/onewire_bench).
+#define SEARCH_MS_PER_SENSOR 15
+
+// Sensors checked for alerts. The first is read for every sample anyway.
+#ifdef CONFIG_ALERTS_ENABLED
+#define ALERT_SENSORS CONFIG_ALERT_SENSORS
+#else
+#define ALERT_SENSORS 0
+#endif
+#define PLAUSIBLE_MIN TEMP16_FROM_C(CONFIG_TEMP_PLAUSIBLE_MIN)
+#define PLAUSIBLE_MAX TEMP16_FROM_C(CONFIG_TEMP_PLAUSIBLE_MAX)
+
+_Static_assert(CONFIG_SAMPLE_PERIOD_MS > DS18B20_CONVERSION_MS,
+               "Sample period must be longer than a DS18B20 conversion");
+
+extern DS18B20_Sensors sensors;
+
+static SamplerStats samplerStats;
+static uint8_t ucSamplerTaskParams;
+#if ALERT_SENSORS > 1
+static Temp16 alertTemps[ALERT_SENSORS];
+#endif
+
+static void samplerTask(void *pvParameters);
+static void processSample(Temp16 temp);
+static void maybeRescan(TickType_t lastWake);
+static void alarmScan();
+static void readAlertSensors();
+static void checkAlertSensors();
+static void recordLateness(s64 latenessUs);
+
+void samplerStart() {
+  memset(&samplerStats, 0, sizeof(samplerStats));
+
+  TaskHandle_t xHandle = NULL;
+  xTaskCreate(samplerTask, "samplerTask", 4096, &ucSamplerTaskParams,
+              tskIDLE_PRIORITY + 1, &xHandle);
+  configASSERT(xHandle);
+}
+
+const SamplerStats *samplerGetStats() { return &samplerStats; }
+
+void samplerResetWindow() { samplerStats.windowMaxLatenessUs = 0; }
+
+static void samplerTask(void *pvParameters) {
+  ds18b20_start_conversion(&sensors);
+  vTaskDelay(pdMS_TO_TICKS(DS18B20_CONVERSION_MS));
+
+  TickType_t lastWake = xTaskGetTickCount();
+  const TickType_t baseTick = lastWake;
+  const s64 baseUs = esp_timer_get_time();
+
+  while (true) {
+    s64 deadlineUs =
+        baseUs + (s64)(lastWake - baseTick) * portTICK_PERIOD_MS * 1000;
+    s64 wakeUs = esp_timer_get_time();
+    recordLateness(wakeUs - deadlineUs);
+    powerCycle();
+
+    // Read the conversion started in the previous cycle, and start the next
+    // one before doing anything else.
+    Temp16 temp = ds18b20_read_temperature(&sensors);
+    readAlertSensors();
+    alarmScan();
+    maybeRescan(lastWake);
+    ds18b20_start_conversion(&sensors);
+    TickType_t conversionStart = xTaskGetTickCount();
+    updateNow();
+    processSample(temp);
+
+    // If we've overrun, skip ahead to the next deadline that's still in the
+    // future, and that leaves the conversion its time, instead of taking a
+    // burst of back-to-back samples, which would read the scratchpad before
+    // the conversion is done.
+    TickType_t now = xTaskGetTickCount();
+    while ((TickType_t)(now - lastWake) >= SAMPLE_PERIOD_TICKS ||
+           (TickType_t)(lastWake + SAMPLE_PERIOD_TICKS - conversionStart) <
+               CONVERSION_TICKS) {
+      lastWake += SAMPLE_PERIOD_TICKS;
+      ++samplerStats.missedDeadlines;
+      INFO("Missed sample deadline. missed=%d\n", samplerStats.missedDeadlines);
+    }
+    // Mostly the 1-Wire reads, which busy-wait through each time slot.
+    powerAwake((u32)(esp_timer_get_time() - wakeUs));
+    vTaskDelayUntil(&lastWake, SAMPLE_PERIOD_TICKS);
+  }
+}
+
+// Update the per sensor extremes, reading only the sensors that may have a
+// new one. Starts over when the date changes.
+static void alarmScan() {
+#ifdef CONFIG_DS18B20_ALARM_MODE
+  static s8 period[16] = "";
+  if (haveTime() && strcmp(period, getCurrentLocalDate())) {
+    strncpy(period, getCurrentLocalDate(), sizeof(period) - 1);
+    ds18b20_alarm_new_period(&sensors);
+  }
+  ds18b20_alarm_scan(&sensors);
+#endif
+}
+
+// Read the other sensors that are checked for alerts, from the conversion
+// that the first was read from.
+static void readAlertSensors() {
+#if ALERT_SENSORS > 1
+  for (u8 i = 1; i < ALERT_SENSORS; ++i) {
+    alertTemps[i] =
+        i < sensors.count ? ds18b20_read(&sensors, i) : TEMP16_INVALID;
+  }
+#endif
+}
+
+// They don't go through the outlier filter, which follows the first sensor
+// only. The alerts' minimum duration rides out the odd glitch instead.
+static void checkAlertSensors() {
+#if ALERT_SENSORS > 1
+  for (u8 i = 1; i < ALERT_SENSORS; ++i) {
+    Temp16 t = alertTemps[i];
+    if (t != TEMP16_INVALID && t >= PLAUSIBLE_MIN && t <= PLAUSIBLE_MAX) {
+      alertsSample(i, t);
+    }
+  }
+#endif
+}
+
+// Search the bus for added or removed sensors, if it's time, and if the
+// search and the following conversion can both complete before the next
+// deadline.
+static void maybeRescan(TickType_t lastWake) {
+#if CONFIG_DS18B20_RESCAN_PERIOD_S > 0
+  static TickType_t lastRescan = 0;
+  TickType_t now = xTaskGetTickCount();
+  if ((TickType_t)(now - lastRescan) < RESCAN_PERIOD_TICKS) {
+    return;
+  }
+  TickType_t searchTicks =
+      pdMS_TO_TICKS(SEARCH_MS_PER_SENSOR * (sensors.count + 1));
+  TickType_t elapsed = now - lastWake;
+  if (elapsed + searchTicks + pdMS_TO_TICKS(DS18B20_CONVERSION_MS) >=
+      SAMPLE_PERIOD_TICKS) {
+    return;
+  }
+  lastRescan = now;
+  ds18b20_rescan(&sensors);
+#endif
+}
+
+static void processSample(Temp16 temp) {
+  s64 startUs = esp_timer_get_time();
+  bool sensorOk = tempFilterAccept(temp);
+  if (sensorOk) {
+    registerTemp(temp);
+    alertsSample(0, temp);
+    publisherSample(temp);
+  }
+  checkAlertSensors();
+  displayUpdate(temp, sensorOk);
+  if (sensorOk) {
+    startupMark(STARTUP_FIRST_SAMPLE);
+  }
+
+  u32 processUs = (u32)(esp_timer_get_time() - startUs);
+  samplerStats.lastProcessUs = processUs;
+  samplerStats.totalProcessUs += processUs;
+  if (processUs > samplerStats.maxProcessUs) {
+    samplerStats.maxProcessUs = processUs;
+  }
+}
+
+static void recordLateness(s64 latenessUs) {
+  u32 lateness = latenessUs > 0 ? (u32)latenessUs : 0;
+  ++samplerStats.cycles;
+  samplerStats.lastLatenessUs = lateness;
+  samplerStats.totalLatenessUs += lateness;
+  if (lateness > samplerStats.maxLatenessUs) {
+    samplerStats.maxLatenessUs = lateness;
+  }
+  if (lateness > samplerStats.windowMaxLatenessUs) {
+    samplerStats.windowMaxLatenessUs = lateness;
+  }
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "int_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+  u32 cycles;
+  // Cycles that started a full period or more after their deadline. The
+  // skipped samples are not made up for.
+  u32 missedDeadlines;
+  // How late each cycle woke up, relative to its deadline.
+  u32 lastLatenessUs;
+  u32 maxLatenessUs;
+  u64 totalLatenessUs;
+  // The max since samplerResetWindow(), for measuring over a given time.
+  u32 windowMaxLatenessUs;
+  // Time from a reading to the filter, tracker and display being updated.
+  u32 lastProcessUs;
+  u32 maxProcessUs;
+  u64 totalProcessUs;
+} SamplerStats;
+
+void samplerStart();
+const SamplerStats *samplerGetStats();
+void samplerResetWindow();
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,48 @@
+// Readiness and timing of the startup stages.
+//
+// Each stage runs in its own task, or in app_main(), and marks itself as
+// reached here. Tasks that depend on another stage wait for it on the event
+// group, instead of app_main() running the stages one after another.
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "esp_timer.h"
+
+#include "int_types.h"
+#include "user_config.h"
+#include "startup.h"
+
+static EventGroupHandle_t startupEvents = NULL;
+static u32 stageMs[STARTUP_STAGE_COUNT];
+
+static const char *stageNames[STARTUP_STAGE_COUNT] = {
+    "display", "sensor", "firstSample", "network", "http", "time",
+};
+
+void startupInit() {
+  startupEvents = xEventGroupCreate();
+  configASSERT(startupEvents);
+}
+
+void startupMark(StartupStage stage) {
+  if (startupReached(stage)) {
+    return;
+  }
+  stageMs[stage] = (u32)(esp_timer_get_time() / 1000);
+  xEventGroupSetBits(startupEvents, 1 << stage);
+  INFO("Startup: %s after %d ms\n", stageNames[stage], stageMs[stage]);
+}
+
+bool startupReached(StartupStage stage) {
+  return (xEventGroupGetBits(startupEvents) & (1 << stage)) != 0;
+}
+
+bool startupWait(StartupStage stage, TickType_t ticks) {
+  EventBits_t bits =
+      xEventGroupWaitBits(startupEvents, 1 << stage, pdFALSE, pdTRUE, ticks);
+  return (bits & (1 << stage)) != 0;
+}
+
+u32 startupGetMs(StartupStage stage) { return stageMs[stage]; }
+
+const char *startupStageName(StartupStage stage) { return stageNames[stage]; }
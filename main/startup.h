@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "freertos/FreeRTOS.h"
+
+#include "int_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Startup stages, in the order they're expected to complete. The sensor and
+// display stages don't depend on the network, which may take a long time or
+// never come up.
+typedef enum {
+  STARTUP_DISPLAY,
+  STARTUP_SENSOR,
+  STARTUP_FIRST_SAMPLE,
+  STARTUP_NETWORK,
+  STARTUP_HTTP,
+  STARTUP_TIME,
+  STARTUP_STAGE_COUNT,
+} StartupStage;
+
+void startupInit();
+void startupMark(StartupStage stage);
+bool startupReached(StartupStage stage);
+// Block until the stage is reached, or the timeout. Returns true if reached.
+bool startupWait(StartupStage stage, TickType_t ticks);
+// Time since boot when the stage was reached.
+u32 startupGetMs(StartupStage stage);
+const char *startupStageName(StartupStage stage);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
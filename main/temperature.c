@@ -0,0 +1,56 @@
+// Integer helpers for temperatures in 1/16 C.
+
+#include <ctype.h>
+#include <stdio.h>
+
+#include "int_types.h"
+#include "temperature.h"
+
+int temp16ToDeciC(Temp16 t) {
+  int v = t < 0 ? -t : t;
+  // 10/16 of a degree per step, plus a half step for rounding.
+  int d = (v * 10 + 8) >> 4;
+  return t < 0 ? -d : d;
+}
+
+// Each 1/16 is 6.25 hundredths, so the hundredths have a fraction of 0, 1/4,
+// 1/2 or 3/4. Halves round to even, as printf does for the exact binary value.
+int temp16Format(s8 *buf, size_t maxLen, Temp16 t) {
+  int v = t < 0 ? -t : t;
+  int quarters = v * 25;
+  int hundredths = quarters >> 2;
+  int rem = quarters & 3;
+  if (rem > 2 || (rem == 2 && (hundredths & 1))) {
+    ++hundredths;
+  }
+  return snprintf(buf, maxLen, "%s%d.%02d", t < 0 ? "-" : "", hundredths / 100,
+                  hundredths % 100);
+}
+
+// Each 1/16 is 6.25 hundredths, so the nearest is (hundredths * 4 + 12) / 25,
+// which gets back what temp16Format() formatted.
+bool temp16Parse(const s8 *s, Temp16 *t) {
+  bool negative = *s == '-';
+  if (negative) {
+    ++s;
+  }
+  if (!isdigit((int)*s)) {
+    return false;
+  }
+  int hundredths = 0;
+  while (isdigit((int)*s) && hundredths < 100000) {
+    hundredths = hundredths * 10 + (*s++ - '0') * 100;
+  }
+  if (*s == '.') {
+    ++s;
+    for (int scale = 10; scale && isdigit((int)*s); scale /= 10) {
+      hundredths += (*s++ - '0') * scale;
+    }
+  }
+  if (*s || hundredths >= 100000) {
+    return false;
+  }
+  int v = (hundredths * 4 + 12) / 25;
+  *t = (Temp16)(negative ? -v : v);
+  return true;
+}
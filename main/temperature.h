@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "int_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Temperature in 1/16 C, the resolution of the DS18B20 and the format of
+// its temperature register. Used on the whole sample path, so that the
+// ESP8266 (no FPU) doesn't have to do soft-float math for every sample.
+typedef s16 Temp16;
+
+// Failed read. Far outside the DS18B20 range of -55 to 125 C.
+#define TEMP16_INVALID ((Temp16)-0x8000)
+#define TEMP16_MIN ((Temp16)-0x7fff)
+#define TEMP16_MAX ((Temp16)0x7fff)
+
+// Whole and tenths of a degree, for configuration values.
+#define TEMP16_FROM_C(c) ((Temp16)((c) * 16))
+#define TEMP16_FROM_DECI_C(dc) ((Temp16)((dc) * 16 / 10))
+
+// For callers that want degrees, e.g. logging. Not used on the sample path.
+static inline float temp16ToCelcius(Temp16 t) { return t / 16.0f; }
+
+// Tenths of a degree, rounded half away from zero.
+int temp16ToDeciC(Temp16 t);
+
+// Format with two decimals, the same as "%.02f" would for t / 16.0. Returns
+// the length, like snprintf.
+int temp16Format(s8 *buf, size_t maxLen, Temp16 t);
+// The reverse, for degrees with up to two decimals, to the nearest 1/16.
+// Returns false if s isn't such a number, or is out of range.
+bool temp16Parse(const s8 *s, Temp16 *t);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,103 @@
+// Streaming outlier filter for temperature readings.
+//
+// A reading is first checked against the configured plausible range. It is
+// then compared against the median of the most recent readings (Hampel
+// filter), and rejected if it deviates by more than 3 scaled median absolute
+// deviations. This rejects the occasional bogus value we get from the onewire
+// bus without having to run another 750 ms conversion.
+
+#include <string.h>
+
+#include "os.h"
+#include "sdkconfig.h"
+
+#include "int_types.h"
+#include "user_config.h"
+#include "temperature.h"
+#include "temperature_filter.h"
+
+#define WINDOW_SIZE CONFIG_TEMP_FILTER_WINDOW
+#define PLAUSIBLE_MIN TEMP16_FROM_C(CONFIG_TEMP_PLAUSIBLE_MIN)
+#define PLAUSIBLE_MAX TEMP16_FROM_C(CONFIG_TEMP_PLAUSIBLE_MAX)
+#define MIN_DEVIATION TEMP16_FROM_DECI_C(CONFIG_TEMP_FILTER_MIN_DEVIATION)
+// 3 * 1.4826, where 1.4826 scales the MAD to a standard deviation estimate
+// for normally distributed noise. In 1/1024, so that scaling is a multiply
+// and a shift (the ESP8266 has no divide instruction).
+#define HAMPEL_SCALE_1024 4555
+
+static Temp16 window[WINDOW_SIZE];
+static u8 windowCount;
+static u8 windowNext;
+static TempFilterStats filterStats;
+
+static Temp16 median(Temp16 *v, u8 n);
+
+void tempFilterInit() {
+  windowCount = 0;
+  windowNext = 0;
+  memset(&filterStats, 0, sizeof(filterStats));
+}
+
+// Return true if the reading should be used. Plausible readings go into the
+// window even when rejected as outliers, so that a real step change is
+// accepted once it dominates the window.
+bool tempFilterAccept(Temp16 temp) {
+  if (temp == TEMP16_INVALID || temp < PLAUSIBLE_MIN || temp > PLAUSIBLE_MAX) {
+    ++filterStats.rejectedImplausible;
+    INFO("Rejected implausible temperature: %d/16 C\n", temp);
+    return false;
+  }
+
+  bool accept = true;
+  // Need a few readings before the median means anything.
+  if (windowCount >= 3) {
+    Temp16 sorted[WINDOW_SIZE];
+    memcpy(sorted, window, windowCount * sizeof(Temp16));
+    s32 med = median(sorted, windowCount);
+    for (u8 i = 0; i < windowCount; ++i) {
+      s32 dev = window[i] - med;
+      sorted[i] = (Temp16)(dev < 0 ? -dev : dev);
+    }
+    s32 threshold = (median(sorted, windowCount) * HAMPEL_SCALE_1024) >> 10;
+    if (threshold < MIN_DEVIATION) {
+      threshold = MIN_DEVIATION;
+    }
+    s32 d = temp - med;
+    accept = (d < 0 ? -d : d) <= threshold;
+  }
+
+  window[windowNext] = temp;
+  windowNext = (windowNext + 1) % WINDOW_SIZE;
+  if (windowCount < WINDOW_SIZE) {
+    ++windowCount;
+  }
+
+  if (accept) {
+    ++filterStats.accepted;
+  } else {
+    ++filterStats.rejectedOutlier;
+    INFO("Rejected outlier temperature: %d/16 C\n", temp);
+  }
+  return accept;
+}
+
+const TempFilterStats *tempFilterGetStats() { return &filterStats; }
+
+// Median by insertion sort. Sorts v in place. The window is small enough
+// that this beats anything fancier. The mean of the middle two, for an even
+// count, is rounded down.
+static Temp16 median(Temp16 *v, u8 n) {
+  for (int i = 1; i < n; ++i) {
+    Temp16 x = v[i];
+    int j = i - 1;
+    while (j >= 0 && v[j] > x) {
+      v[j + 1] = v[j];
+      --j;
+    }
+    v[j + 1] = x;
+  }
+  if (n & 1) {
+    return v[n / 2];
+  }
+  return (Temp16)((v[n / 2 - 1] + v[n / 2]) >> 1);
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "int_types.h"
+#include "temperature.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+  u32 accepted;
+  // Failed read or outside the configured plausible range.
+  u32 rejectedImplausible;
+  // Too far from the median of the recent readings.
+  u32 rejectedOutlier;
+} TempFilterStats;
+
+void tempFilterInit();
+bool tempFilterAccept(Temp16 temp);
+const TempFilterStats *tempFilterGetStats();
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -1,85 +1,849 @@
-//#include "freertos/FreeRTOS.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_attr.h"
+#include "esp_timer.h"
 #include "os.h"
-#include <esp_heap_caps.h>
+#include "sdkconfig.h"
 
-#include <cfloat>
-#include <string>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
 #include <vector>
 
 // Including iostream causes some kind of infinite recursion stack allocation havoc.
 //#include <iostream>
 
+#include "alloc_stats.h"
+#include "deflate.h"
 #include "int_types.h"
 #include "user_config.h"
 #include "ntp.h"
+#include "temperature.h"
 #include "temperature_tracker.h"
 
+// "YYYY-MM-DD" and "HH:MM:SS", with the terminator. The strings are kept in
+// the record, so that a record is the only allocation per day.
+const size_t PERIOD_LENGTH = 11;
+const size_t TIME_LENGTH = 9;
+
 class MinMaxTemp {
 public:
-  explicit MinMaxTemp(std::string &s) { periodStr = s; }
-  //  s8 TEST[1024];
-  std::string periodStr;
-  float minTemp = FLT_MAX_EXP;
-  std::string minTime;
-  float maxTemp = FLT_MIN_EXP;
-  std::string maxTime;
+  explicit MinMaxTemp(const s8 *s) {
+    snprintf(periodStr, sizeof(periodStr), "%s", s);
+  }
+  s8 periodStr[PERIOD_LENGTH];
+  s8 minTime[TIME_LENGTH] = "";
+  s8 maxTime[TIME_LENGTH] = "";
+  Temp16 minTemp = TEMP16_MAX;
+  Temp16 maxTemp = TEMP16_MIN;
+};
+
+const size_t MAX_RECORDS = CONFIG_TRACKER_MAX_DAYS;
+
+// The history is allocated once, at the first record, and never grows past
+// this. How many days are kept only depends on CONFIG_TRACKER_MAX_DAYS, not
+// on what else is using the heap at the time.
+const size_t BUDGET_BYTES = sizeof(MinMaxTemp) * MAX_RECORDS;
+
+// The ESP8266 has 80 KB of data RAM, shared with WiFi, lwIP, the task stacks
+// and the HTTP server. The history gets at most a third of it.
+const size_t DRAM_BYTES = 80 * 1024;
+static_assert(BUDGET_BYTES <= DRAM_BYTES / 3,
+              "CONFIG_TRACKER_MAX_DAYS doesn't fit in DRAM");
+
+size_t usedBytes = 0;
+u32 droppedRecords = 0;
+// Closed records are numbered from boot, see getClosedCount(). The oldest
+// one kept follows the imported days, see importDay().
+u32 firstClosed = 0;
+size_t importedRecords = 0;
+// Bumped whenever the history changes, for the HTTP ETag.
+u32 version = 0;
+// Bumped whenever records move to other indices: the oldest is dropped, or
+// a day is imported before others. See getMinMaxLineSince().
+u32 shifts = 0;
+
+// Closed days never change, so their JSON lines are rendered once, when the
+// day closes, and kept in a byte buffer for the HTTP handler to stream. The
+// cache holds the most recent closed days that fit, each with its ",\n"
+// separator. Older days are formatted on request, as is the current one.
+//
+// With CONFIG_HTTP_GZIP, a second cache holds the codes of the same lines
+// deflated, each against the line before it (see deflate.h), packed bit
+// after bit. The line before is always sent first, cached or not, except
+// when it's dropped from the history.
+const size_t RENDER_CACHE_BYTES = CONFIG_TRACKER_RENDER_CACHE_BYTES;
+const size_t RENDER_LINE_LENGTH = 256;
+static_assert(RENDER_CACHE_BYTES <= DRAM_BYTES / 4,
+              "CONFIG_TRACKER_RENDER_CACHE_BYTES doesn't fit in DRAM");
+
+struct LineCache {
+  size_t capacity;
+  // Allocated with the first closed day.
+  s8 *buf;
+  // The deflated cache counts lengths and positions in bits, as its lines
+  // don't end on byte boundaries, and the rendered one in bytes.
+  bool inBits;
+  size_t len;
+  // Position of buf[0] in all the bits or bytes ever cached. Readers hold
+  // positions, so that they can tell if what they were reading was trimmed.
+  u32 base;
+  // Where the first line starts in buf, less than a byte in.
+  size_t start;
+  // The cached lines are for records [from, from + count), which always
+  // ends at the current record.
+  size_t from;
+  size_t count;
+  // Length of each cached line, oldest first. Rendered lines end with '\n'
+  // instead.
+  u16 *lens;
+  // Length and CRC-32 of the lines before deflating.
+  u32 plainBytes;
+  u32 plainCrc;
+};
+
+LineCache rendered = {RENDER_CACHE_BYTES, nullptr, false, 0, 0, 0, 0, 0,
+                      nullptr, 0, 0};
+
+#ifdef CONFIG_HTTP_GZIP
+const size_t GZIP_CACHE_BYTES = CONFIG_HTTP_GZIP_CACHE_BYTES;
+static_assert(GZIP_CACHE_BYTES <= DRAM_BYTES / 8,
+              "CONFIG_HTTP_GZIP_CACHE_BYTES doesn't fit in DRAM");
+u16 deflatedLens[MAX_RECORDS];
+LineCache deflated = {GZIP_CACHE_BYTES, nullptr, true, 0, 0, 0, 0, 0,
+                      deflatedLens, 0, 0};
+// Most bits readDeflated() copies at once, to keep the critical section
+// short.
+const u32 DEFLATED_READ_BITS = 1024;
+#endif
+
+// Allocate the history from the tracker's budget, and count it in the
+// allocation stats.
+template <class T> struct BudgetAllocator {
+  typedef T value_type;
+
+  BudgetAllocator() = default;
+  template <class U> BudgetAllocator(const BudgetAllocator<U> &) {}
+
+  T *allocate(size_t n) {
+    size_t bytes = n * sizeof(T);
+    T *p = nullptr;
+    if (usedBytes + bytes <= BUDGET_BYTES) {
+      p = static_cast<T *>(allocTraced(ALLOC_TRACKER, bytes));
+    }
+    if (!p) {
+      // Not INFO(), since the log ring is lost with the abort.
+      os_printf("Tracker allocation failed. bytes=%u used=%u budget=%u\n",
+                (u32)bytes, (u32)usedBytes, (u32)BUDGET_BYTES);
+      abort();
+    }
+    usedBytes += bytes;
+    return p;
+  }
+
+  void deallocate(T *p, size_t n) {
+    usedBytes -= n * sizeof(T);
+    freeTraced(ALLOC_TRACKER, p, n * sizeof(T));
+  }
 };
 
-std::vector<MinMaxTemp> minMaxVec;
+template <class T, class U>
+bool operator==(const BudgetAllocator<T> &, const BudgetAllocator<U> &) {
+  return true;
+}
+template <class T, class U>
+bool operator!=(const BudgetAllocator<T> &, const BudgetAllocator<U> &) {
+  return false;
+}
+
+std::vector<MinMaxTemp, BudgetAllocator<MinMaxTemp>> minMaxVec;
+
+// Extremes of samples taken before the first NTP sync, by seconds since boot.
+// They are filed under their local dates once the time is known.
+struct PreSyncBucket {
+  u32 startS;
+  u32 minS;
+  u32 maxS;
+  Temp16 minTemp;
+  Temp16 maxTemp;
+};
+
+const size_t PRESYNC_BUCKETS = CONFIG_TRACKER_PRESYNC_BUCKETS;
+const u32 PRESYNC_FIRST_SPAN_S = 60;
+
+PreSyncBucket preSync[PRESYNC_BUCKETS];
+size_t preSyncCount = 0;
+u32 preSyncSpanS = PRESYNC_FIRST_SPAN_S;
+
+// The current period, mirrored in RTC memory, which keeps it through deep
+// sleep, for restoreCurrentPeriod(). It's garbage after power-on, hence the
+// CRC. Written only when an extreme changes. RTC memory only takes 32-bit
+// accesses, so the mirror is an array of words, copied a word at a time.
+struct RtcPeriod {
+  u32 magic;
+  s8 periodStr[PERIOD_LENGTH];
+  s8 minTime[TIME_LENGTH];
+  s8 maxTime[TIME_LENGTH];
+  Temp16 minTemp;
+  Temp16 maxTemp;
+  u32 crc;
+};
+
+const u32 RTC_PERIOD_MAGIC = 0x4d4d5401;
+const size_t RTC_PERIOD_WORDS = sizeof(RtcPeriod) / sizeof(u32);
+static_assert(sizeof(RtcPeriod) % sizeof(u32) == 0,
+              "RtcPeriod must be whole words for RTC memory");
+
+RTC_DATA_ATTR u32 rtcPeriod[RTC_PERIOD_WORDS];
+
+void writeRtcPeriod(const RtcPeriod &p) {
+  u32 words[RTC_PERIOD_WORDS];
+  memcpy(words, &p, sizeof(p));
+  volatile u32 *rtc = rtcPeriod;
+  for (size_t i = 0; i < RTC_PERIOD_WORDS; ++i) {
+    rtc[i] = words[i];
+  }
+}
+
+void readRtcPeriod(RtcPeriod *p) {
+  u32 words[RTC_PERIOD_WORDS];
+  const volatile u32 *rtc = rtcPeriod;
+  for (size_t i = 0; i < RTC_PERIOD_WORDS; ++i) {
+    words[i] = rtc[i];
+  }
+  memcpy(p, words, sizeof(*p));
+}
+
+void saveRtcPeriod(const MinMaxTemp &cur) {
+  // Built whole, padding included, so that the CRC covers known bytes.
+  RtcPeriod p;
+  memset(&p, 0, sizeof(p));
+  p.magic = RTC_PERIOD_MAGIC;
+  memcpy(p.periodStr, cur.periodStr, sizeof(p.periodStr));
+  memcpy(p.minTime, cur.minTime, sizeof(p.minTime));
+  memcpy(p.maxTime, cur.maxTime, sizeof(p.maxTime));
+  p.minTemp = cur.minTemp;
+  p.maxTemp = cur.maxTemp;
+  p.crc = crc32Update(0, &p, offsetof(RtcPeriod, crc));
+  writeRtcPeriod(p);
+}
+
+// Held while changing the history, and by the sampler's task while reading
+// it, as imports change it from the HTTP server's task, which can preempt
+// the sampler in the middle of a sample. Created by the first call, which is
+// from app_main(), before the other tasks start.
+SemaphoreHandle_t historyLock = nullptr;
+
+void lockHistory() {
+  if (!historyLock) {
+    historyLock = xSemaphoreCreateMutex();
+    configASSERT(historyLock);
+  }
+  xSemaphoreTake(historyLock, portMAX_DELAY);
+}
+
+void unlockHistory() { xSemaphoreGive(historyLock); }
+
+u32 getUptimeS() { return (u32)(esp_timer_get_time() / 1000000); }
+
+// Render a record's JSON line with its ",\n" separator. Returns the length.
+size_t renderLine(s8 *buf, size_t idx) {
+  getMinMaxLine(buf, RENDER_LINE_LENGTH - 2, idx);
+  size_t len = strlen(buf);
+  memcpy(buf + len, ",\n", 3);
+  return len + 2;
+}
+
+// Bytes that len bits or bytes of a cache take.
+size_t cacheBytes(const LineCache &c, size_t len) {
+  return c.inBits ? (len + 7) / 8 : len;
+}
+
+// Drop the oldest line of a cache. For the deflated cache, the CRC of what
+// remains is worked out from the dropped line, before the critical section.
+void trimCache(LineCache &c) {
+  u32 plainBytes = 0;
+  u32 plainCrc = 0;
+  if (c.lens) {
+    s8 line[RENDER_LINE_LENGTH];
+    u32 lineLen = renderLine(line, c.from);
+    plainBytes = c.plainBytes - lineLen;
+    plainCrc = crc32Combine(crc32Update(0, line, lineLen), c.plainCrc,
+                            plainBytes);
+  }
+
+  taskENTER_CRITICAL();
+  size_t n = c.lens ? c.lens[0]
+                    : (const s8 *)memchr(c.buf, '\n', c.len) - c.buf + 1;
+  // Only whole bytes are moved out.
+  size_t unit = c.inBits ? 8 : 1;
+  size_t dropBytes = (c.start + n) / unit;
+  memmove(c.buf, c.buf + dropBytes, cacheBytes(c, c.len) - dropBytes);
+  if (c.lens) {
+    memmove(c.lens, c.lens + 1, (c.count - 1) * sizeof(c.lens[0]));
+  }
+  c.start += n - dropBytes * unit;
+  c.len -= dropBytes * unit;
+  c.base += dropBytes * unit;
+  ++c.from;
+  --c.count;
+  c.plainBytes = plainBytes;
+  c.plainCrc = plainCrc;
+  taskEXIT_CRITICAL();
+}
+
+// Append the line for record idx, making room by dropping the oldest lines.
+// plainLen and crc are of the line before deflating, and only used for the
+// deflated cache.
+void appendCache(LineCache &c, size_t idx, const void *data, size_t len,
+                 size_t plainLen, u32 crc) {
+  while (c.count && cacheBytes(c, c.len + len) > c.capacity) {
+    trimCache(c);
+  }
+  if (!c.buf && c.capacity) {
+    c.buf = (s8 *)allocTraced(ALLOC_TRACKER, c.capacity);
+  }
+  u32 plainCrc = 0;
+  if (c.lens) {
+    plainCrc = c.count ? crc32Combine(c.plainCrc, crc, plainLen) : crc;
+  }
+
+  taskENTER_CRITICAL();
+  if (c.buf && cacheBytes(c, c.len + len) <= c.capacity) {
+    if (!c.count) {
+      c.from = idx;
+      c.plainBytes = 0;
+    }
+    if (c.inBits) {
+      // Carry on from the bits of the last, partial byte.
+      u32 held = c.len % 8;
+      BitWriter w = {(u8 *)c.buf + c.len / 8, 0, c.capacity - c.len / 8,
+                     held ? (u8)c.buf[c.len / 8] & ((1u << held) - 1) : 0u,
+                     held, false};
+      copyBits(&w, (const u8 *)data, 0, len);
+      flushBits(&w);
+    } else {
+      memcpy(c.buf + c.len, data, len);
+    }
+    if (c.lens) {
+      c.lens[c.count] = (u16)len;
+    }
+    c.len += len;
+    ++c.count;
+    c.plainBytes += plainLen;
+    c.plainCrc = plainCrc;
+  } else {
+    c.from = idx + 1;
+  }
+  taskEXIT_CRITICAL();
+}
+
+// Cache the line of a closed record, after those of the records before it.
+void cacheLine(size_t idx) {
+  // The line before, then this one, as the deflate window.
+  s8 window[RENDER_LINE_LENGTH * 2];
+  size_t dictLen = idx ? renderLine(window, idx - 1) : 0;
+  size_t len = renderLine(window + dictLen, idx);
+  appendCache(rendered, idx, window + dictLen, len, len, 0);
+#ifdef CONFIG_HTTP_GZIP
+  u8 out[DEFLATE_DATA_BOUND(RENDER_LINE_LENGTH)];
+  BitWriter w = {out, 0, sizeof(out), 0, 0, false};
+  deflateData(&w, (const u8 *)window, dictLen, len);
+  u32 bits = bitsWritten(&w);
+  flushBits(&w);
+  appendCache(deflated, idx, out, bits, len,
+              crc32Update(0, window + dictLen, len));
+#endif
+}
+
+// Cache the current record, which has just closed.
+void cacheClosed() { cacheLine(minMaxVec.size() - 1); }
+
+// Empty a cache whose lines no longer match their records. Positions carry
+// on counting, so that a reader holding one finds its bytes dropped.
+void clearCache(LineCache &c) {
+  taskENTER_CRITICAL();
+  c.base += cacheBytes(c, c.len) * (c.inBits ? 8 : 1);
+  c.len = 0;
+  c.start = 0;
+  c.from = minMaxVec.empty() ? 0 : minMaxVec.size() - 1;
+  c.count = 0;
+  c.plainBytes = 0;
+  c.plainCrc = 0;
+  taskEXIT_CRITICAL();
+}
+
+// Cache the lines of all closed records again, as many as fit.
+void rebuildCache() {
+  clearCache(rendered);
+#ifdef CONFIG_HTTP_GZIP
+  clearCache(deflated);
+#endif
+  for (size_t i = 0; i + 1 < minMaxVec.size(); ++i) {
+    cacheLine(i);
+  }
+}
+
+// The oldest record is about to be dropped. Drop its cached lines, and move
+// the others down.
+void dropOldestCached(LineCache &c) {
+  if (c.from == 0 && c.count) {
+    trimCache(c);
+  }
+  // The next line was deflated against the one being dropped, and becomes
+  // the first line sent.
+  if (c.lens && c.from == 1 && c.count) {
+    trimCache(c);
+  }
+  taskENTER_CRITICAL();
+  --c.from;
+  taskEXIT_CRITICAL();
+}
+
+void dropOldest() {
+  dropOldestCached(rendered);
+#ifdef CONFIG_HTTP_GZIP
+  dropOldestCached(deflated);
+#endif
+  minMaxVec.erase(minMaxVec.begin());
+  ++droppedRecords;
+  ++shifts;
+  if (importedRecords) {
+    --importedRecords;
+  } else {
+    ++firstClosed;
+  }
+}
+
+// Add the temp to the period, creating the period if it's not the one that
+// was added last.
+void registerTempIn(Temp16 temp, const s8 *period, const s8 *time) {
+  if (minMaxVec.empty() || strcmp(minMaxVec.back().periodStr, period)) {
+    INFO_TEXT("Adding new MinMaxTemp. periodStr=\"%s\"\n", period);
+    if (!minMaxVec.empty()) {
+      cacheClosed();
+    }
+    // Allocate the whole history once, so that it's never reallocated, which
+    // would need room for two copies.
+    minMaxVec.reserve(MAX_RECORDS);
+    if (minMaxVec.size() == MAX_RECORDS) {
+      INFO("History full. Dropping oldest MinMaxTemp\n");
+      dropOldest();
+    }
+    minMaxVec.push_back(MinMaxTemp(period));
+    ++version;
+  }
+
+  auto &cur = minMaxVec.back();
+  u32 before = version;
+
+  if (temp < cur.minTemp) {
+    INFO("New minTemp: %d -> %d (1/16 C)\n", cur.minTemp, temp);
+    cur.minTemp = temp;
+    snprintf(cur.minTime, sizeof(cur.minTime), "%s", time);
+    ++version;
+  }
+  if (temp > cur.maxTemp) {
+    INFO("New maxTemp: %d -> %d (1/16 C)\n", cur.maxTemp, temp);
+    cur.maxTemp = temp;
+    snprintf(cur.maxTime, sizeof(cur.maxTime), "%s", time);
+    ++version;
+  }
+  if (version != before) {
+    saveRtcPeriod(cur);
+  }
+}
+
+bool restoreCurrentPeriod() {
+  RtcPeriod p;
+  readRtcPeriod(&p);
+  lockHistory();
+  if (!minMaxVec.empty() || p.magic != RTC_PERIOD_MAGIC ||
+      p.crc != crc32Update(0, &p, offsetof(RtcPeriod, crc))) {
+    unlockHistory();
+    return false;
+  }
+  INFO_TEXT("Restoring MinMaxTemp from RTC memory. periodStr=\"%s\"\n",
+            p.periodStr);
+  minMaxVec.reserve(MAX_RECORDS);
+  minMaxVec.push_back(MinMaxTemp(p.periodStr));
+  auto &cur = minMaxVec.back();
+  memcpy(cur.minTime, p.minTime, sizeof(cur.minTime));
+  memcpy(cur.maxTime, p.maxTime, sizeof(cur.maxTime));
+  cur.minTemp = p.minTemp;
+  cur.maxTemp = p.maxTemp;
+  ++version;
+  unlockHistory();
+  return true;
+}
+
+void registerAt(Temp16 temp, time_t t) {
+  // The date and time strings share a buffer, so copy the date.
+  s8 period[PERIOD_LENGTH];
+  snprintf(period, sizeof(period), "%s", getLocalDateAt(t));
+  registerTempIn(temp, period, getLocalTimeAt(t));
+}
+
+void registerTempAt(Temp16 temp, time_t t) {
+  lockHistory();
+  registerAt(temp, t);
+  unlockHistory();
+}
+
+// Halve the number of buckets by merging neighbours. The extremes, and when
+// they happened, are kept exactly. Only how they split across a midnight
+// inside a merged bucket is lost.
+void mergePreSync() {
+  size_t n = 0;
+  for (size_t i = 0; i < preSyncCount; i += 2, ++n) {
+    PreSyncBucket b = preSync[i];
+    if (i + 1 < preSyncCount) {
+      auto &next = preSync[i + 1];
+      if (next.minTemp < b.minTemp) {
+        b.minTemp = next.minTemp;
+        b.minS = next.minS;
+      }
+      if (next.maxTemp > b.maxTemp) {
+        b.maxTemp = next.maxTemp;
+        b.maxS = next.maxS;
+      }
+    }
+    preSync[n] = b;
+  }
+  preSyncCount = n;
+  preSyncSpanS *= 2;
+  INFO("Merged pre-sync buckets. count=%u spanS=%u\n", (u32)preSyncCount,
+       preSyncSpanS);
+}
+
+void bufferPreSync(Temp16 temp, u32 uptimeS) {
+  if (preSyncCount &&
+      uptimeS - preSync[preSyncCount - 1].startS >= preSyncSpanS &&
+      preSyncCount == PRESYNC_BUCKETS) {
+    mergePreSync();
+  }
+  if (!preSyncCount ||
+      uptimeS - preSync[preSyncCount - 1].startS >= preSyncSpanS) {
+    preSync[preSyncCount++] = {uptimeS, uptimeS, uptimeS, temp, temp};
+    return;
+  }
+  auto &b = preSync[preSyncCount - 1];
+  if (temp < b.minTemp) {
+    b.minTemp = temp;
+    b.minS = uptimeS;
+  }
+  if (temp > b.maxTemp) {
+    b.maxTemp = temp;
+    b.maxS = uptimeS;
+  }
+}
+
+// File the buffered extremes under their local dates, oldest first, now that
+// the wall clock time of boot is known.
+void foldPreSync(time_t bootTime) {
+  INFO("Filing %u pre-sync buckets. bootTime=%ld\n", (u32)preSyncCount,
+       (long)bootTime);
+  for (size_t i = 0; i < preSyncCount; ++i) {
+    auto &b = preSync[i];
+    if (b.minS <= b.maxS) {
+      registerAt(b.minTemp, bootTime + b.minS);
+      registerAt(b.maxTemp, bootTime + b.maxS);
+    } else {
+      registerAt(b.maxTemp, bootTime + b.maxS);
+      registerAt(b.minTemp, bootTime + b.minS);
+    }
+  }
+  preSyncCount = 0;
+  preSyncSpanS = PRESYNC_FIRST_SPAN_S;
+}
 
 // Update max/min temp for current period if current is higher/lower.
 // Period names don't have to be unique. A new period is created if the
 // one provided in the call in different from the period that was added last.
-void registerTemp(float tempCelcius) {
+// Before the first NTP sync, samples are buffered against the time since boot.
+void registerTemp(Temp16 temp) {
+  u32 uptimeS = getUptimeS();
   if (!haveTime()) {
-    INFO("Ignored temperature registration. Don't have an NTP time yet\n");
+    bufferPreSync(temp, uptimeS);
     return;
   }
+  lockHistory();
+  if (preSyncCount) {
+    foldPreSync(getNow() - uptimeS);
+  }
 
-  auto periodStr = std::string(getCurrentLocalDate());
-  size_t freeSize = heap_caps_get_free_size(MALLOC_CAP_8BIT);
-  INFO("Current free heap: %d bytes\n", freeSize);
+  // The date and time strings share a buffer, so copy the date.
+  s8 period[PERIOD_LENGTH];
+  snprintf(period, sizeof(period), "%s", getCurrentLocalDate());
+  registerTempIn(temp, period, getCurrentLocalTime());
+  unlockHistory();
+}
 
-//  if (minMaxVec.empty() || minMaxVec.back().periodStr != periodStr) {
-    INFO("Adding new MinMaxTemp. periodStr=\"%s\"\n", periodStr.c_str());
-    minMaxVec.push_back(MinMaxTemp(periodStr));
-//  }
+// Set when an import drops a cache's lines, for finishImport() to cache them
+// again. In between, the days are formatted on request.
+bool importClearedCache = false;
 
-  auto &cur = minMaxVec.back();
+// A record at idx is about to be inserted. Keep a cache's lines, moved up,
+// unless the record goes among them, or right before the first deflated
+// one, which is deflated against the record before it.
+void insertCached(LineCache &c, size_t idx) {
+  if (!c.count) {
+    // Still ends at the current record, which moves up.
+    taskENTER_CRITICAL();
+    c.from = minMaxVec.size();
+    taskEXIT_CRITICAL();
+  } else if (idx < c.from || (idx == c.from && !c.lens)) {
+    taskENTER_CRITICAL();
+    ++c.from;
+    taskEXIT_CRITICAL();
+  } else {
+    clearCache(c);
+    importClearedCache = true;
+  }
+}
 
-  while (freeSize < 5 * 1024 and !minMaxVec.empty()) {
-    INFO("Getting low on heap. Dropping oldest MinMaxTemp. curSize=%d\n",
-         minMaxVec.size());
-    // pop_front()
-    minMaxVec.erase(minMaxVec.begin());
-    freeSize = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+// The record at idx has changed. Drop a cache whose lines depend on it.
+void changeCached(LineCache &c, size_t idx) {
+  size_t first = c.lens && c.from ? c.from - 1 : c.from;
+  if (c.count && idx >= first && idx < c.from + c.count) {
+    clearCache(c);
+    importClearedCache = true;
   }
+}
 
-  if (tempCelcius < cur.minTemp) {
-    INFO("New minTemp: %f -> %f\n", cur.minTemp, tempCelcius);
-    cur.minTemp = tempCelcius;
-    cur.minTime = getCurrentLocalTime();
+ImportResult importDay(const s8 *period, const s8 *minTime, Temp16 minTemp,
+                       const s8 *maxTime, Temp16 maxTemp) {
+  lockHistory();
+  if (minMaxVec.empty()) {
+    unlockHistory();
+    return IMPORT_NOT_READY;
+  }
+  ImportResult result = IMPORT_UNCHANGED;
+  size_t idx = 0;
+  while (idx < minMaxVec.size() && strcmp(minMaxVec[idx].periodStr, period)) {
+    ++idx;
   }
-  if (tempCelcius > cur.maxTemp) {
-    INFO("New maxTemp: %f -> %f\n", cur.maxTemp, tempCelcius);
-    cur.maxTemp = tempCelcius;
-    cur.maxTime = getCurrentLocalTime();
+  if (idx < minMaxVec.size()) {
+    auto &mm = minMaxVec[idx];
+    if (minTemp < mm.minTemp) {
+      mm.minTemp = minTemp;
+      snprintf(mm.minTime, sizeof(mm.minTime), "%s", minTime);
+      result = IMPORT_MERGED;
+    }
+    if (maxTemp > mm.maxTemp) {
+      mm.maxTemp = maxTemp;
+      snprintf(mm.maxTime, sizeof(mm.maxTime), "%s", maxTime);
+      result = IMPORT_MERGED;
+    }
+    if (result == IMPORT_MERGED && idx + 1 == minMaxVec.size()) {
+      saveRtcPeriod(mm);
+    } else if (result == IMPORT_MERGED) {
+      changeCached(rendered, idx);
+#ifdef CONFIG_HTTP_GZIP
+      changeCached(deflated, idx);
+#endif
+    }
+  } else if (strcmp(period, minMaxVec[importedRecords].periodStr) > 0) {
+    // Only older days are added, so that the closed days keep their
+    // numbers. A gap in the days kept stays a gap.
+    result = IMPORT_SKIPPED;
+  } else {
+    // The imported days are in order, before the oldest day kept.
+    idx = 0;
+    while (idx < importedRecords &&
+           strcmp(minMaxVec[idx].periodStr, period) < 0) {
+      ++idx;
+    }
+    if (minMaxVec.size() == MAX_RECORDS && idx == 0) {
+      // It would be the one dropped to make room.
+      result = IMPORT_SKIPPED;
+    } else {
+      if (minMaxVec.size() == MAX_RECORDS) {
+        dropOldest();
+        --idx;
+      }
+      MinMaxTemp mm(period);
+      snprintf(mm.minTime, sizeof(mm.minTime), "%s", minTime);
+      snprintf(mm.maxTime, sizeof(mm.maxTime), "%s", maxTime);
+      mm.minTemp = minTemp;
+      mm.maxTemp = maxTemp;
+      insertCached(rendered, idx);
+#ifdef CONFIG_HTTP_GZIP
+      insertCached(deflated, idx);
+#endif
+      minMaxVec.insert(minMaxVec.begin() + idx, mm);
+      ++importedRecords;
+      ++shifts;
+      result = IMPORT_ADDED;
+    }
   }
+  if (result == IMPORT_ADDED || result == IMPORT_MERGED) {
+    ++version;
+  }
+  unlockHistory();
+  return result;
+}
+
+void finishImport() {
+  lockHistory();
+  if (importClearedCache) {
+    rebuildCache();
+    importClearedCache = false;
+  }
+  unlockHistory();
 }
 
 size_t getMinMaxCount() { return minMaxVec.size(); }
 
+u32 getTrackerVersion() { return version; }
+
+// The current record is never an imported one, see importDay().
+u32 closedCount() {
+  return minMaxVec.empty() ? firstClosed
+                           : firstClosed + minMaxVec.size() - 1 -
+                                 importedRecords;
+}
+
+u32 getClosedCount() {
+  lockHistory();
+  u32 n = closedCount();
+  unlockHistory();
+  return n;
+}
+
+bool getClosedLine(u32 n, s8 *lineBuf, size_t maxLen) {
+  lockHistory();
+  bool kept = n >= firstClosed && n < closedCount();
+  if (kept) {
+    getMinMaxLine(lineBuf, maxLen, importedRecords + n - firstClosed);
+  }
+  unlockHistory();
+  return kept;
+}
+
+// Get the min and max values for the current period. Returns false if no
+// period has been started yet.
+bool getCurrentMinMax(Temp16 *minTemp, Temp16 *maxTemp) {
+  lockHistory();
+  bool ok = !minMaxVec.empty();
+  if (ok) {
+    *minTemp = minMaxVec.back().minTemp;
+    *maxTemp = minMaxVec.back().maxTemp;
+  }
+  unlockHistory();
+  return ok;
+}
+
 // Get the min and max values for a period as JSON.
 void getMinMaxLine(s8 *lineBuf, size_t maxLen, size_t lineIdx) {
   auto &mm = minMaxVec[lineIdx];
+  s8 minStr[10];
+  s8 maxStr[10];
+  temp16Format(minStr, sizeof(minStr), mm.minTemp);
+  temp16Format(maxStr, sizeof(maxStr), mm.maxTemp);
   snprintf(lineBuf, maxLen,
            "{ "
            "\"period\": \"%s\", "
            "\"minTime\": \"%s\", "
-           "\"minTemp\": \"%.02f\", "
+           "\"minTemp\": \"%s\", "
            "\"maxTime\": \"%s\", "
-           "\"maxTemp\": \"%.02f\""
+           "\"maxTemp\": \"%s\""
            " }",
-           mm.periodStr.c_str(), mm.minTime.c_str(), mm.minTemp,
-           mm.maxTime.c_str(), mm.maxTemp);
+           mm.periodStr, mm.minTime, minStr, mm.maxTime, maxStr);
+}
+
+void getCacheRange(const LineCache &c, RenderedRange *range) {
+  lockHistory();
+  range->records = minMaxVec.size();
+  range->shifts = shifts;
+  taskENTER_CRITICAL();
+  range->firstLine = c.from;
+  range->lines = c.count;
+  range->startPos = c.base + c.start;
+  range->endPos = c.base + c.len;
+  range->plainBytes = c.plainBytes;
+  range->plainCrc = c.plainCrc;
+  taskEXIT_CRITICAL();
+  unlockHistory();
+}
+
+bool getMinMaxLineSince(s8 *lineBuf, size_t maxLen, size_t lineIdx,
+                        u32 since) {
+  lockHistory();
+  bool same = since == shifts && lineIdx < minMaxVec.size();
+  if (same) {
+    getMinMaxLine(lineBuf, maxLen, lineIdx);
+  }
+  unlockHistory();
+  return same;
+}
+
+int readCache(const LineCache &c, u32 *pos, u32 endPos, s8 *buf,
+              size_t maxLen) {
+  taskENTER_CRITICAL();
+  if ((s32)(*pos - c.base) < 0) {
+    taskEXIT_CRITICAL();
+    return -1;
+  }
+  size_t n = endPos - *pos;
+  if (n > maxLen) {
+    n = maxLen;
+  }
+  memcpy(buf, c.buf + (*pos - c.base), n);
+  taskEXIT_CRITICAL();
+  *pos += n;
+  return (int)n;
+}
+
+void getRenderedRange(RenderedRange *range) { getCacheRange(rendered, range); }
+
+int readRendered(u32 *pos, u32 endPos, s8 *buf, size_t maxLen) {
+  return readCache(rendered, pos, endPos, buf, maxLen);
+}
+
+#ifdef CONFIG_HTTP_GZIP
+void getDeflatedRange(RenderedRange *range) { getCacheRange(deflated, range); }
+
+int readDeflated(u32 *pos, u32 endPos, BitWriter *w) {
+  const LineCache &c = deflated;
+  // Held bits and the copied ones must fit in whole bytes.
+  u32 room = (w->max - w->len) * 8;
+  room = room > 8 ? room - 8 : 0;
+  taskENTER_CRITICAL();
+  if ((s32)(*pos - c.base) < 0) {
+    taskEXIT_CRITICAL();
+    return -1;
+  }
+  u32 n = endPos - *pos;
+  n = n < room ? n : room;
+  n = n < DEFLATED_READ_BITS ? n : DEFLATED_READ_BITS;
+  copyBits(w, (const u8 *)c.buf, *pos - c.base, n);
+  taskEXIT_CRITICAL();
+  *pos += n;
+  return (int)n;
+}
+#endif
+
+void getTrackerMemory(TrackerMemory *mem) {
+  mem->budgetBytes = BUDGET_BYTES;
+  mem->usedBytes = usedBytes;
+  mem->recordBytes = sizeof(MinMaxTemp);
+  mem->records = minMaxVec.size();
+  mem->maxRecords = MAX_RECORDS;
+  mem->droppedRecords = droppedRecords;
+  mem->cacheBudgetBytes = RENDER_CACHE_BYTES;
+  mem->cacheUsedBytes = rendered.len;
+  mem->cachedRecords = rendered.count;
+#ifdef CONFIG_HTTP_GZIP
+  mem->gzipCacheBudgetBytes = GZIP_CACHE_BYTES;
+  mem->gzipCacheUsedBytes = cacheBytes(deflated, deflated.len);
+  mem->gzipCachedRecords = deflated.count;
+  mem->gzipCachePlainBytes = deflated.plainBytes;
+#else
+  mem->gzipCacheBudgetBytes = 0;
+  mem->gzipCacheUsedBytes = 0;
+  mem->gzipCachedRecords = 0;
+  mem->gzipCachePlainBytes = 0;
+#endif
 }
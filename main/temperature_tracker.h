@@ -1,12 +1,112 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+
+#include "deflate.h"
+#include "int_types.h"
+#include "temperature.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-void registerTemp(float tempCelcius);
+typedef struct {
+  // Space for the whole history, and how much of it is allocated. All of it
+  // is allocated with the first record.
+  u32 budgetBytes;
+  u32 usedBytes;
+  u32 recordBytes;
+  u32 records;
+  u32 maxRecords;
+  // Oldest days dropped because the history was full.
+  u32 droppedRecords;
+  // The cache of rendered closed days.
+  u32 cacheBudgetBytes;
+  u32 cacheUsedBytes;
+  u32 cachedRecords;
+  // The cache of deflated closed days, and their size before deflating.
+  u32 gzipCacheBudgetBytes;
+  u32 gzipCacheUsedBytes;
+  u32 gzipCachedRecords;
+  u32 gzipCachePlainBytes;
+} TrackerMemory;
+
+// The closed days that are cached as rendered or deflated JSON lines, and
+// where their bytes are. See readRendered().
+typedef struct {
+  // Records in the history, the current one included.
+  size_t records;
+  // See getMinMaxLineSince().
+  u32 shifts;
+  size_t firstLine;
+  size_t lines;
+  u32 startPos;
+  u32 endPos;
+  // Length and CRC-32 of the lines before deflating.
+  u32 plainBytes;
+  u32 plainCrc;
+} RenderedRange;
+
+void registerTemp(Temp16 temp);
+// Register a reading taken at the given time, e.g. to restore history.
+void registerTempAt(Temp16 temp, time_t t);
+// Restore the current period, kept in RTC memory through deep sleep, so that
+// the day's extremes carry on. Call at boot, before the first registerTemp().
+// Returns false if RTC memory holds no period, e.g. after power-on. The
+// period closes as usual if the date has changed by the next sample.
+bool restoreCurrentPeriod();
+
+typedef enum {
+  IMPORT_ADDED,
+  // A day that's kept, given a lower min or a higher max.
+  IMPORT_MERGED,
+  IMPORT_UNCHANGED,
+  // Not kept, and newer than the oldest day kept, or older than all days of
+  // a full history.
+  IMPORT_SKIPPED,
+  // No day has started yet, e.g. before the first NTP sync.
+  IMPORT_NOT_READY,
+} ImportResult;
+
+// Merge a day of another history, e.g. of a unit this one replaces. A day
+// that's kept gets the lower min and the higher max of the two, with their
+// times. Days older than the oldest kept are added, in date order, and the
+// oldest are dropped when the history is full. Imported days aren't counted
+// as closed, see getClosedCount(), so they aren't published. Call from one
+// task at a time, then finishImport().
+ImportResult importDay(const s8 *period, const s8 *minTime, Temp16 minTemp,
+                       const s8 *maxTime, Temp16 maxTemp);
+// Cache the lines of changed days again.
+void finishImport();
 size_t getMinMaxCount();
+// Changes whenever the history does. Starts from 0 at boot.
+u32 getTrackerVersion();
+// Records closed since boot, dropped ones included, imported ones not.
+// getClosedLine() gets the line of the n-th, from 0, and returns false if it
+// has been dropped.
+u32 getClosedCount();
+bool getClosedLine(u32 n, s8 *lineBuf, size_t maxLen);
+bool getCurrentMinMax(Temp16 *minTemp, Temp16 *maxTemp);
 void getMinMaxLine(s8 *lineBuf, size_t maxLen, size_t lineIdx);
+// The same, for a task other than the sampler's, with the indices of a range
+// taken earlier. Returns false if the records have moved since, e.g. the
+// oldest was dropped at a day change, or lineIdx is past the end.
+bool getMinMaxLineSince(s8 *lineBuf, size_t maxLen, size_t lineIdx,
+                        u32 since);
+void getTrackerMemory(TrackerMemory *mem);
+void getRenderedRange(RenderedRange *range);
+// Copy cached bytes from *pos, up to endPos, and advance *pos. Returns the
+// number of bytes, 0 at endPos, or -1 if the bytes at *pos have been dropped
+// to make room since the range was taken.
+int readRendered(u32 *pos, u32 endPos, s8 *buf, size_t maxLen);
+// The same for the deflated lines, with CONFIG_HTTP_GZIP, except that
+// positions are in bits, and the bits are copied to a writer, as much as
+// fits. The lines are deflate codes that match back into the line before
+// the first one.
+void getDeflatedRange(RenderedRange *range);
+int readDeflated(u32 *pos, u32 endPos, BitWriter *w);
 
 #ifdef __cplusplus
 } // extern "C"
@@ -1,34 +1,70 @@
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 #include "driver/gpio.h"
 #include "esp8266/eagle_soc.h"
 #include "rom/ets_sys.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+
+#include <stdbool.h>
+#include <string.h>
 
 #include "int_types.h"
+#include "power.h"
 #include "tm1637.h"
 
+void _tm1637WriteChanged(const u8 *rawArr);
+void _tm1637DisplayTask(void *pvParameters);
 void _tm1637Start();
 void _tm1637Stop();
 void _tm1637ReadResult();
 void _tm1637WriteByte(u8 b);
-void _tm1637ClkHigh();
-void _tm1637ClkLow();
-void _tm1637DioHigh();
-void _tm1637DioLow();
-
-// Configuration.
 
-// For dev board
-//const int TM1637_CLK_PIN = 4;
-//const int TM1637_DIO_PIN = 5;
-// For deploying on a bare-bones board, like the ESP-01
-const int TM1637_CLK_PIN = 1;
-const int TM1637_DIO_PIN = 3;
+#define TM1637_CLK_PIN CONFIG_TM1637_CLK_PIN
+#define TM1637_DIO_PIN CONFIG_TM1637_DIO_PIN
+
+_Static_assert(TM1637_CLK_PIN != TM1637_DIO_PIN,
+               "TM1637 CLK and DIO must be different pins");
+_Static_assert(TM1637_CLK_PIN != CONFIG_ONEWIRE_PIN &&
+                   TM1637_DIO_PIN != CONFIG_ONEWIRE_PIN,
+               "The TM1637 pins must not be the onewire pin");
+
+// The pins are open drain, so writing 1 releases the line to the pull-up.
+// Direct register writes, with the masks known at compile time.
+#define _tm1637ClkHigh()                                                       \
+  GPIO_REG_WRITE(GPIO_OUT_W1TS_ADDRESS, 1 << TM1637_CLK_PIN)
+#define _tm1637ClkLow()                                                        \
+  GPIO_REG_WRITE(GPIO_OUT_W1TC_ADDRESS, 1 << TM1637_CLK_PIN)
+#define _tm1637DioHigh()                                                       \
+  GPIO_REG_WRITE(GPIO_OUT_W1TS_ADDRESS, 1 << TM1637_DIO_PIN)
+#define _tm1637DioLow()                                                        \
+  GPIO_REG_WRITE(GPIO_OUT_W1TC_ADDRESS, 1 << TM1637_DIO_PIN)
 
 const char segmentMap[] = {
     0x3f, 0x06, 0x5b, 0x4f, 0x66, 0x6d, 0x7d, 0x07, // 0-7
     0x7f, 0x6f, 0x77, 0x7c, 0x39, 0x5e, 0x79, 0x71, // 8-9, A-F
-    0x00};
+    0x00, 0x40, 0x38, 0x76, 0x5c, 0x04, 0x50, 0x54, // space - L H o i r n
+    0x78};                                          // t
+
+// Half of a bit period on the bus. The TM1637 accepts clock rates up to a
+// few hundred kHz, so this leaves a good margin for slow edges caused by the
+// pull-ups and the capacitors on the common display modules.
+#define TM1637_HALF_BIT_US 5
+
+#define TM1637_CMD_DATA_FIXED_ADDR 0x44
+#define TM1637_CMD_ADDRESS 0xc0
 
-void delay_(int d) { os_delay_us(d * 100); }
+// Segments currently shown, by display position. Used for only sending the
+// digits that changed.
+static u8 shownRaw[4];
+static bool shownValid = false;
+
+// Segments waiting to be written by the display task.
+static u8 pendingArr[4];
+static TaskHandle_t displayTaskHandle = NULL;
+static uint8_t ucTm1637TaskParams;
+
+void delay_() { os_delay_us(TM1637_HALF_BIT_US); }
 
 void tm1637Init() {
   gpio_config_t io_conf;
@@ -63,23 +99,71 @@ void tm1637DisplayDecimal(int v, int displaySeparator) {
 // Display a string containing hex digits and spaces
 // 0x00 = 0
 // 0x0f = F
-// 0x10 = space
+// 0x10 - 0x18 = TM1637_GLYPH_*
+// Only digits that differ from what is already shown are sent.
 void tm1637DisplaySegments(const u8 *segmentArr) {
-  _tm1637Start();
-  _tm1637WriteByte(0x40);
-  _tm1637ReadResult();
-  _tm1637Stop();
+  u8 rawArr[4];
+  for (int i = 0; i < 4; ++i) {
+    rawArr[i] = (u8)segmentMap[segmentArr[3 - i]];
+  }
+  _tm1637WriteChanged(rawArr);
+}
 
-  _tm1637Start();
-  _tm1637WriteByte(0xc0);
-  _tm1637ReadResult();
+// Start a low priority task that writes to the display, so that callers of
+// tm1637SetSegments() never wait on the bit-banged bus.
+void tm1637StartTask() {
+  xTaskCreate(_tm1637DisplayTask, "tm1637Task", 1024, &ucTm1637TaskParams,
+              tskIDLE_PRIORITY, &displayTaskHandle);
+  configASSERT(displayTaskHandle);
+}
+
+// Queue a segment string (same format as tm1637DisplaySegments()) for
+// display and return immediately. If called again before the display task
+// gets to run, only the latest string is shown.
+void tm1637SetSegments(const u8 *segmentArr) {
+  taskENTER_CRITICAL();
+  memcpy(pendingArr, segmentArr, sizeof(pendingArr));
+  taskEXIT_CRITICAL();
+  xTaskNotifyGive(displayTaskHandle);
+}
+
+void _tm1637DisplayTask(void *pvParameters) {
+  u8 segmentArr[4];
+  while (true) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    taskENTER_CRITICAL();
+    memcpy(segmentArr, pendingArr, sizeof(segmentArr));
+    taskEXIT_CRITICAL();
+    s64 startUs = esp_timer_get_time();
+    tm1637DisplaySegments(segmentArr);
+    powerAwake((u32)(esp_timer_get_time() - startUs));
+  }
+}
 
+// Write the digits that changed, using fixed address mode so that each digit
+// can be written on its own.
+void _tm1637WriteChanged(const u8 *rawArr) {
+  bool modeSent = false;
   for (int i = 0; i < 4; ++i) {
-    _tm1637WriteByte((u8)segmentMap[segmentArr[3 - i]]);
+    if (shownValid && shownRaw[i] == rawArr[i]) {
+      continue;
+    }
+    if (!modeSent) {
+      _tm1637Start();
+      _tm1637WriteByte(TM1637_CMD_DATA_FIXED_ADDR);
+      _tm1637ReadResult();
+      _tm1637Stop();
+      modeSent = true;
+    }
+    _tm1637Start();
+    _tm1637WriteByte(TM1637_CMD_ADDRESS + i);
+    _tm1637ReadResult();
+    _tm1637WriteByte(rawArr[i]);
     _tm1637ReadResult();
+    _tm1637Stop();
+    shownRaw[i] = rawArr[i];
   }
-
-  _tm1637Stop();
+  shownValid = true;
 }
 
 // Valid brightness values: 0 - 8.
@@ -100,28 +184,28 @@ void tm1637SetBrightness(char brightness) {
 void _tm1637Start() {
   _tm1637ClkHigh();
   _tm1637DioHigh();
-  delay_(2);
+  delay_();
   _tm1637DioLow();
-  delay_(2);
+  delay_();
 }
 
 // Input ends when CLK is high and DIO changes from low to high
 void _tm1637Stop() {
   _tm1637ClkLow();
-  delay_(2);
+  delay_();
   _tm1637DioLow();
-  delay_(2);
+  delay_();
   _tm1637ClkHigh();
-  delay_(2);
+  delay_();
   _tm1637DioHigh();
 }
 
 void _tm1637ReadResult() {
   _tm1637ClkLow();
-  delay_(5);
+  delay_();
   // We're cheating here and not actually reading back the response.
   _tm1637ClkHigh();
-  delay_(2);
+  delay_();
   _tm1637ClkLow();
 }
 
@@ -129,20 +213,14 @@ void _tm1637ReadResult() {
 void _tm1637WriteByte(u8 b) {
   for (int i = 0; i < 8; ++i) {
     _tm1637ClkLow();
-    delay_(3);
     if (b & 0x01) {
       _tm1637DioHigh();
     } else {
       _tm1637DioLow();
     }
-    delay_(3);
+    delay_();
     b >>= 1;
     _tm1637ClkHigh();
-    delay_(3);
+    delay_();
   }
 }
-
-void _tm1637ClkHigh() { gpio_set_level(TM1637_CLK_PIN, 1); }
-void _tm1637ClkLow() { gpio_set_level(TM1637_CLK_PIN, 0); }
-void _tm1637DioHigh() { gpio_set_level(TM1637_DIO_PIN, 1); }
-void _tm1637DioLow() { gpio_set_level(TM1637_DIO_PIN, 0); }
@@ -2,7 +2,20 @@
 
 #include "int_types.h"
 
+// Glyphs beyond the hex digits 0x00 - 0x0f.
+#define TM1637_GLYPH_BLANK 0x10
+#define TM1637_GLYPH_MINUS 0x11
+#define TM1637_GLYPH_L 0x12
+#define TM1637_GLYPH_H 0x13
+#define TM1637_GLYPH_O_LOWER 0x14
+#define TM1637_GLYPH_I_LOWER 0x15
+#define TM1637_GLYPH_R_LOWER 0x16
+#define TM1637_GLYPH_N_LOWER 0x17
+#define TM1637_GLYPH_T_LOWER 0x18
+
 void tm1637Init();
 void tm1637DisplayDecimal(int v, int displaySeparator);
 void tm1637DisplaySegments(const u8 *segmentArr);
+void tm1637StartTask();
+void tm1637SetSegments(const u8 *segmentArr);
 void tm1637SetBrightness(char brightness);
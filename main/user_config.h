@@ -1,11 +1,33 @@
 # pragma once
 
+#include "sdkconfig.h"
+#include "log_ring.h"
+
 #define DEBUG_ON
 // #define MQTT_DEBUG_ON
 
 // DEBUG OPTIONS
-#if defined(DEBUG_ON)
-#define INFO(format, ...) os_printf(format, ##__VA_ARGS__)
+//
+// INFO() records into the log ring, which is read at /log. Its arguments
+// must be integers, or strings that outlive the log. INFO_TEXT() formats
+// right away, for strings in buffers that will be reused. With
+// CONFIG_LOG_UART, both also print to the UART, which on the ESP-01 shares
+// a pin with the display clock.
+#if defined(DEBUG_ON) && defined(CONFIG_LOG_UART)
+#define INFO(format, ...)                                                      \
+  do {                                                                         \
+    LOG_WRITE(format, ##__VA_ARGS__);                                          \
+    os_printf(format, ##__VA_ARGS__);                                          \
+  } while (0)
+#define INFO_TEXT(format, ...)                                                 \
+  do {                                                                         \
+    logText(format, ##__VA_ARGS__);                                            \
+    os_printf(format, ##__VA_ARGS__);                                          \
+  } while (0)
+#elif defined(DEBUG_ON)
+#define INFO(format, ...) LOG_WRITE(format, ##__VA_ARGS__)
+#define INFO_TEXT(format, ...) logText(format, ##__VA_ARGS__)
 #else
 #define INFO(format, ...)
+#define INFO_TEXT(format, ...)
 #endif